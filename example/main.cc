@@ -67,7 +67,7 @@ int main(int argc, char** argv) {
     interp.create_return();
 
     /// Define a function.
-    interp.defun("display", [](interp::interpreter& i) { fmt::print("{}\n", i.arg(0, INTERP_SIZE_MASK_32)); });
+    interp.defun("display", [](interp::context& i) { fmt::print("{}\n", i.arg(0, INTERP_SIZE_MASK_32)); });
 
     /// Disassemble.
     if (options::get<"-d">()) {
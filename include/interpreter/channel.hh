@@ -0,0 +1,139 @@
+#ifndef INTERPRETER_CHANNEL_HH
+#define INTERPRETER_CHANNEL_HH
+
+#include <atomic>
+#include <functional>
+#include <interpreter/interp.hh>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace interp {
+/// ===========================================================================
+///  Channels.
+/// ===========================================================================
+/// A bounded queue of messages that connects contexts, e.g. the stages
+/// of a pipeline of guest programs.
+///
+/// The host creates a channel and attaches it to each context that uses
+/// it; guests then send and receive through the natives defined by
+/// module::defun_channels(). A message is a buffer of bytes; a word is
+/// sent as a buffer of 8 bytes.
+///
+/// The queue itself never takes a lock. Single-producer channels use
+/// a ring with one index per side (Lamport, 1983); multi-producer ones
+/// use a ring with a sequence number per cell (Vyukov, 2010). Messages
+/// are heap-allocated buffers, however, so sending from a guest allocates
+/// one per message, and the allocator may lock.
+class channel {
+public:
+    using message = std::vector<u8>;
+
+    /// Who may use the channel.
+    enum struct kind : u8 {
+        /// One thread sends, and one thread receives.
+        spsc,
+
+        /// Any number of threads send and receive.
+        mpmc,
+    };
+
+private:
+    struct cell {
+        std::atomic<u64> seq;
+        message msg;
+    };
+
+    const kind type;
+    const u64 mask;
+    std::unique_ptr<cell[]> cells;
+
+    /// Next positions to send to and receive from.
+    alignas(64) std::atomic<u64> head{};
+    alignas(64) std::atomic<u64> tail{};
+
+    /// Bumped whenever a message is sent or received, or the channel is
+    /// closed, so that blocked threads can wait for them to change.
+    alignas(64) std::atomic<u32> sent{};
+    std::atomic<u32> received{};
+    std::atomic<bool> is_closed{};
+
+    /// One-shot callbacks of runs that are blocked on the channel, and
+    /// who registered them.
+    using watcher = std::pair<const void*, std::function<void()>>;
+    std::mutex watch_mutex;
+    std::vector<watcher> waiting_for_message;
+    std::vector<watcher> waiting_for_room;
+    std::atomic<bool> watched{};
+
+    bool push(message& m);
+    bool pop(message& m);
+
+    /// Add a callback, replacing the one of the same owner, if any.
+    void watch(std::vector<watcher>& callbacks, std::function<void()> callback, const void* owner);
+
+    /// Call and remove callbacks. Cheap if there are none.
+    void wake(std::vector<watcher>& callbacks);
+
+public:
+    /// Create a channel.
+    ///
+    /// \param k Who may use the channel.
+    /// \param capacity The maximum number of messages in the channel.
+    ///        This is rounded up to a power of two.
+    explicit channel(kind k, usz capacity);
+
+    channel(const channel&) = delete;
+    channel(channel&&) noexcept = delete;
+    channel& operator=(const channel&) = delete;
+    channel& operator=(channel&&) noexcept = delete;
+
+    /// Get the maximum number of messages in the channel.
+    usz capacity() const { return usz(mask + 1); }
+
+    /// Close the channel. Sending fails from then on; receiving fails
+    /// once the channel is empty. Wakes up all blocked threads.
+    void close();
+
+    /// Check whether the channel has been closed.
+    bool closed() const { return is_closed.load(std::memory_order_acquire); }
+
+    /// Send a message, or fail if the channel is full or closed. If this
+    /// fails, the message is left as is.
+    bool try_send(message& m);
+
+    /// Receive a message, or fail if the channel is empty.
+    std::optional<message> try_receive();
+
+    /// Send a message, waiting for room if the channel is full.
+    ///
+    /// \return False if the channel is closed.
+    bool send(message m);
+
+    /// Receive a message, waiting for one if the channel is empty.
+    ///
+    /// \return The message, or nothing if the channel is closed and empty.
+    std::optional<message> receive();
+
+    /// Call a function once, the next time a message is sent or the channel
+    /// is closed. Check again after calling this, since that may already
+    /// have happened.
+    ///
+    /// \param callback The function to call.
+    /// \param owner If not null, replaces a callback with the same owner
+    ///        that hasn’t been called yet instead of adding another one.
+    void notify_on_send(std::function<void()> callback, const void* owner = nullptr);
+
+    /// Call a function once, the next time a message is received or the
+    /// channel is closed. Check again after calling this, since that may
+    /// already have happened.
+    ///
+    /// \param callback The function to call.
+    /// \param owner As for notify_on_send().
+    void notify_on_receive(std::function<void()> callback, const void* owner = nullptr);
+};
+} // namespace interp
+
+#endif // INTERPRETER_CHANNEL_HH
@@ -0,0 +1,142 @@
+#ifndef INTERPRETER_EXECUTOR_HH
+#define INTERPRETER_EXECUTOR_HH
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <interpreter/pool.hh>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace interp {
+/// ===========================================================================
+///  Executor.
+/// ===========================================================================
+/// A thread pool that runs guest executions (or any other jobs) on all cores.
+///
+/// Each worker thread has its own work-stealing deque. Jobs submitted by
+/// a worker go to its own deque; jobs submitted from other threads go to
+/// a shared injector queue. Idle workers take work from the injector queue
+/// and steal from the deques of other workers, so the load stays balanced
+/// even if jobs take wildly different amounts of time.
+///
+/// Modules can be shared between workers as-is; to avoid creating a new
+/// context for every execution, run them through a context_pool.
+class executor {
+public:
+    /// A unit of work.
+    using job = std::move_only_function<void()>;
+
+    /// Result callback of an execution. Exactly one of the two is set.
+    using callback = std::move_only_function<void(word result, std::exception_ptr error)>;
+
+private:
+    /// Work-stealing deque (Chase and Lev, 2005; with the memory orderings
+    /// of Lê et al., 2013). Only the owner pushes and pops at the bottom;
+    /// everyone else steals from the top.
+    class work_deque {
+        struct ring {
+            i64 capacity;
+            std::unique_ptr<std::atomic<job*>[]> slots;
+
+            explicit ring(i64 cap) : capacity(cap), slots(new std::atomic<job*>[usz(cap)]) {}
+            job* get(i64 i) const { return slots[usz(i & (capacity - 1))].load(std::memory_order_relaxed); }
+            void put(i64 i, job* j) { slots[usz(i & (capacity - 1))].store(j, std::memory_order_relaxed); }
+        };
+
+        alignas(64) std::atomic<i64> top{0};
+        alignas(64) std::atomic<i64> bottom{0};
+        std::atomic<ring*> buffer;
+
+        /// Rings that have been replaced. Thieves may still be reading
+        /// from them, so they are only freed with the deque.
+        std::vector<std::unique_ptr<ring>> rings;
+
+    public:
+        work_deque();
+
+        /// Push a job. Owner only.
+        void push(job* j);
+
+        /// Pop the most recently pushed job. Owner only.
+        job* pop();
+
+        /// Steal the least recently pushed job.
+        job* steal();
+    };
+
+    struct worker {
+        work_deque deque;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<worker>> workers;
+
+    /// Jobs submitted from outside the executor.
+    std::mutex injector_mutex;
+    std::deque<job*> injector;
+
+    /// Number of jobs that have been submitted but not yet started.
+    std::atomic<usz> queued{};
+
+    /// Number of workers waiting for work.
+    std::atomic<usz> sleeping{};
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    /// Queue a job.
+    void enqueue(job* j);
+
+    /// Find a job to run.
+    job* find_job(usz self);
+
+    /// Main loop of a worker.
+    void work(usz self);
+
+public:
+    /// Start the worker threads.
+    ///
+    /// \param threads Number of workers. Defaults to one per core.
+    /// \param pin_threads Whether to pin worker N to CPU N. Only supported on Linux.
+    explicit executor(usz threads = std::thread::hardware_concurrency(), bool pin_threads = false);
+
+    executor(const executor&) = delete;
+    executor(executor&&) noexcept = delete;
+    executor& operator=(const executor&) = delete;
+    executor& operator=(executor&&) noexcept = delete;
+
+    /// Run all remaining jobs and stop the worker threads.
+    ~executor() noexcept;
+
+    /// Get the number of worker threads.
+    usz size() const { return workers.size(); }
+
+    /// Run a job without waiting for it. If the job throws, the program
+    /// is terminated; use submit() to get exceptions back.
+    void post(job j);
+
+    /// Run a job and get its result as a future.
+    template <typename callable>
+    auto submit(callable&& c) -> std::future<std::invoke_result_t<callable>> {
+        std::packaged_task<std::invoke_result_t<callable>()> task{std::forward<callable>(c)};
+        auto fut = task.get_future();
+        post(std::move(task));
+        return fut;
+    }
+
+    /// Run the entry point of a module in a context from a pool.
+    std::future<word> execute(context_pool& pool);
+
+    /// Run the entry point of a module in a context from a pool, and
+    /// call a callback with the result on the worker thread.
+    void execute(context_pool& pool, callback cb);
+};
+} // namespace interp
+
+#endif // INTERPRETER_EXECUTOR_HH
@@ -10,6 +10,9 @@ extern "C" {
 
 /// Error codes.
 #define INTERP_OK (0)
+#define INTERP_ERR_OUT_OF_FUEL (2)
+#define INTERP_ERR_CANCELLED (3)
+#define INTERP_ERR_DEADLINE_EXCEEDED (4)
 
 /// Opaque type.
 typedef struct interp_handle_t* interp_handle;
@@ -25,6 +28,7 @@ typedef uint64_t interp_word;
 
 /// Address type.
 typedef uint64_t interp_address;
+typedef uint32_t interp_label;
 
 /// Size flags.
 typedef enum interp_size_mask {
@@ -34,6 +38,51 @@ typedef enum interp_size_mask {
     INTERP_SIZE_MASK_8 = 0b11000000,
 } interp_size_mask;
 
+/// Vector shape flags.
+///
+/// A shape is one lane size, optionally OR’d with INTERP_VECTOR_256
+/// and/or INTERP_VECTOR_SIGNED. Vectors are 128 bits wide by default.
+typedef enum interp_vector_shape {
+    INTERP_VECTOR_LANE_8 = 0,
+    INTERP_VECTOR_LANE_16 = 0b0001,
+    INTERP_VECTOR_LANE_32 = 0b0010,
+    INTERP_VECTOR_LANE_64 = 0b0011,
+    INTERP_VECTOR_256 = 0b0100,
+    INTERP_VECTOR_SIGNED = 0b1000,
+} interp_vector_shape;
+
+/// Memory order of an atomic operation.
+///
+/// These have the same meaning as the corresponding C11 memory orders.
+typedef enum interp_memory_order {
+    INTERP_MEMORY_ORDER_RELAXED = 0,
+    INTERP_MEMORY_ORDER_ACQUIRE = 1,
+    INTERP_MEMORY_ORDER_RELEASE = 2,
+    INTERP_MEMORY_ORDER_ACQ_REL = 3,
+    INTERP_MEMORY_ORDER_SEQ_CST = 4,
+} interp_memory_order;
+
+/// Outcome of a (partial) run.
+typedef enum interp_status {
+    INTERP_STATUS_FINISHED = 0,
+    INTERP_STATUS_SUSPENDED = 1,
+    INTERP_STATUS_CANCELLED = 2,
+    INTERP_STATUS_DEADLINE_EXCEEDED = 3,
+    INTERP_STATUS_BLOCKED = 4,
+} interp_status;
+
+/// How a parallel loop combines the return values of its chunks. MIN
+/// and MAX compare the values as unsigned integers; the _SIGNED variants
+/// compare them as two’s complement integers.
+typedef enum interp_reduction {
+    INTERP_REDUCE_NONE = 0,
+    INTERP_REDUCE_ADD = 1,
+    INTERP_REDUCE_MIN = 2,
+    INTERP_REDUCE_MAX = 3,
+    INTERP_REDUCE_MIN_SIGNED = 4,
+    INTERP_REDUCE_MAX_SIGNED = 5,
+} interp_reduction;
+
 /// ===========================================================================
 ///  Interpreter creation and destruction.
 /// ===========================================================================
@@ -71,6 +120,16 @@ interp_code interp_defun(
     void* user
 );
 
+/// Define a native function that runs a function on chunks of a range
+/// in parallel. See interp_create_parallel_for() for what it does; it
+/// takes the function in r2, the range in r3 and r4, and an
+/// interp_reduction in r5.
+///
+/// \param handle The interpreter handle.
+/// \param name The name of the binding.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_defun_parallel_for(interp_handle handle, const char* name);
+
 /// Disassemble the bytecode.
 ///
 /// \param handle The interpreter handle.
@@ -83,9 +142,113 @@ char* interp_disassemble(interp_handle handle);
 ///
 /// \param handle The interpreter handle.
 /// \param retval Out parameter for the return value. May be NULL.
-/// \return INTERP_OK (0) on success; a nonzero value on failure.
+/// \return INTERP_OK (0) on success; INTERP_ERR_OUT_OF_FUEL if fuel
+///         metering is enabled and the run ran out of fuel;
+///         INTERP_ERR_CANCELLED or INTERP_ERR_DEADLINE_EXCEEDED if the
+///         run was stopped; a nonzero value on any other failure.
 interp_code interp_run(interp_handle handle, interp_word* retval);
 
+/// Run the interpreter, but stop after a number of ticks.
+///
+/// A tick is a call or a backward jump. If the budget runs out, the
+/// run is suspended and can be continued with interp_resume().
+///
+/// \param handle The interpreter handle.
+/// \param max_ticks The maximum number of ticks to run for.
+/// \param status Out parameter for whether the run finished. May be NULL.
+/// \param retval Out parameter for the return value if the run finished. May be NULL.
+/// \return INTERP_OK (0) on success; INTERP_ERR_OUT_OF_FUEL if the run
+///         ran out of fuel; a nonzero value on any other failure.
+interp_code interp_run_for(
+    interp_handle handle,
+    interp_word max_ticks,
+    interp_status* status,
+    interp_word* retval
+);
+
+/// Continue a suspended run.
+///
+/// \param handle The interpreter handle.
+/// \param max_ticks The maximum number of ticks to run for.
+/// \param status Out parameter for whether the run finished. May be NULL.
+/// \param retval Out parameter for the return value if the run finished. May be NULL.
+/// \return INTERP_OK (0) on success; INTERP_ERR_OUT_OF_FUEL if the run
+///         ran out of fuel; a nonzero value on any other failure.
+interp_code interp_resume(
+    interp_handle handle,
+    interp_word max_ticks,
+    interp_status* status,
+    interp_word* retval
+);
+
+/// Run the interpreter until it finishes or blocks.
+///
+/// If the run blocks (INTERP_STATUS_BLOCKED), wait for the descriptor
+/// returned by interp_event_fd() to become readable, and continue with
+/// interp_resume().
+///
+/// \param handle The interpreter handle.
+/// \param status Out parameter for whether the run finished. May be NULL.
+/// \param retval Out parameter for the return value if the run finished. May be NULL.
+/// \return INTERP_OK (0) on success; INTERP_ERR_OUT_OF_FUEL if the run
+///         ran out of fuel; a nonzero value on any other failure.
+interp_code interp_run_until_blocked(
+    interp_handle handle,
+    interp_status* status,
+    interp_word* retval
+);
+
+/// Get a file descriptor that becomes readable once a blocked run can
+/// continue, e.g. to register it with epoll. It is owned by the interpreter.
+///
+/// \param handle The interpreter handle.
+/// \return The file descriptor, or -1 on failure.
+int interp_event_fd(interp_handle handle);
+
+/// Enable fuel metering and set the amount of fuel left.
+///
+/// Each instruction costs one unit of fuel. If a run does not have
+/// enough fuel left, it fails with INTERP_ERR_OUT_OF_FUEL; it can be
+/// continued with interp_resume() after adding more fuel.
+///
+/// \param handle The interpreter handle.
+/// \param fuel The amount of fuel.
+void interp_set_fuel(interp_handle handle, interp_word fuel);
+
+/// Disable fuel metering.
+///
+/// \param handle The interpreter handle.
+void interp_disable_fuel(interp_handle handle);
+
+/// Get the amount of fuel left.
+///
+/// \param handle The interpreter handle.
+/// \param fuel Out parameter for the amount of fuel left. May be NULL.
+/// \return INTERP_OK (0) on success; a nonzero value if fuel metering is disabled.
+interp_code interp_get_fuel(interp_handle handle, interp_word* fuel);
+
+/// Stop the current run. This can be called from any thread.
+///
+/// The run stops at its next call or backward jump with the status
+/// INTERP_STATUS_CANCELLED. If nothing is running, the next run stops
+/// as soon as it gets to a call or backward jump.
+///
+/// \param handle The interpreter handle.
+void interp_interrupt(interp_handle handle);
+
+/// Stop runs with the status INTERP_STATUS_DEADLINE_EXCEEDED once some
+/// time has passed. This applies to every run until the deadline is
+/// changed or cleared.
+///
+/// \param handle The interpreter handle.
+/// \param timeout_ns The deadline, in nanoseconds from now.
+void interp_set_deadline(interp_handle handle, uint64_t timeout_ns);
+
+/// Remove the deadline.
+///
+/// \param handle The interpreter handle.
+void interp_clear_deadline(interp_handle handle);
+
 /// ===========================================================================
 ///  State manipulation.
 /// ===========================================================================
@@ -243,6 +406,26 @@ interp_code interp_create_load_indirect(
     interp_word offs
 );
 
+/// Emit an indexed load from memory.
+///
+/// This loads from the address `base + index * scale + offs`.
+///
+/// \param handle The interpreter handle.
+/// \param dest The register to load into.
+/// \param base The register containing the base address. r0 represents the stack base pointer.
+/// \param index The register containing the index. May not be r0.
+/// \param scale The scale of the index. Must be 1, 2, 4, or 8.
+/// \param offs The offset from the scaled address.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_load_indexed(
+    interp_handle handle,
+    interp_reg dest,
+    interp_reg base,
+    interp_reg index,
+    interp_word scale,
+    interp_word offs
+);
+
 /// Emit a store to memory.
 ///
 /// \param handle The interpreter handle.
@@ -307,6 +490,201 @@ interp_code interp_create_store_indirect(
     interp_reg src
 );
 
+/// Emit an indexed store to memory.
+///
+/// This stores to the address `base + index * scale + offs`.
+///
+/// \param handle The interpreter handle.
+/// \param base The register containing the base address. r0 represents the stack base pointer.
+/// \param index The register containing the index. May not be r0.
+/// \param scale The scale of the index. Must be 1, 2, 4, or 8.
+/// \param offs The offset from the scaled address.
+/// \param src The register containing the value to store.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_store_indexed(
+    interp_handle handle,
+    interp_reg base,
+    interp_reg index,
+    interp_word scale,
+    interp_word offs,
+    interp_reg src
+);
+
+/// Emit an instruction to copy a block of memory.
+///
+/// The source and destination may overlap.
+///
+/// \param handle The interpreter handle.
+/// \param dest The register containing the destination address. r0 represents the stack base pointer.
+/// \param src The register containing the source address. r0 represents the stack base pointer.
+/// \param size The register containing the number of bytes to copy.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_memcopy(
+    interp_handle handle,
+    interp_reg dest,
+    interp_reg src,
+    interp_reg size
+);
+
+/// Emit an instruction to fill a block of memory with a byte.
+///
+/// \param handle The interpreter handle.
+/// \param dest The register containing the destination address. r0 represents the stack base pointer.
+/// \param value The register whose lowest byte is the fill value.
+/// \param size The register containing the number of bytes to fill.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_memfill(
+    interp_handle handle,
+    interp_reg dest,
+    interp_reg value,
+    interp_reg size
+);
+
+/// Emit an instruction to compare two blocks of memory.
+///
+/// \param handle The interpreter handle.
+/// \param result The register that is set to -1, 0, or 1.
+/// \param lhs The register containing the address of the first block. r0 represents the stack base pointer.
+/// \param rhs The register containing the address of the second block. r0 represents the stack base pointer.
+/// \param size The register containing the number of bytes to compare.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_memcompare(
+    interp_handle handle,
+    interp_reg result,
+    interp_reg lhs,
+    interp_reg rhs,
+    interp_reg size
+);
+
+/// ===========================================================================
+///  Atomic operations.
+/// ===========================================================================
+/// Emit an instruction to atomically load a value from memory.
+///
+/// \param handle The interpreter handle.
+/// \param dest The destination register. Its size determines the size of the access.
+/// \param address The register containing the address. r0 represents the stack base pointer.
+/// \param order The memory order. May not be release or acq_rel.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_atomic_load(interp_handle handle, interp_reg dest, interp_reg address, interp_memory_order order);
+
+/// Emit an instruction to atomically store a register to memory.
+///
+/// \param handle The interpreter handle.
+/// \param address The register containing the address. r0 represents the stack base pointer.
+/// \param src The source register. Its size determines the size of the access.
+/// \param order The memory order. May not be acquire or acq_rel.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_atomic_store(interp_handle handle, interp_reg address, interp_reg src, interp_memory_order order);
+
+/// Emit an atomic read-modify-write instruction.
+///
+/// The available operations are xchg, fetch_add, fetch_sub, fetch_and,
+/// and fetch_or. The old value of the memory location is stored in `dest`.
+///
+/// \param handle The interpreter handle.
+/// \param dest The destination register. Its size determines the size of the access.
+/// \param address The register containing the address. r0 represents the stack base pointer.
+/// \param src The register containing the operand.
+/// \param order The memory order.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_atomic_xchg(interp_handle handle, interp_reg dest, interp_reg address, interp_reg src, interp_memory_order order);
+interp_code interp_create_atomic_fetch_add(interp_handle handle, interp_reg dest, interp_reg address, interp_reg src, interp_memory_order order);
+interp_code interp_create_atomic_fetch_sub(interp_handle handle, interp_reg dest, interp_reg address, interp_reg src, interp_memory_order order);
+interp_code interp_create_atomic_fetch_and(interp_handle handle, interp_reg dest, interp_reg address, interp_reg src, interp_memory_order order);
+interp_code interp_create_atomic_fetch_or(interp_handle handle, interp_reg dest, interp_reg address, interp_reg src, interp_memory_order order);
+
+/// Emit an atomic compare-and-swap instruction.
+///
+/// \param handle The interpreter handle.
+/// \param dest The register that receives the old value. Its size determines the size of the access.
+/// \param address The register containing the address. r0 represents the stack base pointer.
+/// \param expected The register containing the expected value.
+/// \param desired The register containing the value to store if the old value is equal to `expected`.
+/// \param order The memory order.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_atomic_cmpxchg(
+    interp_handle handle,
+    interp_reg dest,
+    interp_reg address,
+    interp_reg expected,
+    interp_reg desired,
+    interp_memory_order order
+);
+
+/// Emit a memory fence.
+///
+/// \param handle The interpreter handle.
+/// \param order The memory order.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_fence(interp_handle handle, interp_memory_order order);
+
+/// ===========================================================================
+///  Vector operations.
+/// ===========================================================================
+/// Vector register type.
+typedef uint8_t interp_vreg;
+
+/// Emit an instruction to load a vector from memory.
+///
+/// \param handle The interpreter handle.
+/// \param dest The destination vector register.
+/// \param src The register containing the address. r0 represents the stack base pointer.
+/// \param shape The shape of the vector.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_vload(interp_handle handle, interp_vreg dest, interp_reg src, uint8_t shape);
+
+/// Emit an instruction to store a vector to memory.
+///
+/// \param handle The interpreter handle.
+/// \param dest The register containing the address. r0 represents the stack base pointer.
+/// \param src The source vector register.
+/// \param shape The shape of the vector.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_vstore(interp_handle handle, interp_reg dest, interp_vreg src, uint8_t shape);
+
+/// Emit an instruction to broadcast a register to every lane of a vector.
+///
+/// \param handle The interpreter handle.
+/// \param dest The destination vector register.
+/// \param src The source register.
+/// \param shape The shape of the vector.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_vsplat(interp_handle handle, interp_vreg dest, interp_reg src, uint8_t shape);
+
+/// Emit a lane-wise vector instruction.
+///
+/// The available operations are vadd, vsub, vmul, vcmpeq, vcmplt, vmin,
+/// and vmax. Comparisons set each lane to all ones if the comparison is
+/// true and to zero otherwise.
+///
+/// \param handle The interpreter handle.
+/// \param dest The destination vector register.
+/// \param src1 The first source vector register.
+/// \param src2 The second source vector register.
+/// \param shape The shape of the vectors.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_vadd(interp_handle handle, interp_vreg dest, interp_vreg src1, interp_vreg src2, uint8_t shape);
+interp_code interp_create_vsub(interp_handle handle, interp_vreg dest, interp_vreg src1, interp_vreg src2, uint8_t shape);
+interp_code interp_create_vmul(interp_handle handle, interp_vreg dest, interp_vreg src1, interp_vreg src2, uint8_t shape);
+interp_code interp_create_vcmpeq(interp_handle handle, interp_vreg dest, interp_vreg src1, interp_vreg src2, uint8_t shape);
+interp_code interp_create_vcmplt(interp_handle handle, interp_vreg dest, interp_vreg src1, interp_vreg src2, uint8_t shape);
+interp_code interp_create_vmin(interp_handle handle, interp_vreg dest, interp_vreg src1, interp_vreg src2, uint8_t shape);
+interp_code interp_create_vmax(interp_handle handle, interp_vreg dest, interp_vreg src1, interp_vreg src2, uint8_t shape);
+
+/// Emit a horizontal reduction of a vector into a register.
+///
+/// The available reductions are add, min, and max.
+///
+/// \param handle The interpreter handle.
+/// \param dest The destination register.
+/// \param src The source vector register.
+/// \param shape The shape of the vector.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_vreduce_add(interp_handle handle, interp_reg dest, interp_vreg src, uint8_t shape);
+interp_code interp_create_vreduce_min(interp_handle handle, interp_reg dest, interp_vreg src, uint8_t shape);
+interp_code interp_create_vreduce_max(interp_handle handle, interp_reg dest, interp_vreg src, uint8_t shape);
+
 /// ===========================================================================
 ///  Operations.
 /// ===========================================================================
@@ -345,6 +723,21 @@ interp_code interp_create_move_ri(
 /// \return INTERP_OK (0) on success; a nonzero value on failure.
 interp_code interp_create_call(interp_handle handle, const char* name);
 
+/// Create a call to the function whose index is stored in a register.
+///
+/// \param handle The interpreter handle.
+/// \param index The register containing the function index.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_call_indirect(interp_handle handle, interp_reg index);
+
+/// Get the index of a function, declaring it if it does not exist yet.
+///
+/// \param handle The interpreter handle.
+/// \param name The name of the function.
+/// \param index Out parameter for the index of the function.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_function_index(interp_handle handle, const char* name, size_t* index);
+
 /// Create a direct branch.
 ///
 /// \param handle The interpreter handle.
@@ -360,6 +753,171 @@ interp_code interp_create_branch(interp_handle handle, interp_address target);
 /// \return INTERP_OK (0) on success; a nonzero value on failure.
 interp_code interp_create_branch_ifnz(interp_handle handle, interp_reg cond, interp_address target);
 
+/// Create a branch to the address stored in a register.
+///
+/// \param handle The interpreter handle.
+/// \param target The register containing the target address. The target
+///     must be the start of an instruction.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_branch_indirect(interp_handle handle, interp_reg target);
+
+/// Create a label that isn’t bound to an address yet.
+///
+/// \param handle The interpreter handle.
+/// \param label Out parameter for the label.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_label(interp_handle handle, interp_label* label);
+
+/// Bind a label to the current address.
+///
+/// \param handle The interpreter handle.
+/// \param label The label. It must not have been bound yet.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_bind_label(interp_handle handle, interp_label label);
+
+/// Create a direct branch to a label, which may be bound later. The
+/// branch has a 32-bit displacement until interp_relax() is called.
+///
+/// \param handle The interpreter handle.
+/// \param label The label to branch to.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_branch_to_label(interp_handle handle, interp_label label);
+
+/// Create a conditional branch to a label, which may be bound later.
+///
+/// \param handle The interpreter handle.
+/// \param cond The condition to branch on.
+/// \param label The label to branch to.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_branch_ifnz_to_label(interp_handle handle, interp_reg cond, interp_label label);
+
+/// Give each branch to a label the smallest encoding that reaches its
+/// target. This moves code; see interp::module::relax().
+///
+/// \param handle The interpreter handle.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_relax(interp_handle handle);
+
+/// Mark a range of code as a try region.
+///
+/// If an exception is thrown in [begin, end), the stack is unwound to the
+/// function that contains the region, and execution continues at the
+/// handler with the exception value in r1. This emits no instructions.
+///
+/// \param handle The interpreter handle.
+/// \param begin The first address of the region.
+/// \param end The address after the last instruction of the region.
+/// \param handler The address of the handler.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_try(interp_handle handle, interp_address begin, interp_address end, interp_address handler);
+
+/// Throw an exception.
+///
+/// \param handle The interpreter handle.
+/// \param value The register containing the exception value.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_throw(interp_handle handle, interp_reg value);
+
+/// Create a coroutine that runs a function.
+///
+/// Registers r32 through r63 are private to each coroutine; all other
+/// registers are shared.
+///
+/// \param handle The interpreter handle.
+/// \param dest The register in which to store the handle of the coroutine.
+/// \param func The register containing the index of the function.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_coroutine(interp_handle handle, interp_reg dest, interp_reg func);
+
+/// Resume a coroutine until it yields or returns.
+///
+/// \param handle The interpreter handle.
+/// \param status The register that is set to 1 if the coroutine yielded, and to 0 if it returned.
+/// \param coroutine The register containing the handle of the coroutine.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_resume(interp_handle handle, interp_reg status, interp_reg coroutine);
+
+/// Suspend the current coroutine and return to the one that resumed it.
+///
+/// \param handle The interpreter handle.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_yield(interp_handle handle);
+
+/// Set the size of the stack of each coroutine. The default is 16 KiB.
+///
+/// \param handle The interpreter handle.
+/// \param size The size of the stack in bytes.
+void interp_set_coroutine_stack_size(interp_handle handle, size_t size);
+
+/// Start a guest thread that runs a function.
+///
+/// The thread shares memory with the rest of the program, but has its
+/// own registers and stack. The argument is passed in r2.
+///
+/// \param handle The interpreter handle.
+/// \param dest The register in which to store the handle of the thread.
+/// \param func The register containing the index of the function.
+/// \param arg The register containing the argument.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_thread_spawn(interp_handle handle, interp_reg dest, interp_reg func, interp_reg arg);
+
+/// Wait for a guest thread to return and get its return value.
+///
+/// \param handle The interpreter handle.
+/// \param dest The register in which to store the return value of the thread.
+/// \param thread The register containing the handle of the thread.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_thread_join(interp_handle handle, interp_reg dest, interp_reg thread);
+
+/// Run a function on chunks of a range in parallel.
+///
+/// The range [begin, end) is split into one chunk per guest thread, and
+/// the function is called on each chunk with its bounds in r2 and r3.
+/// The return values of the chunks are combined according to `op`.
+/// Registers r2 through r5 are overwritten.
+///
+/// \param handle The interpreter handle.
+/// \param dest The register in which to store the combined return value.
+/// \param func The register containing the index of the function.
+/// \param begin The register containing the start of the range.
+/// \param end The register containing the end of the range.
+/// \param op How to combine the return values.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_parallel_for(
+    interp_handle handle,
+    interp_reg dest,
+    interp_reg func,
+    interp_reg begin,
+    interp_reg end,
+    interp_reduction op
+);
+
+/// Set the maximum number of guest threads that can run at the same time,
+/// and the size of the stack of each one. The defaults are 8 and 16 KiB.
+///
+/// \param handle The interpreter handle.
+/// \param max_threads The maximum number of threads.
+/// \param stack_size The size of the stack of each thread in bytes.
+void interp_set_thread_limits(interp_handle handle, size_t max_threads, size_t stack_size);
+
+/// Create a multiway branch on the value of a register.
+///
+/// \param handle The interpreter handle.
+/// \param index The register to switch on.
+/// \param keys The case keys. Keys must be unique.
+/// \param targets The targets of the cases; `targets[i]` is the target of `keys[i]`.
+/// \param count The number of cases.
+/// \param default_target The target if no key matches.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_switch(
+    interp_handle handle,
+    interp_reg index,
+    const uint64_t* keys,
+    const interp_address* targets,
+    size_t count,
+    interp_address default_target
+);
+
 /// Create a function at the current address.
 ///
 /// \param handle The interpreter handle.
@@ -378,6 +936,21 @@ interp_code interp_create_function(interp_handle handle, const char* name);
 /// \return INTERP_OK (0) on success; a nonzero value on failure.
 interp_code interp_create_xchg_rr(interp_handle handle, interp_reg r1, interp_reg r2);
 
+/// Emit an instruction to push several registers onto the stack.
+///
+/// \param handle The interpreter handle.
+/// \param mask A mask of registers; bit N selects register N. May not include r0.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_pushregs(interp_handle handle, uint64_t mask);
+
+/// Emit an instruction to pop several registers off the stack.
+///
+/// \param handle The interpreter handle.
+/// \param mask A mask of registers; bit N selects register N. This should be
+///     the same mask that was used to push the registers.
+/// \return INTERP_OK (0) on success; a nonzero value on failure.
+interp_code interp_create_popregs(interp_handle handle, uint64_t mask);
+
 /// Get the current address.
 ///
 /// \param handle The interpreter handle.
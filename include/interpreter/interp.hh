@@ -6,10 +6,19 @@
 #    error "This header is C++ only. Use <interpreter/interp.h> instead."
 #endif
 
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <exception>
 #include <functional>
 #include <interpreter/interp.h>
 #include <interpreter/utils.hh>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <unordered_map>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -22,7 +31,15 @@ struct interp_handle_t {};
 /// The interpreter namespace.
 namespace interp {
 /// Forward decls.
+class module;
+class context;
 class interpreter;
+class executor;
+class function_builder;
+class channel;
+class io_service;
+struct event_notifier;
+struct thread_group;
 
 /// Opcode of an instruction.
 using opcode_t = u8;
@@ -30,8 +47,11 @@ using opcode_t = u8;
 /// Bytecode address.
 using addr = usz;
 
+/// A name for a bytecode address that may not be known yet.
+enum struct label : u32 {};
+
 /// Native function handle.
-using native_function = std::function<void(interpreter&)>;
+using native_function = std::function<void(context&)>;
 
 /// Register size.
 using word = u64;
@@ -39,17 +59,63 @@ using word = u64;
 /// Register.
 enum struct reg : u8 {};
 
+/// Vector register.
+enum struct vreg : u8 {};
+
+/// Value of a vector register.
+struct alignas(32) vector_value {
+    std::array<u8, 32> bytes{};
+};
+
 /// Pointer.
 enum struct ptr : u64 { null = 0 };
 
+/// Memory order of an atomic operation.
+enum struct memory_order : u8 {
+    relaxed = INTERP_MEMORY_ORDER_RELAXED,
+    acquire = INTERP_MEMORY_ORDER_ACQUIRE,
+    release = INTERP_MEMORY_ORDER_RELEASE,
+    acq_rel = INTERP_MEMORY_ORDER_ACQ_REL,
+    seq_cst = INTERP_MEMORY_ORDER_SEQ_CST,
+};
+
+/// Outcome of a (partial) run.
+enum struct run_status : u8 {
+    finished = INTERP_STATUS_FINISHED,
+    suspended = INTERP_STATUS_SUSPENDED,
+    cancelled = INTERP_STATUS_CANCELLED,
+    deadline_exceeded = INTERP_STATUS_DEADLINE_EXCEEDED,
+
+    /// A native function is waiting for something, e.g. a message. Resuming
+    /// the run calls it again.
+    blocked = INTERP_STATUS_BLOCKED,
+};
+
+/// How a parallel loop combines the return values of its chunks. min and
+/// max compare the values as unsigned integers, min_signed and max_signed
+/// as signed integers.
+enum struct reduction : u8 {
+    none = INTERP_REDUCE_NONE,
+    add = INTERP_REDUCE_ADD,
+    min = INTERP_REDUCE_MIN,
+    max = INTERP_REDUCE_MAX,
+    min_signed = INTERP_REDUCE_MIN_SIGNED,
+    max_signed = INTERP_REDUCE_MAX_SIGNED,
+};
+
 /// Constants.
 constexpr static usz ip_start_addr = 1;
 constexpr static u8 osz_mask = 0b1100'0000;
 constexpr static u8 reg_mask = static_cast<u8>(~osz_mask);
+constexpr static u8 vector_shape_mask = 0b1111;
+constexpr static usz register_count = 64;
+constexpr static usz vector_register_count = 16;
+constexpr static usz coroutine_register_base = 32;
 
 /// Literals.
 namespace literals {
 constexpr reg operator""_r(unsigned long long r) { return static_cast<reg>(r); }
+constexpr vreg operator""_v(unsigned long long r) { return static_cast<vreg>(r); }
 constexpr word operator""_w(unsigned long long a) { return static_cast<word>(a); }
 } // namespace literals
 
@@ -57,11 +123,15 @@ constexpr word operator""_w(unsigned long long a) { return static_cast<word>(a);
 constexpr reg operator|(reg r, u8 s) { return static_cast<reg>(static_cast<u8>(r) | s); }
 constexpr u8 operator+(reg r) { return static_cast<u8>(r); }
 constexpr u8 index(reg r) { return static_cast<u8>(r) & reg_mask; }
+constexpr u8 operator+(vreg r) { return static_cast<u8>(r); }
 
 /// Pointer helpers.
 constexpr u64 operator+(ptr p) { return static_cast<u64>(p); }
 constexpr ptr operator+(ptr p, word a) { return static_cast<ptr>(static_cast<u64>(p) + a); }
 
+/// Label helpers.
+constexpr u32 operator+(label l) { return static_cast<u32>(l); }
+
 /// Opcode.
 enum struct opcode : opcode_t {
     invalid = 0,
@@ -153,9 +223,136 @@ enum struct opcode : opcode_t {
     store_rel32,
     store_rel64,
 
+    /// Load a value from base + index * scale + offset. ‘r0’ as the base is the stack base.
+    /// Operands: dest, base, index, log2(scale), offset (word).
+    load_idx8,
+    load_idx16,
+    load_idx32,
+    load_idx64,
+
+    /// Store a register to base + index * scale + offset. ‘r0’ as the base is the stack base.
+    /// Operands: base, index, log2(scale), source, offset (word).
+    store_idx8,
+    store_idx16,
+    store_idx32,
+    store_idx64,
+
     /// Swap two registers. This is also used for truncation.
     xchg,
 
+    /// Push the registers in a mask onto the stack, in ascending order.
+    /// Operands: mask (u64). Bit N selects register N.
+    pushregs,
+
+    /// Pop the registers in a mask off the stack.
+    /// Operands: mask (u64). Bit N selects register N.
+    popregs,
+
+    /// Copy a block of memory. The blocks may overlap.
+    /// Operands: dest (register), source (register), size (register).
+    memcopy,
+
+    /// Fill a block of memory with a byte.
+    /// Operands: dest (register), value (register), size (register).
+    memfill,
+
+    /// Compare two blocks of memory.
+    /// Operands: result (register), lhs (register), rhs (register), size (register).
+    memcompare,
+
+    /// Atomically load a value from memory.
+    /// Operands: memory order, dest (register), address (register).
+    atomic_load,
+
+    /// Atomically store a register to memory.
+    /// Operands: memory order, address (register), source (register).
+    atomic_store,
+
+    /// Atomic read-modify-write operations. The old value is stored in dest.
+    /// Operands: memory order, dest (register), address (register), source (register).
+    atomic_xchg,
+    atomic_fetch_add,
+    atomic_fetch_sub,
+    atomic_fetch_and,
+    atomic_fetch_or,
+
+    /// Atomic compare-and-swap. The old value is stored in dest.
+    /// Operands: memory order, dest, address, expected, desired (registers).
+    atomic_cmpxchg,
+
+    /// Memory fence.
+    /// Operands: memory order.
+    fence,
+
+    /// Call the function whose index is stored in a register.
+    /// Operands: index (register), call site cache slot (u32).
+    call_indirect,
+
+    /// Jump to the address stored in a register.
+    /// Operands: address (register).
+    jmp_indirect,
+
+    /// Create a coroutine that runs a function.
+    /// Operands: dest (register), function index (register).
+    coro_create,
+
+    /// Resume a coroutine until it yields or returns.
+    /// Operands: status (register), coroutine (register).
+    resume,
+
+    /// Suspend the current coroutine and return to the one that resumed it.
+    yield,
+
+    /// Throw an exception.
+    /// Operands: value (register).
+    throw_,
+
+    /// Start a guest thread that runs a function.
+    /// Operands: dest (register), function index (register), argument (register).
+    thread_spawn,
+
+    /// Wait for a guest thread to return and get its return value.
+    /// Operands: dest (register), thread (register).
+    thread_join,
+
+    /// Jump through a table indexed by a register.
+    /// Operands: index (register), widths, count (u32), low key, default address, addresses.
+    /// The low 2 bits of the widths byte are log2 of the size of an address, the
+    /// next 2 bits are log2 of the size of a key.
+    switch_dense,
+
+    /// Jump through a sorted table of keys and addresses using binary search.
+    /// Operands: index (register), widths, count (u32), default address, (key, address) pairs.
+    switch_sparse,
+
+    /// Load a vector from memory.
+    /// Operands: shape, dest (vector register), address (register).
+    vload,
+
+    /// Store a vector to memory.
+    /// Operands: shape, address (register), source (vector register).
+    vstore,
+
+    /// Broadcast a register to every lane of a vector.
+    /// Operands: shape, dest (vector register), source (register).
+    vsplat,
+
+    /// Lane-wise vector operations.
+    /// Operands: shape, dest, src1, src2 (vector registers).
+    vadd,
+    vsub,
+    vmul,
+    vcmpeq,
+    vcmplt,
+    vmin,
+    vmax,
+
+    /// Horizontal reductions.
+    /// Operands: shape, dest (register), source (vector register).
+    vreduce_add,
+    vreduce_min,
+    vreduce_max,
+
     /// For sanity checks.
     max_opcode
 };
@@ -177,6 +374,30 @@ constexpr opcode_t operator+(opcode o) { return static_cast<opcode_t>(o); }
     F(shift_right_arithmetic, >>, i64)        \
     F(shift_right_logical, >>, word)
 
+/// Macro used for codegenning lane-wise vector instructions.
+#define INTERP_ALL_VECTOR_INSTRUCTIONS(F) \
+    F(vadd, add)                          \
+    F(vsub, sub)                          \
+    F(vmul, mul)                          \
+    F(vcmpeq, cmpeq)                      \
+    F(vcmplt, cmplt)                      \
+    F(vmin, min)                          \
+    F(vmax, max)
+
+/// Macro used for codegenning vector reductions.
+#define INTERP_ALL_VECTOR_REDUCTIONS(F) \
+    F(vreduce_add, add)                 \
+    F(vreduce_min, min)                 \
+    F(vreduce_max, max)
+
+/// Macro used for codegenning atomic read-modify-write instructions.
+#define INTERP_ALL_ATOMIC_RMW_INSTRUCTIONS(F) \
+    F(atomic_xchg, xchg)                      \
+    F(atomic_fetch_add, add)                  \
+    F(atomic_fetch_sub, sub)                  \
+    F(atomic_fetch_and, and)                  \
+    F(atomic_fetch_or, or)
+
 /// Error type.
 struct error : std::runtime_error {
     template <typename... arguments>
@@ -184,6 +405,130 @@ struct error : std::runtime_error {
         : std::runtime_error(fmt::format(fmt, std::forward<arguments>(args)...)) {}
 };
 
+/// Thrown when a run runs out of fuel.
+struct out_of_fuel : error {
+    out_of_fuel() : error("Out of fuel") {}
+};
+
+/// Thrown by run() when a run is cancelled or exceeds its deadline.
+struct interrupted : error {
+    run_status status;
+
+    explicit interrupted(run_status st)
+        : error("{}", st == run_status::cancelled ? "Run was cancelled" : "Deadline exceeded"),
+          status(st) {}
+};
+
+/// Flags used to stop a run from another thread. This is shared
+/// between a context and the deadline timer.
+struct interrupt_state {
+    /// Set by context::interrupt().
+    constexpr static u8 cancel = 1;
+
+    /// Set once the deadline of the context has passed.
+    constexpr static u8 deadline = 2;
+
+    std::atomic<u8> flags{};
+
+    /// Whether the deadline timer has an entry for this state. Only
+    /// changed by the timer, with its lock held.
+    std::atomic<bool> scheduled{};
+};
+
+/// Result of an asynchronous native function.
+///
+/// An asynchronous native is a coroutine that returns a task. It starts
+/// running as soon as it is called; if it suspends, e.g. to wait for I/O,
+/// the run that called it stops with the status blocked, and once the
+/// coroutine has been resumed by whoever it is waiting for and returns,
+/// resuming the run continues after the call. As with other natives, the
+/// return value is set with context::set_return_value().
+class task {
+public:
+    struct promise_type {
+        /// States of the coroutine. While it is finishing, it is about to
+        /// be done, but the frame must not be destroyed yet.
+        constexpr static u8 running = 0, awaited = 1, finishing = 2, done = 3;
+
+        std::atomic<u8> state{running};
+        std::exception_ptr error;
+
+        /// Called once the coroutine is done if someone is waiting for it.
+        std::function<void()> on_done;
+
+        task get_return_object() { return task{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { error = std::current_exception(); }
+
+        /// Stay suspended at the end so that the task can see how it ended.
+        auto final_suspend() noexcept {
+            struct awaiter {
+                bool await_ready() noexcept { return false; }
+                void await_resume() noexcept {}
+                /// Once the state is done, the frame may be destroyed at any
+                /// moment, so the callback is moved out of it first.
+                void await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                    auto& p = h.promise();
+                    if (p.state.exchange(finishing, std::memory_order_acq_rel) != awaited) {
+                        p.state.store(done, std::memory_order_release);
+                        return;
+                    }
+
+                    auto callback = std::move(p.on_done);
+                    p.state.store(done, std::memory_order_release);
+                    if (callback) callback();
+                }
+            };
+
+            return awaiter{};
+        }
+    };
+
+private:
+    std::coroutine_handle<promise_type> handle;
+
+    explicit task(std::coroutine_handle<promise_type> h) : handle(h) {}
+
+public:
+    task() = default;
+    task(const task&) = delete;
+    task(task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    task& operator=(const task&) = delete;
+    task& operator=(task&& other) noexcept {
+        if (this == &other) return *this;
+        if (handle) handle.destroy();
+        handle = std::exchange(other.handle, nullptr);
+        return *this;
+    }
+
+    /// Destroys the coroutine, even if it hasn’t finished.
+    ~task() noexcept {
+        if (handle) handle.destroy();
+    }
+
+    /// Check whether this refers to a coroutine.
+    explicit operator bool() const { return bool(handle); }
+
+    /// Check whether the coroutine has returned.
+    bool done() const { return handle.promise().state.load(std::memory_order_acquire) == promise_type::done; }
+
+    /// Call a function once the coroutine has returned, on the thread that
+    /// finishes it. If it already has, return false instead.
+    bool notify(std::function<void()> callback);
+
+    /// Wait for the coroutine to return.
+    void wait();
+
+    /// Rethrow the exception the coroutine ended with, if any.
+    void get() const {
+        if (auto& e = handle.promise().error) std::rethrow_exception(e);
+    }
+};
+
+/// Asynchronous native function handle.
+using async_native_function = std::function<task(context&)>;
+
 /// Integer types supported by the interpreter.
 template <typename t>
 concept integer = std::same_as<std::make_unsigned_t<t>, u8> ||  //
@@ -192,30 +537,68 @@ concept integer = std::same_as<std::make_unsigned_t<t>, u8> ||  //
                   std::same_as<std::make_unsigned_t<t>, u64>;
 
 /// ===========================================================================
-///  Interpreter struct.
+///  Guest memory.
 /// ===========================================================================
-/// This holds the interpreter state.
-class interpreter : public ::interp_handle_t {
-    /// Instruction pointer.
-    addr ip{};
+/// Memory for globals and the stack of a context.
+///
+/// This is backed by an anonymous mapping rather than a heap allocation
+/// so that resetting it only costs as much as the number of pages that
+/// were actually written to: those are handed back to the kernel and
+/// read back as zeroes the next time they are touched.
+class guest_memory {
+    u8* _data_{};
+    usz _size_{};
+    bool _file_backed_{};
+    bool _owned_ = true;
 
-    /// Registers.
-    ///
-    /// The underscores are due to the fact that, sometimes, you don’t
-    /// want to use this directly, and they make you think twice about
-    /// using this.
-    std::array<word, 64> _registers_{};
-
-    /// Stack pointer. This *must* always be aligned to 8 bytes.
-    ptr sp{};
+public:
+    guest_memory() = default;
+    guest_memory(const guest_memory&) = delete;
+    guest_memory(guest_memory&& other) noexcept;
+    guest_memory& operator=(const guest_memory&) = delete;
+    guest_memory& operator=(guest_memory&& other) noexcept;
+    ~guest_memory() noexcept;
+
+    /// Get the start of the memory.
+    u8* data() const { return _data_; }
+
+    /// Get the size of the memory.
+    usz size() const { return _size_; }
+
+    /// Resize the memory. The contents are preserved up to the smaller
+    /// of the old and new sizes; new memory is zeroed. Memory mapped
+    /// from a file can only be freed, not resized.
+    void resize(usz new_size);
+
+    /// Replace the memory with a copy-on-write mapping of a file. Writes
+    /// are private to this memory, and resetting it restores the contents
+    /// of the file rather than zeroing it.
+    void map_private(int fd, usz new_size);
+
+    /// Zero the memory, or restore the contents of the file it maps.
+    void reset();
+
+    /// Create memory that refers to the same pages as another memory.
+    /// The other memory must outlive it, and it cannot be resized.
+    static guest_memory alias(const guest_memory& other);
+};
 
-    /// The code that we’re executing.
+/// ===========================================================================
+///  Module.
+/// ===========================================================================
+/// A module holds a program: its bytecode, its functions, and the layout
+/// of its globals. Once built, a module can be run by any number of
+/// contexts at the same time, as long as no code is added to it while
+/// any of them are running.
+class module {
+    friend class context;
+    friend class function_builder;
+    friend class process_pool;
+    friend class snapshot;
+
+    /// The bytecode of the program.
     std::vector<u8> bytecode;
 
-    /// Global variables and stack.
-    std::vector<u8> _memory_;
-    ptr stack_base{};
-
     /// Globals pointer.
     ptr gp{};
 
@@ -233,6 +616,12 @@ class interpreter : public ::interp_handle_t {
 
     std::unordered_map<std::string, library> libraries;
 
+    /// Load a library, or get it if it is already loaded.
+    library& load_library(const std::string& library_path);
+
+    /// Look up a function in a loaded library.
+    static void* find_library_symbol(library& lib, const std::string& library_path, const std::string& function_name);
+
     /// Functions in the bytecode. NEVER reorder or remove elements from these.
     struct function {
         std::variant<std::monostate, addr, native_function, library_function> address = std::monostate{};
@@ -241,30 +630,89 @@ class interpreter : public ::interp_handle_t {
     std::vector<function> functions;
     std::unordered_map<std::string, usz> functions_map;
 
+    /// Number of indirect call sites; each one gets a slot in the call cache of a context.
+    u32 indirect_call_sites{};
+
+    /// Which bytes of the bytecode start an instruction. Used to
+    /// validate the targets of indirect jumps.
+    mutable std::vector<bool> instruction_starts;
+
+    /// Fuel cost of the straight-line run of code that starts at each address.
+    mutable std::vector<u32> block_costs;
+
+    /// Whether the code contains instructions that spawn threads.
+    bool spawns_threads{};
+
+    /// Protects the parts of the module that are computed lazily.
+    mutable std::mutex finalize_mutex;
+
+    /// A range of code whose exceptions are handled by a handler.
+    struct try_region {
+        addr begin{};
+        addr end{};
+        addr handler{};
+
+        /// The function that contains the region.
+        usz function{};
+    };
+
+    /// Try regions, in no particular order. These are only looked at
+    /// when an exception is thrown.
+    std::vector<try_region> try_regions;
+
     /// The index of the function that we’re currently emitting.
     usz current_function = 0;
 
-    /// How many stack frames deep we are.
-    usz stack_frame_count{};
+    /// Addresses of labels; empty if a label hasn’t been bound yet.
+    std::vector<std::optional<addr>> labels;
+
+    /// Branches to labels that haven’t been relaxed yet, by address. These
+    /// are emitted with a 32-bit displacement and shrunk by relax().
+    std::vector<std::pair<addr, label>> label_branches;
+
+    /// Branches to labels that haven’t been bound yet, by label. Their
+    /// displacements are filled in when the label is bound.
+    std::unordered_map<u32, std::vector<addr>> unbound_branches;
+
+    /// Whether the code contains indirect branches. Their targets are
+    /// computed at run time, so code must not move if there are any.
+    bool has_indirect_branches{};
+
+    /// Set once a context has started running the module. Contexts may be
+    /// in the middle of the code from then on, so it must not move anymore.
+    mutable std::atomic<bool> code_in_use{};
+
+    /// If this is a function builder, the module that it builds a function
+    /// for. Functions and globals are looked up and created there.
+    module* owner{};
+
+    /// Protects functions, globals, and code while function builders are
+    /// in use.
+    std::mutex build_mutex;
 
     /// ===========================================================================
-    ///  Encoder/decoder.
+    ///  Encoder.
     /// ===========================================================================
     /// Check if registers are valid.
-    void check_regs(std::same_as<reg> auto... regs) const {
-        ([this](reg r) {
-            if (index(r) >= _registers_.size()) {
+    static void check_regs(std::same_as<reg> auto... regs) {
+        ([](reg r) {
+            if (index(r) >= register_count) {
                 throw error("Invalid register: {}", index(r));
             }
         }(regs),
          ...);
     }
 
-    /// Set (part of) a register to a value.
-    void set_register(reg r, word value);
-
-    /// Read (part of) a register.
-    word read_register(reg r) const;
+    /// Check if vector registers and a vector shape are valid.
+    static void check_vregs(u8 shape, std::same_as<vreg> auto... regs) {
+        if (shape & ~vector_shape_mask) throw error("Invalid vector shape: {:#x}", shape);
+        ([](vreg r) {
+            if (+r >= vector_register_count) {
+                throw error("Invalid vector register: {}", +r);
+            }
+        }(regs),
+         ...);
+    }
 
     /// Encode an arithmetic instruction.
     ///
@@ -281,83 +729,147 @@ class interpreter : public ::interp_handle_t {
     void encode_arithmetic(opcode op, reg dest, reg src, word imm);
     void encode_arithmetic(opcode op, reg dest, word imm, reg src);
 
-    /// Decode a register operand that may also be an immediate.
-    word decode_register_operand(reg r);
-
-    /// Decode an arithmetic instruction.
-    struct arith_t {
-        reg dest;
-        word src1;
-        word src2;
-    };
-    arith_t decode_arithmetic();
-
-    /// Read an address from the bytecode at ip.
-    word read_sized_address_at_ip(opcode op);
+    /// Encode the scale of an indexed load or store.
+    static u8 encode_scale(word scale);
 
     /// Create a call.
     void create_call_internal(usz index);
 
-    /// Separate function because it’s just too horrible.
-    void do_library_call_unsafe(library_function& f);
+    /// Get the index of a library function, adding it if need be.
+    usz library_function_index(const std::string& library_path, const std::string& function_name, usz num_params);
+
+    /// Create a branch to a label that is relaxed later.
+    void create_label_branch(opcode op, std::optional<reg> condition, label target);
+
+    /// Pick the smallest encoding for each branch to a label, move code to
+    /// close the gaps, and update every address that refers to moved code.
+    /// If code must not move, only fill in the displacements.
+    void relax_branches();
 
 public:
     /// Maximum memory for globals and the stack.
     usz max_memory = 1024 * 1024;
 
-    /// Last error. Used by the C API.
-    std::string last_error;
-
     /// ===========================================================================
     ///  Driver and Utils.
     /// ===========================================================================
 
-    /// Construct an interpreter.
-    explicit interpreter();
+    /// Construct a module.
+    explicit module();
 
     /// Copying/moving this is a bad idea.
-    interpreter(const interpreter&) = delete;
-    interpreter(interpreter&&) noexcept = delete;
-    interpreter& operator=(const interpreter&) = delete;
-    interpreter& operator=(interpreter&&) noexcept = delete;
+    module(const module&) = delete;
+    module(module&&) noexcept = delete;
+    module& operator=(const module&) = delete;
+    module& operator=(module&&) noexcept = delete;
 
     /// Free resources.
-    ~interpreter() noexcept;
+    ~module() noexcept;
 
     /// Define a binding to a native function.
     void defun(const std::string& name, native_function func);
 
-    /// Disassemble the bytecode.
-    std::string disassemble() const;
+    /// Define a binding to an asynchronous native function; see task.
+    void defun(const std::string& name, async_native_function func);
 
-    /// Run the interpreter().
-    /// \return The return value of the program.
-    word run();
+    /// Pick the right overload for lambdas that are coroutines.
+    template <typename callable>
+    requires std::same_as<std::invoke_result_t<callable&, context&>, task>
+    void defun(const std::string& name, callable&& func) {
+        defun(name, async_native_function{std::forward<callable>(func)});
+    }
 
-    /// ===========================================================================
-    ///  State manipulation.
-    /// ===========================================================================
-    /// Get the value of an argument register.
-    word arg(usz index, interp_size_mask sz) const;
+    /// Define native functions that send and receive messages through the
+    /// channels attached to a context:
+    ///
+    ///   - chan.send(r2: channel, r3: word)
+    ///   - chan.send_buf(r2: channel, r3: pointer, r4: size)
+    ///   - chan.recv(r2: channel) -> r1: word
+    ///   - chan.recv_buf(r2: channel, r3: pointer, r4: capacity) -> r1: size
+    ///   - chan.close(r2: channel)
+    ///
+    /// Sending sets r1 to 1, or to 0 if the channel is closed. Receiving sets
+    /// r2 to 1, or to 0 if the channel is closed and empty. recv_buf returns
+    /// the size of the message; if that is more than the capacity, nothing is
+    /// copied, and the message is received again by the next call on that
+    /// channel. recv returns the first 8 bytes of the message.
+    ///
+    /// If the channel is full or empty, a run started with run_for() stops
+    /// with the status blocked, and the call is retried when it is resumed;
+    /// any other run waits.
+    void defun_channels();
 
-    /// Load a value from memory.
-    word load_mem(ptr p, usz sz) const;
+    /// Define native functions that read and write files asynchronously:
+    ///
+    ///   - io.read(r2: file, r3: pointer, r4: size, r5: offset) -> r1: bytes read
+    ///   - io.write(r2: file, r3: pointer, r4: size, r5: offset) -> r1: bytes written
+    ///   - io.submit_read(r2: file, r3: pointer, r4: size, r5: offset) -> r1: ticket
+    ///   - io.submit_write(r2: file, r3: pointer, r4: size, r5: offset) -> r1: ticket
+    ///   - io.wait(r2: ticket) -> r1: bytes transferred
+    ///
+    /// Files are handles returned by context::attach_file(); guests cannot
+    /// open files or use any other descriptors of the host.
+    ///
+    /// Errors are returned as negated errno values. An offset of -1 uses the
+    /// file position. The submit natives queue an operation and return at
+    /// once, so several operations can be handed to the kernel together;
+    /// the memory they use must not be touched until they have been waited
+    /// for. Waiting is asynchronous: in a run started with run_for(), it
+    /// stops the run with the status blocked until the operation is done.
+    ///
+    /// \param io The service that performs the operations.
+    void defun_io(std::shared_ptr<io_service> io);
 
-    /// Push a value onto the stack.
-    void push(word value);
+    /// Define a native function that runs a function on a range in parallel.
+    ///
+    /// The native takes the index of a function in r2, the range [begin, end)
+    /// in r3 and r4, and a reduction in r5. It splits the range into one chunk
+    /// per guest thread and calls the function with the bounds of a chunk in
+    /// r2 and r3 on each one. The return values of the chunks are combined
+    /// with the reduction and returned in r1; with reduction::none, r1 is 0.
+    ///
+    /// \param name The name of the native function.
+    void defun_parallel_for(const std::string& name = "parallel_for");
 
-    /// Pop a value from the stack.
-    word pop();
+    /// Disassemble the bytecode.
+    std::string disassemble() const;
 
-    /// Get the value of a register.
-    word r(reg r) const;
-    void r(reg r, word value);
+    /// Compute everything needed to run the code that has been added so far.
+    ///
+    /// This is called by context::run(), so there is normally no need to
+    /// call it directly. It is thread-safe, and it never changes the code.
+    ///
+    /// \throw error If a label that is branched to hasn’t been bound.
+    void finalize() const;
 
-    /// Set the return value.
-    void set_return_value(word value);
+    /// Give each branch to a label the smallest encoding that reaches its
+    /// target. This moves code, so addresses obtained from current_addr()
+    /// before calling it may be stale afterwards; see create_branch(label).
+    ///
+    /// Until this is called, branches to labels have a 32-bit displacement;
+    /// that is also what disassemble() and serialize() see. If the module
+    /// contains indirect branches, or a context has already started running
+    /// it, code must not move, and this does nothing.
+    ///
+    /// \throw error If a label that is branched to hasn’t been bound.
+    void relax();
 
-    /// Store a value to memory.
-    void store_mem(ptr p, word value, usz sz);
+    /// Serialize the module, e.g. to load it in another process.
+    ///
+    /// Native functions are recorded by name only; they have to be defined
+    /// again after loading the module. Library functions are recorded by
+    /// library path and name, and the libraries are loaded again.
+    std::vector<u8> serialize() const;
+
+    /// Replace the contents of this module with a serialized module.
+    ///
+    /// Native functions of the serialized module are declared, but not
+    /// defined; define them with defun() afterwards. Any functions that
+    /// were defined before are discarded.
+    ///
+    /// \param image The output of serialize().
+    /// \throw error If the image is malformed.
+    void deserialize(std::span<const u8> image);
 
     /// ===========================================================================
     ///  Linker.
@@ -397,6 +909,17 @@ public:
     /// \param offs The offset from the base address.
     void create_load(reg dest, reg src, word offs);
 
+    /// Indexed load from memory.
+    ///
+    /// This loads from the address `base + index * scale + offs`.
+    ///
+    /// \param dest The destination register.
+    /// \param base The register containing the base address. r0 represents the stack base pointer.
+    /// \param index The register containing the index. May not be r0.
+    /// \param scale The scale of the index. Must be 1, 2, 4, or 8.
+    /// \param offs The offset from the scaled address.
+    void create_load(reg dest, reg base, reg index, word scale, word offs);
+
     /// Store to memory.
     void create_store(ptr dest, reg src);
 
@@ -410,6 +933,130 @@ public:
     /// \param src The source register.
     void create_store(reg dest, word offs, reg src);
 
+    /// Indexed store to memory.
+    ///
+    /// This stores to the address `base + index * scale + offs`.
+    ///
+    /// \param base The register containing the base address. r0 represents the stack base pointer.
+    /// \param index The register containing the index. May not be r0.
+    /// \param scale The scale of the index. Must be 1, 2, 4, or 8.
+    /// \param offs The offset from the scaled address.
+    /// \param src The source register.
+    void create_store(reg base, reg index, word scale, word offs, reg src);
+
+    /// Copy a block of memory.
+    ///
+    /// The source and destination may overlap.
+    ///
+    /// \param dest The register containing the destination address. r0 represents the stack base pointer.
+    /// \param src The register containing the source address. r0 represents the stack base pointer.
+    /// \param size The register containing the number of bytes to copy. May not be r0.
+    void create_memcopy(reg dest, reg src, reg size);
+
+    /// Fill a block of memory with a byte.
+    ///
+    /// \param dest The register containing the destination address. r0 represents the stack base pointer.
+    /// \param value The register whose lowest byte is the fill value. May not be r0.
+    /// \param size The register containing the number of bytes to fill. May not be r0.
+    void create_memfill(reg dest, reg value, reg size);
+
+    /// Compare two blocks of memory.
+    ///
+    /// \param result The register to store the result in. This is -1, 0, or 1 depending
+    ///     on whether the first block compares less than, equal to, or greater than the second.
+    /// \param lhs The register containing the address of the first block. r0 represents the stack base pointer.
+    /// \param rhs The register containing the address of the second block. r0 represents the stack base pointer.
+    /// \param size The register containing the number of bytes to compare. May not be r0.
+    void create_memcompare(reg result, reg lhs, reg rhs, reg size);
+
+    /// ===========================================================================
+    ///  Atomic operations.
+    /// ===========================================================================
+    /// Atomically load a value from memory.
+    ///
+    /// The size of `dest` determines the size of the access, and the address
+    /// must be aligned to that size.
+    ///
+    /// \param dest The destination register.
+    /// \param address The register containing the address. r0 represents the stack base pointer.
+    /// \param order The memory order. May not be `release` or `acq_rel`.
+    void create_atomic_load(reg dest, reg address, memory_order order = memory_order::seq_cst);
+
+    /// Atomically store a register to memory.
+    ///
+    /// The size of `src` determines the size of the access, and the address
+    /// must be aligned to that size.
+    ///
+    /// \param address The register containing the address. r0 represents the stack base pointer.
+    /// \param src The source register. May not be r0.
+    /// \param order The memory order. May not be `acquire` or `acq_rel`.
+    void create_atomic_store(reg address, reg src, memory_order order = memory_order::seq_cst);
+
+    /// Atomic read-modify-write instructions.
+    ///
+    /// These store the old value of the memory location in `dest`. The size
+    /// of `dest` determines the size of the access, and the address must be
+    /// aligned to that size. `src` may not be r0.
+#define ATOMIC(name, ...) void INTERP_CAT(create_, name)(reg dest, reg address, reg src, memory_order order = memory_order::seq_cst);
+    INTERP_ALL_ATOMIC_RMW_INSTRUCTIONS(ATOMIC)
+#undef ATOMIC
+
+    /// Atomic compare-and-swap.
+    ///
+    /// If the value at `address` is equal to `expected`, replace it with
+    /// `desired`. Either way, the old value is stored in `dest`, so the
+    /// operation succeeded iff `dest` is equal to `expected` afterwards.
+    ///
+    /// \param dest The register to store the old value in. Its size determines the size of the access.
+    /// \param address The register containing the address. r0 represents the stack base pointer.
+    /// \param expected The register containing the expected value. May not be r0.
+    /// \param desired The register containing the new value. May not be r0.
+    /// \param order The memory order if the exchange succeeds.
+    void create_atomic_cmpxchg(reg dest, reg address, reg expected, reg desired, memory_order order = memory_order::seq_cst);
+
+    /// Create a memory fence.
+    void create_fence(memory_order order = memory_order::seq_cst);
+
+    /// ===========================================================================
+    ///  Vector operations.
+    /// ===========================================================================
+    /// Load a vector from memory.
+    ///
+    /// \param dest The destination vector register.
+    /// \param src The register containing the address. r0 represents the stack base pointer.
+    /// \param shape The shape of the vector (see `interp_vector_shape`).
+    void create_vload(vreg dest, reg src, u8 shape);
+
+    /// Store a vector to memory.
+    ///
+    /// \param dest The register containing the address. r0 represents the stack base pointer.
+    /// \param src The source vector register.
+    /// \param shape The shape of the vector (see `interp_vector_shape`).
+    void create_vstore(reg dest, vreg src, u8 shape);
+
+    /// Broadcast the value of a register to every lane of a vector register.
+    ///
+    /// \param dest The destination vector register.
+    /// \param src The source register. May not be r0.
+    /// \param shape The shape of the vector (see `interp_vector_shape`).
+    void create_vsplat(vreg dest, reg src, u8 shape);
+
+    /// Lane-wise vector instructions.
+    ///
+    /// Comparisons set each lane to all ones if the comparison is true, and
+    /// to zero otherwise. Comparisons, min, and max honour INTERP_VECTOR_SIGNED.
+#define VECTOR(name, ...) void INTERP_CAT(create_, name)(vreg dest, vreg src1, vreg src2, u8 shape);
+    INTERP_ALL_VECTOR_INSTRUCTIONS(VECTOR)
+#undef VECTOR
+
+    /// Horizontal reductions.
+    ///
+    /// The result is sign-extended if the shape is INTERP_VECTOR_SIGNED, and
+    /// zero-extended otherwise. Additions wrap around at the lane size.
+#define VECTOR(name, ...) void INTERP_CAT(create_, name)(reg dest, vreg src, u8 shape);
+    INTERP_ALL_VECTOR_REDUCTIONS(VECTOR)
+#undef VECTOR
+
     /// ===========================================================================
     ///  Operations.
     /// ===========================================================================
@@ -423,12 +1070,172 @@ public:
     /// Create a call to a function.
     void create_call(const std::string& name);
 
+    /// Create a call to the function whose index is stored in a register.
+    ///
+    /// Each call site caches the last function it called, so calls
+    /// that always go to the same function are about as fast as direct
+    /// calls.
+    ///
+    /// \param index The register containing the function index. May not be r0.
+    void create_call_indirect(reg index);
+
+    /// Get the index of a function, e.g. to store it in a register
+    /// for use with an indirect call. If the function does not exist
+    /// yet, it is declared.
+    usz function_index(const std::string& name);
+
     /// Create a direct branch.
     void create_branch(addr target);
 
+    /// Create a direct branch to a label, which may be bound later.
+    ///
+    /// The branch has a 32-bit displacement, which is filled in when the
+    /// label is bound. Once all labels are bound, relax() can shrink each
+    /// branch to the smallest displacement that reaches its target, which
+    /// may in turn bring other branches closer to theirs. Code after the
+    /// first such branch moves when this happens, so addresses obtained from
+    /// current_addr() before relax() may be stale afterwards; the addresses
+    /// of labels, functions, try regions, and switch targets are updated.
+    void create_branch(label target);
+
+    /// Create a branch to the address stored in a register. The target
+    /// must be the start of an instruction.
+    ///
+    /// \param target The register containing the target address. May not be r0.
+    void create_branch_indirect(reg target);
+
+    /// Mark a range of code as a try region.
+    ///
+    /// If an exception is thrown by an instruction in [begin, end), or
+    /// by a function called from there, then the stack is unwound to
+    /// the frame of the function that contains the region, and execution
+    /// continues at the handler with the exception value in r1. If regions
+    /// are nested, the innermost one wins.
+    ///
+    /// This does not emit any instructions, so there is no overhead if no
+    /// exception is thrown.
+    ///
+    /// \param begin The first address of the region.
+    /// \param end The address after the last instruction of the region.
+    /// \param handler The address of the handler.
+    void create_try(addr begin, addr end, addr handler);
+
+    /// Throw an exception.
+    ///
+    /// \param value The register containing the exception value. May not be r0.
+    void create_throw(reg value);
+
+    /// Create a multiway branch on the value of a register.
+    ///
+    /// If the keys are dense enough, this creates a jump table indexed
+    /// by the value of the register; otherwise, it creates a sorted table
+    /// of keys that is searched with binary search.
+    ///
+    /// \param index The register to switch on. May not be r0.
+    /// \param cases Pairs of keys and targets. Keys must be unique.
+    /// \param default_target The target if no key matches.
+    void create_switch(reg index, std::vector<std::pair<word, addr>> cases, addr default_target);
+
+    /// Create a coroutine.
+    ///
+    /// The coroutine starts executing the function when it is first resumed.
+    /// Each coroutine has its own stack and its own copy of registers r32
+    /// through r63; all other registers are shared, so r1 can be used to
+    /// pass values back and forth, and r2 onwards are the arguments of the
+    /// function when it is first resumed.
+    ///
+    /// \param dest The register in which to store the handle of the coroutine.
+    /// \param func The register containing the index of the function. May not be r0.
+    void create_coroutine(reg dest, reg func);
+
+    /// Resume a coroutine until it yields or returns.
+    ///
+    /// \param status The register that is set to 1 if the coroutine yielded, and
+    ///     to 0 if it returned. A coroutine that has returned cannot be resumed.
+    /// \param handle The register containing the handle of the coroutine. May not be r0.
+    void create_resume(reg status, reg handle);
+
+    /// Suspend the current coroutine and return to the one that resumed it.
+    void create_yield();
+
+    /// Start a guest thread.
+    ///
+    /// The thread runs the function on a host worker thread, with its own
+    /// registers and its own stack; memory is shared with every other
+    /// thread. The argument is passed in r2. Every thread must be joined;
+    /// threads that haven’t been joined when the program returns are
+    /// waited for.
+    ///
+    /// \param dest The register in which to store the handle of the thread.
+    /// \param func The register containing the index of the function. May not be r0.
+    /// \param arg The register containing the argument.
+    void create_thread_spawn(reg dest, reg func, reg arg);
+
+    /// Wait for a guest thread to return.
+    ///
+    /// If the thread threw an exception, it is rethrown.
+    ///
+    /// \param dest The register in which to store the return value of the thread.
+    /// \param handle The register containing the handle of the thread. May not be r0.
+    void create_thread_join(reg dest, reg handle);
+
+    /// Run a function on chunks of a range in parallel.
+    ///
+    /// This calls the native defined by defun_parallel_for(), defining it
+    /// first if there is no function called “parallel_for” yet. Registers
+    /// r2 through r5 are overwritten, so the operands may only be among
+    /// them if they are already in the right place.
+    ///
+    /// \param dest The register in which to store the combined return value.
+    /// \param func The register containing the index of the function. May not be r0.
+    /// \param begin The register containing the start of the range.
+    /// \param end The register containing the end of the range.
+    /// \param op How to combine the return values of the chunks.
+    void create_parallel_for(reg dest, reg func, reg begin, reg end, reduction op = reduction::none);
+
     /// Create a conditional branch that branches if the top of the stack is nonzero.
     void create_branch_ifnz(reg condition, addr target);
 
+    /// Create a conditional branch to a label; see create_branch(label).
+    void create_branch_ifnz(reg condition, label target);
+
+    /// Create a label that isn’t bound to an address yet.
+    label create_label();
+
+    /// Bind a label to the current address. Every label that is branched
+    /// to must be bound exactly once before the module is run.
+    void bind(label l);
+
+    /// Get the address that a label is bound to.
+    addr label_address(label l) const;
+
+    /// Start building a function in a buffer of its own.
+    ///
+    /// Builders can be filled in on different threads at the same time;
+    /// once a builder is done, append its code to the module with link().
+    /// This is thread-safe. While builders are in use, the module itself
+    /// should only be changed through builders and link().
+    ///
+    /// \param name The name of the function. It must not be defined yet.
+    /// \throw error If a context has started running the module.
+    std::unique_ptr<function_builder> build_function(const std::string& name);
+
+    /// Append the code of a function builder to the module and define its
+    /// function. This is thread-safe, and functions can be linked in any
+    /// order. Each builder can only be linked once.
+    ///
+    /// Functions can only be linked before the module is run, since that
+    /// moves code and grows the tables that running contexts use.
+    ///
+    /// The code is appended at the end of the module. Finish any function
+    /// that is being emitted directly into the module before linking, and
+    /// call create_function() before adding more code to the module
+    /// afterwards; otherwise, that function is split in two, with the
+    /// linked function in the middle.
+    ///
+    /// \throw error If a context has started running the module.
+    void link(function_builder& f);
+
     /// Create a function that can be called.
     void create_function(const std::string& name);
 
@@ -438,6 +1245,20 @@ public:
     /// the register is truncated to the smaller size.
     void create_xchg(reg r1, reg r2);
 
+    /// Push several registers onto the stack.
+    ///
+    /// All 64 bits of each selected register are saved, in ascending
+    /// order of register number, so the same mask must be passed to
+    /// create_popregs() to restore them.
+    ///
+    /// \param mask A mask of registers; bit N selects register N. May not include r0.
+    void create_pushregs(u64 mask);
+
+    /// Pop several registers off the stack.
+    ///
+    /// \param mask A mask of registers; bit N selects register N. May not include r0.
+    void create_popregs(u64 mask);
+
     /// Get the current address.
     addr current_addr() const;
 
@@ -450,6 +1271,571 @@ public:
 #undef ARITH
 };
 
+/// ===========================================================================
+///  Function builder.
+/// ===========================================================================
+/// Builds the code of one function of a module in a buffer of its own, so
+/// that the functions of a large program can be generated in parallel.
+///
+/// A builder offers the create_*() functions of a module, but it is not a
+/// module itself and cannot be run or serialized. Calls by name are
+/// resolved when the builder is linked, so emitting them doesn’t touch the
+/// module; function_index() and create_global() do need to look at the
+/// module, but each function is only looked up there once. Branches are
+/// relative and need no fixing up; labels are local to the builder.
+/// Addresses obtained from current_addr() are offsets into the builder’s
+/// buffer until it is linked.
+///
+/// A builder cannot define other functions or native functions, and it
+/// cannot contain indirect branches, since their targets would not be
+/// moved along with the code.
+class function_builder : module {
+    friend class module;
+
+    /// The index of the function in that module.
+    usz index;
+
+    /// Whether the code has been linked into the module.
+    bool linked{};
+
+    /// Whether the code calls parallel_for, which is defined when the
+    /// builder is linked if the module doesn’t have it yet.
+    bool calls_parallel_for{};
+
+    /// The functions that the code calls, by name or by index. Every call
+    /// in a builder is a call32 whose operand indexes this list; link()
+    /// replaces it with the index of the function in the module.
+    std::vector<std::variant<std::string, usz>> callees;
+    std::unordered_map<std::string, u32> callees_by_name;
+
+    /// Functions that have already been looked up in the module.
+    std::unordered_map<std::string, usz> known_functions;
+    std::unordered_map<std::string, usz> known_library_functions;
+
+    explicit function_builder(module& m, usz function_index);
+
+    /// Get the operand of a call to a function.
+    u32 callee(const std::string& name);
+    u32 callee(usz function_index);
+
+    /// Lock the module to look something up or create something in it.
+    std::unique_lock<std::mutex> lock_owner();
+
+public:
+    using module::bind;
+    using module::create_alloca;
+    using module::create_atomic_cmpxchg;
+    using module::create_atomic_load;
+    using module::create_atomic_store;
+    using module::create_branch;
+    using module::create_branch_ifnz;
+    using module::create_call;
+    using module::create_call_indirect;
+    using module::create_coroutine;
+    using module::create_fence;
+    using module::create_global;
+    using module::create_label;
+    using module::create_library_call_unsafe;
+    using module::create_load;
+    using module::create_memcompare;
+    using module::create_memcopy;
+    using module::create_memfill;
+    using module::create_move;
+    using module::create_parallel_for;
+    using module::create_popregs;
+    using module::create_pushregs;
+    using module::create_resume;
+    using module::create_return;
+    using module::create_store;
+    using module::create_switch;
+    using module::create_thread_join;
+    using module::create_thread_spawn;
+    using module::create_throw;
+    using module::create_try;
+    using module::create_vload;
+    using module::create_vsplat;
+    using module::create_vstore;
+    using module::create_xchg;
+    using module::create_yield;
+    using module::current_addr;
+    using module::function_index;
+    using module::label_address;
+
+#define USING(name, ...) using module::INTERP_CAT(create_, name);
+    INTERP_ALL_ARITHMETIC_INSTRUCTIONS(USING)
+    INTERP_ALL_ATOMIC_RMW_INSTRUCTIONS(USING)
+    INTERP_ALL_VECTOR_INSTRUCTIONS(USING)
+    INTERP_ALL_VECTOR_REDUCTIONS(USING)
+#undef USING
+
+    /// Get the index of the function in the module.
+    usz function() const { return index; }
+};
+
+/// ===========================================================================
+///  Context.
+/// ===========================================================================
+/// A context holds the state of one execution of a module: registers,
+/// memory, and stacks. Contexts are cheap to create, and each one can
+/// run on a different thread.
+class context : public ::interp_handle_t {
+    friend class module;
+    friend class snapshot;
+
+    /// The module that we’re executing.
+    const module& mod;
+
+    /// The code that we’re executing, and its functions.
+    const std::vector<u8>& bytecode;
+    const std::vector<module::function>& functions;
+
+    /// Instruction pointer.
+    addr ip{};
+
+    /// Registers.
+    ///
+    /// The underscores are due to the fact that, sometimes, you don’t
+    /// want to use this directly, and they make you think twice about
+    /// using this.
+    std::array<word, register_count> _registers_{};
+
+    /// Vector registers.
+    std::array<vector_value, vector_register_count> _vregisters_{};
+
+    /// Stack pointer. This *must* always be aligned to 8 bytes.
+    ptr sp{};
+
+    /// Global variables and stack.
+    guest_memory _memory_;
+    ptr stack_base{};
+
+    /// End of the current stack. This is the start of the coroutine stacks
+    /// for the main stack, and the end of its stack slice for a coroutine.
+    ptr stack_limit{};
+
+    /// Base of the bottommost stack frame of the current stack. Returning
+    /// from this frame ends the program or the current coroutine.
+    ptr bottom_frame{};
+
+    /// Inline cache for an indirect call site. Only calls to functions
+    /// defined in bytecode are cached.
+    struct call_cache {
+        word index{};
+        addr target{};
+        usz locals_size{};
+        bool valid{};
+    };
+
+    /// One entry per indirect call site.
+    std::vector<call_cache> call_caches;
+
+    /// Saved state of a stack of execution. Entry 0 is the main stack.
+    ///
+    /// Each coroutine owns a slice of memory for its stack; slices are
+    /// carved from the top of memory and reused once a coroutine returns.
+    struct coroutine {
+        enum struct state : u8 {
+            free,
+            suspended,
+            running,
+        };
+
+        addr ip{};
+        ptr sp{};
+        ptr stack_base{};
+        ptr bottom_frame{};
+        ptr stack_limit{};
+
+        /// Start of the stack slice of this coroutine.
+        ptr stack_slice{};
+
+        /// The coroutine that resumed this one, and the register in which
+        /// *this* coroutine receives the status of a coroutine it resumed.
+        u32 resumer{};
+        reg status_reg{};
+        state st = state::free;
+
+        /// Registers that are private to each coroutine.
+        std::array<word, register_count - coroutine_register_base> registers{};
+    };
+
+    std::vector<coroutine> coroutines;
+    std::vector<u32> free_coroutines;
+    u32 current_coroutine{};
+
+    /// The lowest address used by a coroutine stack.
+    ptr coroutine_stacks_end{};
+
+    /// How many stack frames deep we are.
+    usz stack_frame_count{};
+
+    /// Number of back-edges and calls left before the current run is suspended.
+    u64 budget{};
+
+    /// Whether there is a run that has been started, but hasn’t finished.
+    bool suspended{};
+
+    /// Whether the current run can stop and be resumed later.
+    bool resumable_run{};
+
+    /// Set by a native function to stop the run and retry the call on resume.
+    bool blocked{};
+
+    /// Channels attached to this context.
+    std::vector<std::shared_ptr<channel>> channels;
+
+    /// File descriptors attached to this context.
+    std::vector<int> files;
+
+    /// Messages that were too large for the buffer they were received
+    /// into, by channel handle. They are received again next time.
+    std::unordered_map<word, std::vector<u8>> held_messages;
+
+    /// Asynchronous native function that the run is blocked on.
+    task pending_task;
+
+    /// Signals that a blocked run can continue. Created on first use.
+    std::shared_ptr<event_notifier> notifier;
+
+    /// Fuel left, if metering is enabled.
+    u64 fuel{};
+    bool metered{};
+
+    /// Whether the run of code at ip still needs to be paid for.
+    bool charge_pending{};
+
+    /// Checked at the same points as the budget. Guest threads share this
+    /// with the context that started them.
+    std::shared_ptr<interrupt_state> interrupts = std::make_shared<interrupt_state>();
+
+    /// Guest threads of this context, or of the context that started this
+    /// one if this is a guest thread itself. Created on first use.
+    std::shared_ptr<thread_group> threads;
+
+    /// Whether this is a guest thread.
+    bool guest_thread{};
+
+    /// I/O services that may have operations in flight that use our memory.
+    std::vector<std::shared_ptr<io_service>> io_services;
+
+    /// ===========================================================================
+    ///  Decoder.
+    /// ===========================================================================
+    /// Set (part of) a register to a value.
+    void set_register(reg r, word value);
+
+    /// Read (part of) a register.
+    word read_register(reg r) const;
+
+    /// Decode a register operand that may also be an immediate.
+    word decode_register_operand(reg r);
+
+    /// Decode an arithmetic instruction.
+    struct arith_t {
+        reg dest;
+        word src1;
+        word src2;
+    };
+    arith_t decode_arithmetic();
+
+    /// Read an address from the bytecode at ip.
+    word read_sized_address_at_ip(opcode op);
+
+    /// Bounds-check a memory range and get the corresponding host address.
+    u8* mem_range(ptr p, usz size);
+
+    /// Like mem_range(), but also checks that the address is suitably aligned for an atomic access.
+    u8* atomic_mem(ptr p, usz size);
+
+    /// Copy the registers in a mask to or from memory.
+    void copy_registers(u64 mask, word* mem, bool save);
+
+    /// Call a function by index.
+    void call_function(usz index);
+
+    /// Push a stack frame and jump to a function.
+    void enter_function(addr target, usz locals_size);
+
+    /// Create a coroutine that runs a function and return its handle.
+    u32 new_coroutine(word function_index);
+
+    /// Save the current stack and switch to a coroutine.
+    void switch_coroutine(u32 to);
+
+    /// Free the current coroutine and switch back to its resumer. Returns the resumer.
+    u32 finish_coroutine();
+
+    /// Unwind the stack to the innermost handler for an exception thrown at an address.
+    void unwind(addr at, word value);
+
+    /// Separate function because it’s just too horrible.
+    void do_library_call_unsafe(const module::library_function& f);
+
+    /// Set up the stack and registers to run a function.
+    void start(usz function_index);
+
+    /// Pay for the straight-line run of code at ip.
+    void charge_fuel();
+
+    /// Run until the program finishes or the budget runs out.
+    run_status execute();
+
+    /// Figure out why execution stopped at a tick.
+    run_status stop_reason();
+
+    /// Reserve the stacks of guest threads at the top of memory.
+    void reserve_thread_stacks();
+
+    /// Start a guest thread and return its handle.
+    word spawn_thread(word function_index, word arg);
+
+    /// Start a guest thread with arguments in r2 and r3, or return 0 if
+    /// there are already as many threads as there can be.
+    word try_spawn_thread(word function_index, word arg0, word arg1);
+
+    /// Wait for a guest thread and return its return value.
+    word join_thread(word handle);
+
+    /// Make event_fd() not readable.
+    void clear_events();
+
+    /// Call an asynchronous native function, or pick up where we left off if
+    /// the run was blocked on it.
+    void call_async(const async_native_function& func);
+
+    /// Run a guest thread to completion and record how it ended.
+    static void run_thread(thread_group& group, usz slot) noexcept;
+
+    /// Wait for all guest threads that haven’t been joined.
+    ///
+    /// \param cancel Whether to cancel them first. Threads that haven’t
+    ///     started yet are dropped either way.
+    void reap_threads(bool cancel) noexcept;
+
+    /// Cancel I/O operations that use our memory, or that of our guest
+    /// threads, and wait for them. Threads must have been reaped.
+    void cancel_io() noexcept;
+
+    /// Remember that an I/O service may have operations for us.
+    void use_io(const std::shared_ptr<io_service>& io);
+
+public:
+    /// Size of the stack of each coroutine.
+    usz coroutine_stack_size = 16 * 1024;
+
+    /// Maximum number of guest threads that can run at the same time,
+    /// and the size of the stack of each one. Memory for their stacks is
+    /// only reserved if the module spawns threads.
+    ///
+    /// Guest threads can be neither metered nor suspended, so runs that
+    /// use fuel or that can be resumed cannot start them.
+    usz max_guest_threads = 8;
+    usz guest_thread_stack_size = 16 * 1024;
+
+    /// The host threads that guest threads run on. If this is null, a
+    /// process-wide executor with one worker per core is used.
+    executor* thread_executor{};
+
+    /// Last error. Used by the C API.
+    std::string last_error;
+
+    /// ===========================================================================
+    ///  Driver and Utils.
+    /// ===========================================================================
+
+    /// Create a context that runs a module. The module must outlive the context.
+    explicit context(const module& m);
+
+    /// Waits for guest threads.
+    ~context() noexcept;
+
+    /// Contexts can be moved, but not copied.
+    context(const context&) = delete;
+    context(context&&) noexcept = default;
+    context& operator=(const context&) = delete;
+    context& operator=(context&&) noexcept = delete;
+
+    /// Clear all state: registers, memory, stacks, attached channels,
+    /// fuel, deadlines, and pending cancellations. This is cheaper than
+    /// creating a new context, since the memory stays mapped.
+    void reset();
+
+    /// Run the module, starting at the entry point.
+    ///
+    /// \throw interrupted If the run is cancelled or exceeds its deadline.
+    /// \return The return value of the program.
+    word run();
+
+    /// Run a function as though it were the entry point.
+    ///
+    /// \param function_index The index of a function defined in bytecode.
+    /// \return The return value of the function.
+    word run(usz function_index);
+
+    /// Run a function as though it were the entry point, with arguments.
+    ///
+    /// \param function_index The index of a function defined in bytecode.
+    /// \param args The arguments, which are passed in r2, r3, and so on.
+    /// \return The return value of the function.
+    word run(usz function_index, std::span<const word> args);
+
+    /// Run the module, but stop after a number of ticks.
+    ///
+    /// A tick is a call or a backward jump; straight-line code is never
+    /// interrupted. Once the budget runs out, the run is suspended with
+    /// its state intact, and it can be continued with resume().
+    ///
+    /// \param max_ticks The maximum number of ticks to run for.
+    /// \return Whether the program finished or why it stopped.
+    run_status run_for(u64 max_ticks);
+
+    /// Continue a suspended run.
+    ///
+    /// \param max_ticks The maximum number of ticks to run for.
+    /// \return Whether the program finished or why it stopped.
+    run_status resume(u64 max_ticks = std::numeric_limits<u64>::max());
+
+    /// Run the module until it finishes or blocks, for embedding in an
+    /// event loop.
+    ///
+    /// If the run blocks, wait for event_fd() to become readable, and then
+    /// continue with resume(); repeat until the run finishes. This keeps
+    /// a thread free while a guest waits, so one thread can drive any
+    /// number of guests.
+    ///
+    /// \return Whether the program finished or why it stopped.
+    run_status run_until_blocked();
+
+    /// Get a file descriptor that becomes readable once a blocked run can
+    /// continue, e.g. to register it with epoll. It is an eventfd on Linux
+    /// and the read end of a pipe elsewhere. resume() clears it; otherwise,
+    /// it stays readable. It is owned by the context.
+    int event_fd();
+
+    /// Get the return value of a finished run.
+    word result() const;
+
+    /// Enable fuel metering and set the amount of fuel left.
+    ///
+    /// Each instruction costs one unit of fuel. Fuel is paid for every
+    /// straight-line run of code before it is executed, so a run that
+    /// does not have enough fuel left to complete a run of code throws
+    /// out_of_fuel before executing any of it. The state is left intact,
+    /// so the run can be continued with resume() after adding more fuel.
+    void set_fuel(u64 amount);
+
+    /// Disable fuel metering.
+    void disable_fuel();
+
+    /// Get the amount of fuel left, if metering is enabled.
+    std::optional<u64> remaining_fuel() const;
+
+    /// Stop the current run. This can be called from any thread.
+    ///
+    /// The run stops at its next call or backward jump with the status
+    /// cancelled, and its state is left intact. If nothing is running,
+    /// the next run stops as soon as it gets to a call or backward jump.
+    void interrupt();
+
+    /// Set a point in time after which runs stop with the status
+    /// deadline_exceeded. This applies to every run and resume() until
+    /// the deadline is changed or cleared.
+    void set_deadline(std::chrono::steady_clock::time_point when);
+
+    /// Remove the deadline.
+    void clear_deadline();
+
+    /// Check whether the current run can stop and be resumed, i.e. whether it
+    /// was started by run_for(). Native functions that have to wait for
+    /// something should call block() in this case instead of waiting.
+    bool resumable() const { return resumable_run; }
+
+    /// Stop the current run with the status blocked once the calling native
+    /// function returns, so the host can do something else in the meantime.
+    /// The call is executed again when the run is resumed.
+    ///
+    /// \throw error If the run isn’t resumable.
+    void block();
+
+    /// Called when an asynchronous native function that a run is blocked on
+    /// returns, on the thread that finished it. Use this to schedule a call
+    /// to resume().
+    std::function<void()> wakeup;
+
+    /// Get a function that tells the host that a blocked run can continue:
+    /// it makes event_fd() readable and calls wakeup. Native functions that
+    /// call block() should arrange for it to be called once whatever they
+    /// are waiting for happens. It can be called from any thread, any
+    /// number of times, even after the context is gone.
+    std::function<void()> waker();
+
+    /// Attach a channel so that guests can use it.
+    ///
+    /// \return The handle by which guests refer to the channel.
+    word attach(std::shared_ptr<channel> ch);
+
+    /// Get an attached channel by its handle.
+    channel& attached_channel(word handle) const;
+
+    /// Let guests use a file descriptor through the natives defined by
+    /// module::defun_io(). Guests can only use descriptors attached this
+    /// way. The descriptor stays owned by the caller, and it must stay open
+    /// until the context is reset or destroyed.
+    ///
+    /// \return The handle by which guests refer to the file.
+    word attach_file(int fd);
+
+    /// Get an attached file descriptor by its handle.
+    int attached_file(word handle) const;
+
+    /// Run a function on chunks of [begin, end) on guest threads.
+    ///
+    /// This is what the native defined by defun_parallel_for() does; see
+    /// there for details. It may only be called while the context is
+    /// running a module that spawns threads, e.g. from a native function.
+    ///
+    /// \return The combined return values of the chunks.
+    word parallel_for(word function_index, word begin, word end, reduction op);
+
+    /// ===========================================================================
+    ///  State manipulation.
+    /// ===========================================================================
+    /// Get the value of an argument register.
+    word arg(usz index, interp_size_mask sz) const;
+
+    /// Load a value from memory.
+    word load_mem(ptr p, usz sz) const;
+
+    /// Get a range of memory. Throws if it is out of bounds.
+    std::span<u8> memory(ptr p, usz size);
+
+    /// Push a value onto the stack.
+    void push(word value);
+
+    /// Pop a value from the stack.
+    word pop();
+
+    /// Get the value of a register.
+    word r(reg r) const;
+    void r(reg r, word value);
+
+    /// Set the return value.
+    void set_return_value(word value);
+
+    /// Store a value to memory.
+    void store_mem(ptr p, word value, usz sz);
+};
+
+/// ===========================================================================
+///  Interpreter.
+/// ===========================================================================
+/// A module together with a context that runs it.
+class interpreter : public module, public context {
+public:
+    /// Construct an interpreter.
+    explicit interpreter() : context(static_cast<const module&>(*this)) {}
+};
+
 } // namespace interp
 
 #endif // INTERPRETER_INTERP_HH
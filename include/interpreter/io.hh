@@ -0,0 +1,173 @@
+#ifndef INTERPRETER_IO_HH
+#define INTERPRETER_IO_HH
+
+#include <atomic>
+#include <coroutine>
+#include <interpreter/interp.hh>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <unordered_map>
+
+namespace interp {
+class executor;
+
+/// ===========================================================================
+///  Asynchronous I/O.
+/// ===========================================================================
+/// Reads and writes files without blocking the thread that runs a guest.
+///
+/// Operations are queued by submit_read() and submit_write() and handed
+/// to the kernel in batches by flush(), which happens at the latest when
+/// someone waits for one of them. On Linux, this uses io_uring, talking
+/// to the kernel through raw system calls; where io_uring isn’t available
+/// (older kernels, seccomp filters, other platforms), each operation runs
+/// as a blocking call on a small thread pool instead. A blocking call on a
+/// pipe or socket could wait forever and can’t be cancelled, so the thread
+/// pool only supports regular files and block devices; operations on
+/// anything else fail with EOPNOTSUPP.
+///
+/// Coroutines waiting for an operation are resumed on the thread pool,
+/// never on the thread that collects io_uring completions, so a slow
+/// continuation doesn’t hold up other operations.
+///
+/// Guests use this through the natives defined by module::defun_io().
+class io_service {
+public:
+    /// How operations are performed.
+    enum struct backend : u8 {
+        /// io_uring if it is available; threads otherwise.
+        automatic,
+
+        /// io_uring. Creating the service fails if it isn’t available.
+        io_uring,
+
+        /// Blocking system calls on a thread pool.
+        threads,
+    };
+
+private:
+    /// An operation in flight.
+    struct operation {
+        /// States of an operation. An abandoned operation has been cancelled
+        /// by its context; no one is resumed once it is done.
+        constexpr static u8 pending = 0, awaited = 1, done = 2, abandoned = 3;
+
+        std::atomic<u8> state{pending};
+        std::coroutine_handle<> waiter;
+
+        /// Bytes transferred, or a negated errno value.
+        i64 result{};
+
+        /// The context whose memory the operation uses, if any.
+        const context* owner{};
+
+        /// Set once the operation is done and whoever waited for it has
+        /// been resumed, so nothing touches the buffer or the waiter anymore.
+        std::atomic<bool> settled{};
+    };
+
+    struct ring;
+
+    backend kind;
+    std::unique_ptr<ring> uring;
+    std::unique_ptr<executor> pool;
+
+    /// Operations that haven’t been waited for, by ticket.
+    std::mutex ops_mutex;
+    std::unordered_map<word, std::shared_ptr<operation>> ops;
+    word next_ticket = 1;
+
+    /// Operations that aren’t settled yet. The kernel only knows their
+    /// address, so this keeps them alive until it is done with them.
+    std::unordered_map<const operation*, std::shared_ptr<operation>> in_flight;
+
+    /// Thread that collects io_uring completions.
+    std::thread reaper;
+
+    /// Record the result of an operation and have the thread pool resume
+    /// whoever waits for it.
+    void complete(const operation* op, i64 result);
+
+    /// Queue an operation.
+    word submit(bool write, int fd, u8* data, usz size, i64 offset, const context* owner);
+
+    /// Collect io_uring completions until the service is destroyed.
+    void reap();
+
+public:
+    /// Waits for an operation; the result of `co_await` is the result of
+    /// the operation.
+    class completion {
+        friend class io_service;
+        std::shared_ptr<operation> op;
+
+        explicit completion(std::shared_ptr<operation> o) : op(std::move(o)) {}
+
+    public:
+        bool await_ready() const { return op->state.load(std::memory_order_acquire) == operation::done; }
+        bool await_suspend(std::coroutine_handle<> h);
+        i64 await_resume() const { return op->result; }
+    };
+
+    /// Create a service.
+    ///
+    /// \param b How to perform operations.
+    /// \param queue_depth Maximum number of operations handed to the
+    ///        kernel at once when using io_uring.
+    /// \param threads Number of threads that resume waiting coroutines and,
+    ///        when not using io_uring, perform the blocking calls.
+    explicit io_service(backend b = backend::automatic, u32 queue_depth = 256, usz threads = 4);
+
+    io_service(const io_service&) = delete;
+    io_service(io_service&&) noexcept = delete;
+    io_service& operator=(const io_service&) = delete;
+    io_service& operator=(io_service&&) noexcept = delete;
+
+    /// Wait for all operations that have been handed to the kernel.
+    ~io_service() noexcept;
+
+    /// Get how operations are performed. This is never automatic.
+    backend get_backend() const { return kind; }
+
+    /// Queue a read into a buffer, which must stay valid until the read is done.
+    ///
+    /// \param fd The file descriptor.
+    /// \param buffer The buffer to read into.
+    /// \param offset The offset in the file, or -1 to use and update the file position.
+    /// \param owner The context whose memory the buffer is in, if any.
+    /// \return A ticket for wait().
+    word submit_read(int fd, std::span<u8> buffer, i64 offset, const context* owner = nullptr);
+
+    /// Queue a write from a buffer, which must stay valid until the write is done.
+    ///
+    /// \param fd The file descriptor.
+    /// \param buffer The data to write.
+    /// \param offset The offset in the file, or -1 to use and update the file position.
+    /// \param owner The context whose memory the buffer is in, if any.
+    /// \return A ticket for wait().
+    word submit_write(int fd, std::span<const u8> buffer, i64 offset, const context* owner = nullptr);
+
+    /// Hand all queued operations to the kernel.
+    void flush();
+
+    /// Wait for an operation. This flushes the queue. Every ticket can
+    /// only be waited for once.
+    ///
+    /// \param ticket The ticket returned when the operation was queued.
+    /// \param owner If not null, the context that queued the operation.
+    /// \return An awaitable that yields the number of bytes transferred,
+    ///         or a negated errno value.
+    completion wait(word ticket, const context* owner = nullptr);
+
+    /// Cancel all operations of a context and wait until they have ended.
+    /// Whoever waits for them is not resumed, and their tickets become
+    /// invalid. With the threads backend, operations can’t be cancelled,
+    /// so this waits for them to finish; since they only use files, that
+    /// doesn’t take long.
+    void cancel(const context& owner);
+};
+} // namespace interp
+
+#endif // INTERPRETER_IO_HH
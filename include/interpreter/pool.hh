@@ -0,0 +1,108 @@
+#ifndef INTERPRETER_POOL_HH
+#define INTERPRETER_POOL_HH
+
+#include <chrono>
+#include <functional>
+#include <interpreter/interp.hh>
+#include <memory>
+#include <mutex>
+
+namespace interp {
+class snapshot;
+
+/// ===========================================================================
+///  Context pool.
+/// ===========================================================================
+/// A pool of contexts that run the same module.
+///
+/// Acquiring a context from the pool reuses an idle one if there is
+/// one; releasing it resets it and makes it idle again. Resetting only
+/// costs as much as the memory the context actually touched, so this is
+/// much cheaper than creating and destroying a context per run.
+///
+/// The pool is thread-safe; the contexts it hands out are not.
+class context_pool {
+public:
+    /// A context borrowed from a pool. Returns the context when destroyed.
+    class lease {
+        friend class context_pool;
+        context_pool* pool{};
+        std::unique_ptr<context> ctx;
+
+        lease(context_pool* p, std::unique_ptr<context> c) : pool(p), ctx(std::move(c)) {}
+
+    public:
+        lease(const lease&) = delete;
+        lease(lease&&) noexcept = default;
+        lease& operator=(const lease&) = delete;
+        lease& operator=(lease&& other) noexcept;
+        ~lease() noexcept;
+
+        context& operator*() const { return *ctx; }
+        context* operator->() const { return ctx.get(); }
+    };
+
+    /// Pool statistics.
+    struct metrics {
+        /// Number of contexts handed out.
+        usz acquired{};
+
+        /// Number of contexts that had to be created because none were idle.
+        usz created{};
+
+        /// Number of contexts that were returned to the pool.
+        usz released{};
+
+        /// Number of returned contexts that were destroyed because the pool was full.
+        usz discarded{};
+
+        /// Number of contexts currently in use.
+        usz in_use{};
+
+        /// Number of idle contexts.
+        usz idle{};
+
+        /// Total time spent resetting contexts.
+        std::chrono::nanoseconds reset_time{};
+    };
+
+private:
+    /// Creates a new context.
+    std::function<std::unique_ptr<context>()> create;
+
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<context>> idle;
+    usz max_idle;
+    metrics stats;
+
+    /// Reset a context and make it idle.
+    void release(std::unique_ptr<context> ctx) noexcept;
+
+public:
+    /// Create a pool for a module. The module must outlive the pool.
+    ///
+    /// \param m The module that contexts from this pool run.
+    /// \param max_idle_contexts How many idle contexts to keep around at most.
+    explicit context_pool(const module& m, usz max_idle_contexts = 64);
+
+    /// Create a pool of contexts that start out in the state captured
+    /// by a snapshot. The snapshot must outlive the pool.
+    explicit context_pool(const snapshot& s, usz max_idle_contexts = 64);
+
+    context_pool(const context_pool&) = delete;
+    context_pool(context_pool&&) noexcept = delete;
+    context_pool& operator=(const context_pool&) = delete;
+    context_pool& operator=(context_pool&&) noexcept = delete;
+
+    /// Get a ready-to-run context.
+    lease acquire();
+
+    /// Create idle contexts until there are at least `count` of them.
+    void reserve(usz count);
+
+    /// Get a snapshot of the pool statistics.
+    metrics get_metrics() const;
+};
+} // namespace interp
+
+#endif // INTERPRETER_POOL_HH
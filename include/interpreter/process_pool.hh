@@ -0,0 +1,189 @@
+#ifndef INTERPRETER_PROCESS_POOL_HH
+#define INTERPRETER_PROCESS_POOL_HH
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <interpreter/interp.hh>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace interp {
+/// ===========================================================================
+///  Process pool.
+/// ===========================================================================
+/// Runs functions of a module in worker processes, so that a guest (or a
+/// native function) that crashes only takes down its worker, not the host.
+///
+/// The module is serialized once into a sealed in-memory file, from which
+/// a helper process loads it. The helper is forked when the pool is
+/// created, before the pool starts any threads of its own; it stays single-
+/// threaded and forks the workers, so a worker never starts out with locks
+/// held by threads that don’t exist in it. Still, create the pool before
+/// starting host threads that may be holding locks at the time. Workers
+/// receive runs and send back results over Unix domain sockets, in frames
+/// that carry many runs at once to keep the number of system calls per run
+/// low. The host never blocks on a socket; frames that a worker isn’t ready
+/// to take yet are buffered.
+///
+/// If a worker dies, the run that it was executing fails, and a new worker
+/// is started in its place. The other runs that had been sent to it are
+/// run again, so a run that was sent along with one that crashes its worker
+/// may be executed twice. Each run starts out with zeroed memory.
+///
+/// This is currently only supported on Linux.
+class process_pool {
+public:
+    /// Called in each worker after it has loaded the module, e.g. to define
+    /// native functions, which are not part of the serialized module.
+    using setup_function = std::function<void(module&)>;
+
+    /// Pool statistics.
+    struct metrics {
+        /// Number of runs submitted.
+        usz submitted{};
+
+        /// Number of runs that returned a value.
+        usz completed{};
+
+        /// Number of runs that threw an exception, or that killed their worker.
+        usz failed{};
+
+        /// Number of frames sent to workers.
+        usz batches{};
+
+        /// Number of workers that died and had to be replaced.
+        usz respawned{};
+
+        /// Number of runs that were run again because their worker died.
+        usz retried{};
+    };
+
+private:
+    /// A run that has been submitted.
+    struct job {
+        usz function;
+        std::vector<word> args;
+        std::promise<word> result;
+    };
+
+    struct worker {
+        int pid = -1;
+        int fd = -1;
+
+        /// Runs sent to the worker, in the order it executes them.
+        std::deque<job> in_flight;
+
+        /// Number of runs the worker has started, in memory shared with
+        /// it, and number of results we have received from it. If it dies,
+        /// the last run it started is the one that killed it.
+        std::atomic<u64>* started{};
+        u64 answered{};
+
+        /// Bytes received that don’t make up a whole frame yet.
+        std::vector<u8> received;
+
+        /// Frames that haven’t been sent yet.
+        std::vector<u8> outgoing;
+    };
+
+    /// The module, loaded from the image. Used to look up functions.
+    module loaded;
+    setup_function setup;
+
+    /// The file that holds the image of the module.
+    int image_fd = -1;
+    usz image_size{};
+
+    /// Maximum number of runs per frame, and per worker at a time.
+    usz max_batch;
+
+    /// Shared memory that holds the run counters of the workers.
+    void* counters = nullptr;
+    usz counters_size{};
+
+    /// The helper process that forks workers, and our socket to it.
+    int helper_pid = -1;
+    int helper_fd = -1;
+
+    std::vector<worker> workers;
+
+    /// Runs that have not been sent to a worker yet.
+    mutable std::mutex mutex;
+    std::deque<job> queue;
+    metrics stats;
+    bool stopping = false;
+
+    /// Wakes up the dispatcher when runs are submitted.
+    int wake_fd = -1;
+    std::thread dispatcher;
+
+    /// Start the helper process.
+    void start_helper();
+
+    /// Start a worker.
+    void spawn(worker& w);
+
+    /// Get the exit status of a worker that has died.
+    int reap(worker& w);
+
+    /// Hand queued runs to workers.
+    void dispatch();
+
+    /// Send as much of the buffered frames of a worker as it will take
+    /// without blocking. Returns false if it died.
+    bool flush(worker& w);
+
+    /// Read results from a worker. Returns false if it died or sent
+    /// something malformed.
+    bool collect(worker& w);
+
+    /// Fail the run that killed a worker, requeue its other runs, and replace it.
+    void replace(worker& w);
+
+    /// Main loop of the dispatcher.
+    void run_dispatcher();
+
+public:
+    /// Start the workers.
+    ///
+    /// \param m The module to run. It is copied, so it can be changed or
+    ///        destroyed afterwards.
+    /// \param processes Number of workers. Defaults to one per core.
+    /// \param setup Called in each worker after loading the module. It is
+    ///        also called once in the host to make sure it works.
+    /// \param max_batch Maximum number of runs per frame.
+    explicit process_pool(
+        const module& m,
+        usz processes = std::thread::hardware_concurrency(),
+        setup_function setup = {},
+        usz max_batch = 64
+    );
+
+    process_pool(const process_pool&) = delete;
+    process_pool(process_pool&&) noexcept = delete;
+    process_pool& operator=(const process_pool&) = delete;
+    process_pool& operator=(process_pool&&) noexcept = delete;
+
+    /// Wait for all submitted runs and stop the workers.
+    ~process_pool() noexcept;
+
+    /// Get the number of workers.
+    usz size() const { return workers.size(); }
+
+    /// Run a function in a worker.
+    ///
+    /// \param function The name of a function defined in bytecode.
+    /// \param args The arguments, which are passed in r2, r3, and so on.
+    /// \return The return value of the function. If the function throws,
+    ///         or the worker dies, the future holds an error instead.
+    std::future<word> submit(const std::string& function, std::vector<word> args = {});
+
+    /// Get a snapshot of the pool statistics.
+    metrics get_metrics() const;
+};
+} // namespace interp
+
+#endif // INTERPRETER_PROCESS_POOL_HH
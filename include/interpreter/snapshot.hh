@@ -0,0 +1,52 @@
+#ifndef INTERPRETER_SNAPSHOT_HH
+#define INTERPRETER_SNAPSHOT_HH
+
+#include <interpreter/interp.hh>
+#include <memory>
+
+namespace interp {
+/// ===========================================================================
+///  Snapshots.
+/// ===========================================================================
+/// The state of the globals of a module after running an init function.
+///
+/// Taking a snapshot runs the init function once, in a context of its
+/// own, and then freezes its globals in a sealed in-memory file. Contexts
+/// spawned from the snapshot map that file copy-on-write, so they start
+/// out with the globals exactly as the init function left them without
+/// having to run it again. Resetting such a context (e.g. when it is
+/// returned to a pool) restores the snapshot rather than zeroing memory.
+///
+/// Only memory is captured: registers and the stack start out empty.
+/// This is currently only supported on Linux.
+class snapshot {
+    const module& mod;
+
+    /// The file that holds the memory image.
+    int fd = -1;
+
+    /// Size of the memory image.
+    usz size{};
+
+public:
+    /// Take a snapshot of a module.
+    ///
+    /// \param m The module. Must outlive the snapshot.
+    /// \param init_function The name of a function defined in bytecode
+    ///        that initialises the globals.
+    explicit snapshot(const module& m, const std::string& init_function);
+
+    snapshot(const snapshot&) = delete;
+    snapshot(snapshot&&) noexcept = delete;
+    snapshot& operator=(const snapshot&) = delete;
+    snapshot& operator=(snapshot&&) noexcept = delete;
+
+    /// Free resources.
+    ~snapshot() noexcept;
+
+    /// Create a context that starts out in the state captured by the snapshot.
+    std::unique_ptr<context> spawn() const;
+};
+} // namespace interp
+
+#endif // INTERPRETER_SNAPSHOT_HH
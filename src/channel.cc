@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <interpreter/channel.hh>
+
+interp::channel::channel(kind k, usz capacity)
+    : type(k),
+      mask(std::bit_ceil(std::max<usz>(capacity, 2)) - 1),
+      cells(new cell[mask + 1]) {
+    for (u64 i = 0; i <= mask; i++) cells[i].seq.store(i, std::memory_order_relaxed);
+}
+
+bool interp::channel::push(message& m) {
+    /// Only we move the head, so there is nothing to race with.
+    if (type == kind::spsc) {
+        auto h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) > mask) return false;
+        cells[h & mask].msg = std::move(m);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// A cell is free for position `pos` once its sequence number is `pos`.
+    auto pos = head.load(std::memory_order_relaxed);
+    for (;;) {
+        auto& c = cells[pos & mask];
+        auto seq = c.seq.load(std::memory_order_acquire);
+        auto diff = i64(seq - pos);
+
+        /// Free. Claim it.
+        if (diff == 0) {
+            if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                c.msg = std::move(m);
+                c.seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+
+        /// Full.
+        else if (diff < 0) return false;
+
+        /// Someone else got there first.
+        else pos = head.load(std::memory_order_relaxed);
+    }
+}
+
+bool interp::channel::pop(message& m) {
+    if (type == kind::spsc) {
+        auto t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) return false;
+        m = std::move(cells[t & mask].msg);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// A cell holds a message for position `pos` once its sequence number is `pos + 1`.
+    auto pos = tail.load(std::memory_order_relaxed);
+    for (;;) {
+        auto& c = cells[pos & mask];
+        auto seq = c.seq.load(std::memory_order_acquire);
+        auto diff = i64(seq - (pos + 1));
+
+        /// Holds a message. Take it and free the cell for the next lap.
+        if (diff == 0) {
+            if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                m = std::move(c.msg);
+                c.seq.store(pos + mask + 1, std::memory_order_release);
+                return true;
+            }
+        }
+
+        /// Empty.
+        else if (diff < 0) return false;
+
+        /// Someone else got there first.
+        else pos = tail.load(std::memory_order_relaxed);
+    }
+}
+
+void interp::channel::wake(std::vector<watcher>& callbacks) {
+    /// Pairs with the fence in watch(): either we see the callback, or it
+    /// sees what we just did when it checks again.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (not watched.load(std::memory_order_relaxed)) return;
+
+    std::vector<watcher> to_call;
+    {
+        std::unique_lock _{watch_mutex};
+        to_call.swap(callbacks);
+        watched.store(not waiting_for_message.empty() or not waiting_for_room.empty(), std::memory_order_relaxed);
+    }
+
+    for (auto& [_, cb] : to_call) cb();
+}
+
+void interp::channel::watch(std::vector<watcher>& callbacks, std::function<void()> callback, const void* owner) {
+    {
+        std::unique_lock _{watch_mutex};
+        auto it = owner ? std::ranges::find(callbacks, owner, &watcher::first) : callbacks.end();
+        if (it != callbacks.end()) it->second = std::move(callback);
+        else callbacks.emplace_back(owner, std::move(callback));
+        watched.store(true, std::memory_order_relaxed);
+    }
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void interp::channel::notify_on_send(std::function<void()> callback, const void* owner) {
+    watch(waiting_for_message, std::move(callback), owner);
+}
+
+void interp::channel::notify_on_receive(std::function<void()> callback, const void* owner) {
+    watch(waiting_for_room, std::move(callback), owner);
+}
+
+void interp::channel::close() {
+    is_closed.store(true, std::memory_order_release);
+    sent.fetch_add(1, std::memory_order_release);
+    received.fetch_add(1, std::memory_order_release);
+    sent.notify_all();
+    received.notify_all();
+    wake(waiting_for_message);
+    wake(waiting_for_room);
+}
+
+bool interp::channel::try_send(message& m) {
+    if (closed() or not push(m)) return false;
+    sent.fetch_add(1, std::memory_order_release);
+    sent.notify_all();
+    wake(waiting_for_message);
+    return true;
+}
+
+auto interp::channel::try_receive() -> std::optional<message> {
+    message m;
+    if (not pop(m)) return std::nullopt;
+    received.fetch_add(1, std::memory_order_release);
+    received.notify_all();
+    wake(waiting_for_room);
+    return m;
+}
+
+bool interp::channel::send(message m) {
+    for (;;) {
+        /// Read the counter first so we can’t miss a wakeup between
+        /// finding the channel full and going to sleep.
+        auto seen = received.load(std::memory_order_acquire);
+        if (closed()) return false;
+        if (try_send(m)) return true;
+        received.wait(seen, std::memory_order_acquire);
+    }
+}
+
+auto interp::channel::receive() -> std::optional<message> {
+    for (;;) {
+        /// Messages sent before the channel was closed can still be received.
+        auto seen = sent.load(std::memory_order_acquire);
+        auto was_closed = closed();
+        if (auto m = try_receive()) return m;
+        if (was_closed) return std::nullopt;
+        sent.wait(seen, std::memory_order_acquire);
+    }
+}
+
+/// ===========================================================================
+///  Guest API.
+/// ===========================================================================
+auto interp::context::attach(std::shared_ptr<channel> ch) -> word {
+    if (not ch) throw error("Cannot attach a null channel");
+    channels.push_back(std::move(ch));
+    return channels.size();
+}
+
+auto interp::context::attached_channel(word handle) const -> channel& {
+    if (handle == 0 or handle > channels.size()) throw error("Invalid channel handle {}", handle);
+    return *channels[handle - 1];
+}
+
+void interp::module::defun_channels() {
+    /// In a resumable run, a call that would have to wait stops the run
+    /// instead; it is retried from scratch when the run is resumed, which
+    /// the host is told to do once the channel changes.
+    const auto send = [](context& c, channel::message m) {
+        auto& ch = c.attached_channel(c.arg(0, INTERP_SIZE_MASK_64));
+        if (not c.resumable()) return c.set_return_value(ch.send(std::move(m)));
+        if (ch.try_send(m)) return c.set_return_value(1);
+        ch.notify_on_receive(c.waker(), &c);
+        if (ch.try_send(m)) return c.set_return_value(1);
+        if (ch.closed()) return c.set_return_value(0);
+        c.block();
+    };
+
+    /// Returns false if the run is blocked. Otherwise, sets r2 to whether
+    /// there was a message.
+    const auto receive = [](context& c, std::optional<channel::message>& m) {
+        auto handle = c.arg(0, INTERP_SIZE_MASK_64);
+        auto& ch = c.attached_channel(handle);
+        if (auto h = c.held_messages.find(handle); h != c.held_messages.end()) {
+            m = std::move(h->second);
+            c.held_messages.erase(h);
+        } else if (not c.resumable()) m = ch.receive();
+        else {
+            /// Messages sent before the channel was closed can still be received.
+            auto was_closed = ch.closed();
+            m = ch.try_receive();
+            if (not m and not was_closed) {
+                ch.notify_on_send(c.waker(), &c);
+                was_closed = ch.closed();
+                m = ch.try_receive();
+            }
+
+            if (not m and not was_closed) {
+                c.block();
+                return false;
+            }
+        }
+
+        c.r(static_cast<reg>(2), m.has_value());
+        return true;
+    };
+
+    defun("chan.send", [=](context& c) {
+        auto value = c.arg(1, INTERP_SIZE_MASK_64);
+        channel::message m(sizeof(word));
+        std::memcpy(m.data(), &value, sizeof(word));
+        send(c, std::move(m));
+    });
+
+    defun("chan.send_buf", [=](context& c) {
+        auto data = c.memory(static_cast<ptr>(c.arg(1, INTERP_SIZE_MASK_64)), c.arg(2, INTERP_SIZE_MASK_64));
+        send(c, channel::message(data.begin(), data.end()));
+    });
+
+    defun("chan.recv", [=](context& c) {
+        std::optional<channel::message> m;
+        if (not receive(c, m)) return;
+        word value = 0;
+        if (m) std::memcpy(&value, m->data(), std::min(m->size(), sizeof(word)));
+        c.set_return_value(value);
+    });
+
+    defun("chan.recv_buf", [=](context& c) {
+        auto dest = static_cast<ptr>(c.arg(1, INTERP_SIZE_MASK_64));
+        auto capacity = c.arg(2, INTERP_SIZE_MASK_64);
+        std::optional<channel::message> m;
+        if (not receive(c, m)) return;
+        if (not m) return c.set_return_value(0);
+
+        /// Keep a message that doesn’t fit so the guest can try again with
+        /// a bigger buffer.
+        auto size = m->size();
+        if (size > capacity) c.held_messages[c.arg(0, INTERP_SIZE_MASK_64)] = std::move(*m);
+        else if (size) std::memcpy(c.memory(dest, size).data(), m->data(), size);
+        c.set_return_value(size);
+    });
+
+    defun("chan.close", [](context& c) {
+        c.attached_channel(c.arg(0, INTERP_SIZE_MASK_64)).close();
+    });
+}
@@ -7,7 +7,7 @@
 #define r5(x) r(x), r(x + 1), r(x + 2), r(x + 3), r(x + 4)
 #define r10(x) r5(x), r5(x + 5)
 
-void interp::interpreter::do_library_call_unsafe(interp::interpreter::library_function& func) {
+void interp::context::do_library_call_unsafe(const interp::module::library_function& func) {
     switch (func.num_params) {
         case 0: r(0) = f() (); break;
         case 1: r(0) = f(u64) (r(1)); break;
@@ -0,0 +1,86 @@
+#include <cstring>
+#include <interpreter/interp.hh>
+
+#ifdef __linux__
+#    include <sys/eventfd.h>
+#endif
+
+#ifndef _WIN32
+#    include <fcntl.h>
+#    include <unistd.h>
+#endif
+
+/// A file descriptor that is readable while a blocked run can continue.
+///
+/// This is an eventfd on Linux, and a pipe elsewhere, where the read end
+/// is the one reported to the host.
+struct interp::event_notifier {
+    int read_fd = -1;
+    int write_fd = -1;
+
+    event_notifier() {
+#if defined(__linux__)
+        read_fd = write_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (read_fd < 0) throw error("Failed to create eventfd: {}", std::strerror(errno));
+#elif !defined(_WIN32)
+        int fds[2];
+        if (pipe(fds) != 0) throw error("Failed to create pipe: {}", std::strerror(errno));
+        for (auto fd : fds) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        read_fd = fds[0];
+        write_fd = fds[1];
+#else
+        throw error("Event file descriptors are not supported on this platform");
+#endif
+    }
+
+    event_notifier(const event_notifier&) = delete;
+    event_notifier& operator=(const event_notifier&) = delete;
+
+    ~event_notifier() noexcept {
+#ifndef _WIN32
+        if (write_fd != read_fd) close(write_fd);
+        close(read_fd);
+#endif
+    }
+
+    /// Make the descriptor readable.
+    void notify() {
+#ifndef _WIN32
+        /// If this fails, the descriptor is already readable.
+        u64 one = 1;
+        [[maybe_unused]] auto _ = write(write_fd, &one, read_fd == write_fd ? sizeof one : 1);
+#endif
+    }
+
+    /// Make the descriptor not readable.
+    void drain() {
+#ifndef _WIN32
+        u64 buf[8];
+        while (read(read_fd, buf, sizeof buf) > 0) {}
+#endif
+    }
+};
+
+auto interp::context::run_until_blocked() -> run_status {
+    return run_for(std::numeric_limits<u64>::max());
+}
+
+void interp::context::clear_events() {
+    notifier->drain();
+}
+
+int interp::context::event_fd() {
+    if (not notifier) notifier = std::make_shared<event_notifier>();
+    return notifier->read_fd;
+}
+
+auto interp::context::waker() -> std::function<void()> {
+    if (not notifier) notifier = std::make_shared<event_notifier>();
+    return [n = notifier, w = wakeup] {
+        n->notify();
+        if (w) w();
+    };
+}
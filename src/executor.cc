@@ -0,0 +1,203 @@
+#include <interpreter/executor.hh>
+
+#ifdef __linux__
+#    include <pthread.h>
+#    include <sched.h>
+#endif
+
+namespace {
+/// The executor and worker that the current thread belongs to, if any.
+thread_local interp::executor* current_executor;
+thread_local interp::usz current_worker;
+} // namespace
+
+/// ===========================================================================
+///  Work-stealing deque.
+/// ===========================================================================
+interp::executor::work_deque::work_deque() {
+    rings.push_back(std::make_unique<ring>(64));
+    buffer.store(rings.back().get(), std::memory_order_relaxed);
+}
+
+void interp::executor::work_deque::push(job* j) {
+    auto b = bottom.load(std::memory_order_relaxed);
+    auto t = top.load(std::memory_order_acquire);
+    auto a = buffer.load(std::memory_order_relaxed);
+
+    /// Grow the ring if it is full.
+    if (b - t > a->capacity - 1) {
+        auto bigger = std::make_unique<ring>(a->capacity * 2);
+        for (auto i = t; i < b; i++) bigger->put(i, a->get(i));
+        a = bigger.get();
+        rings.push_back(std::move(bigger));
+        buffer.store(a, std::memory_order_release);
+    }
+
+    a->put(b, j);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+auto interp::executor::work_deque::pop() -> job* {
+    auto b = bottom.load(std::memory_order_relaxed) - 1;
+    auto a = buffer.load(std::memory_order_relaxed);
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto t = top.load(std::memory_order_relaxed);
+
+    /// Empty.
+    if (t > b) {
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    /// More than one element; no need to race with thieves.
+    auto j = a->get(b);
+    if (t != b) return j;
+
+    /// Last element. Race with thieves for it.
+    if (not top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) j = nullptr;
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return j;
+}
+
+auto interp::executor::work_deque::steal() -> job* {
+    auto t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto b = bottom.load(std::memory_order_acquire);
+    if (t >= b) return nullptr;
+
+    /// Lost the race to another thief or to the owner.
+    auto j = buffer.load(std::memory_order_acquire)->get(t);
+    if (not top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) return nullptr;
+    return j;
+}
+
+/// ===========================================================================
+///  Executor.
+/// ===========================================================================
+interp::executor::executor(usz threads, bool pin_threads) {
+    threads = std::max<usz>(threads, 1);
+    for (usz i = 0; i < threads; i++) workers.push_back(std::make_unique<worker>());
+
+    /// Only start the threads once all deques exist.
+    for (usz i = 0; i < threads; i++) {
+        auto& w = *workers[i];
+        w.thread = std::thread([this, i] { work(i); });
+
+#ifdef __linux__
+        if (pin_threads) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(i % std::max(std::thread::hardware_concurrency(), 1u), &set);
+            pthread_setaffinity_np(w.thread.native_handle(), sizeof set, &set);
+        }
+#endif
+    }
+}
+
+interp::executor::~executor() noexcept {
+    {
+        std::unique_lock _{sleep_mutex};
+        stopping = true;
+    }
+
+    wake.notify_all();
+    for (auto& w : workers) w->thread.join();
+}
+
+void interp::executor::enqueue(job* j) {
+    /// Count the job before anyone can see it; otherwise, a thief could
+    /// take it and decrement the count before we increment it.
+    queued.fetch_add(1, std::memory_order_seq_cst);
+
+    /// Workers push to their own deque.
+    if (current_executor == this) workers[current_worker]->deque.push(j);
+    else {
+        std::unique_lock _{injector_mutex};
+        injector.push_back(j);
+    }
+
+    /// Wake up a worker if any are asleep. Taking the lock makes sure
+    /// that we can’t notify a worker that is about to go to sleep, but
+    /// hasn’t yet; it will see the new job before it waits instead.
+    if (sleeping.load(std::memory_order_seq_cst)) {
+        { std::unique_lock _{sleep_mutex}; }
+        wake.notify_one();
+    }
+}
+
+auto interp::executor::find_job(usz self) -> job* {
+    /// Our own jobs first.
+    if (auto j = workers[self]->deque.pop()) return j;
+
+    /// Then jobs from outside.
+    {
+        std::unique_lock _{injector_mutex};
+        if (not injector.empty()) {
+            auto j = injector.front();
+            injector.pop_front();
+            return j;
+        }
+    }
+
+    /// Then steal from everyone else.
+    for (usz i = 1; i < workers.size(); i++) {
+        auto victim = (self + i) % workers.size();
+        if (auto j = workers[victim]->deque.steal()) return j;
+    }
+
+    return nullptr;
+}
+
+void interp::executor::work(usz self) {
+    current_executor = this;
+    current_worker = self;
+
+    for (;;) {
+        if (auto j = find_job(self)) {
+            queued.fetch_sub(1, std::memory_order_relaxed);
+
+            /// Like an exception that escapes a std::thread, an exception
+            /// that escapes a job terminates the program; there is no one
+            /// to report it to. submit() catches them for the caller.
+            std::unique_ptr<job> owned{j};
+            try {
+                (*owned)();
+            } catch (...) {
+                std::terminate();
+            }
+            continue;
+        }
+
+        /// Nothing to do. Go to sleep unless there is still work left,
+        /// which means we lost a race with another thief.
+        std::unique_lock lock{sleep_mutex};
+        if (queued.load(std::memory_order_seq_cst)) continue;
+        if (stopping) return;
+        sleeping.fetch_add(1, std::memory_order_seq_cst);
+        wake.wait(lock, [&] { return stopping or queued.load(std::memory_order_seq_cst); });
+        sleeping.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+void interp::executor::post(job j) {
+    enqueue(new job{std::move(j)});
+}
+
+auto interp::executor::execute(context_pool& pool) -> std::future<word> {
+    return submit([&pool] { return pool.acquire()->run(); });
+}
+
+void interp::executor::execute(context_pool& pool, callback cb) {
+    post([&pool, cb = std::move(cb)]() mutable {
+        word result;
+        try {
+            result = pool.acquire()->run();
+        } catch (...) {
+            cb(0, std::current_exception());
+            return;
+        }
+        cb(result, nullptr);
+    });
+}
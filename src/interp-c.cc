@@ -22,7 +22,7 @@ void interp_destroy(interp_handle handle) { delete static_cast<interp::interpret
 ///  Driver and utils.
 /// ===========================================================================
 char* interp_get_error(interp_handle handle) {
-    auto i = static_cast<interp::interpreter*>(handle);
+    auto i = static_cast<interp::context*>(handle);
     if (i->last_error.empty()) return nullptr;
     return strdup(i->last_error.c_str());
 }
@@ -35,7 +35,18 @@ interp_code interp_defun(
 ) {
     auto i = static_cast<interp::interpreter*>(handle);
     try {
-        i->defun(name, [=](interp::interpreter&) { func(handle, user); });
+        i->defun(name, [=](interp::context& ctx) { func(&ctx, user); });
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_defun_parallel_for(interp_handle handle, const char* name) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->defun_parallel_for(name);
         return INTERP_OK;
     } catch (const std::exception& e) {
         i->last_error = e.what();
@@ -55,15 +66,130 @@ char* interp_disassemble(interp_handle handle) {
 }
 
 interp_code interp_run(interp_handle handle, interp_word* retval) {
-    auto i = static_cast<interp::interpreter*>(handle);
+    auto i = static_cast<interp::context*>(handle);
     try {
         auto result = i->run();
         if (retval) *retval = result;
         return INTERP_OK;
+    } catch (const interp::out_of_fuel& e) {
+        i->last_error = e.what();
+        return INTERP_ERR_OUT_OF_FUEL;
+    } catch (const interp::interrupted& e) {
+        i->last_error = e.what();
+        return e.status == interp::run_status::cancelled ? INTERP_ERR_CANCELLED : INTERP_ERR_DEADLINE_EXCEEDED;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_run_for(
+    interp_handle handle,
+    interp_word max_ticks,
+    interp_status* status,
+    interp_word* retval
+) {
+    auto i = static_cast<interp::context*>(handle);
+    try {
+        auto st = i->run_for(max_ticks);
+        if (status) *status = static_cast<interp_status>(st);
+        if (retval and st == interp::run_status::finished) *retval = i->result();
+        return INTERP_OK;
+    } catch (const interp::out_of_fuel& e) {
+        i->last_error = e.what();
+        return INTERP_ERR_OUT_OF_FUEL;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_resume(
+    interp_handle handle,
+    interp_word max_ticks,
+    interp_status* status,
+    interp_word* retval
+) {
+    auto i = static_cast<interp::context*>(handle);
+    try {
+        auto st = i->resume(max_ticks);
+        if (status) *status = static_cast<interp_status>(st);
+        if (retval and st == interp::run_status::finished) *retval = i->result();
+        return INTERP_OK;
+    } catch (const interp::out_of_fuel& e) {
+        i->last_error = e.what();
+        return INTERP_ERR_OUT_OF_FUEL;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_run_until_blocked(
+    interp_handle handle,
+    interp_status* status,
+    interp_word* retval
+) {
+    auto i = static_cast<interp::context*>(handle);
+    try {
+        auto st = i->run_until_blocked();
+        if (status) *status = static_cast<interp_status>(st);
+        if (retval and st == interp::run_status::finished) *retval = i->result();
+        return INTERP_OK;
+    } catch (const interp::out_of_fuel& e) {
+        i->last_error = e.what();
+        return INTERP_ERR_OUT_OF_FUEL;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+int interp_event_fd(interp_handle handle) {
+    auto i = static_cast<interp::context*>(handle);
+    try {
+        return i->event_fd();
     } catch (const std::exception& e) {
         i->last_error = e.what();
+        return -1;
+    }
+}
+
+void interp_set_fuel(interp_handle handle, interp_word fuel) {
+    auto i = static_cast<interp::context*>(handle);
+    i->set_fuel(fuel);
+}
+
+void interp_disable_fuel(interp_handle handle) {
+    auto i = static_cast<interp::context*>(handle);
+    i->disable_fuel();
+}
+
+interp_code interp_get_fuel(interp_handle handle, interp_word* fuel) {
+    auto i = static_cast<interp::context*>(handle);
+    auto left = i->remaining_fuel();
+    if (not left) {
+        i->last_error = "Fuel metering is disabled";
         return INTERP_ERR;
     }
+
+    if (fuel) *fuel = *left;
+    return INTERP_OK;
+}
+
+void interp_interrupt(interp_handle handle) {
+    auto i = static_cast<interp::context*>(handle);
+    i->interrupt();
+}
+
+void interp_set_deadline(interp_handle handle, uint64_t timeout_ns) {
+    auto i = static_cast<interp::context*>(handle);
+    i->set_deadline(std::chrono::steady_clock::now() + std::chrono::nanoseconds(timeout_ns));
+}
+
+void interp_clear_deadline(interp_handle handle) {
+    auto i = static_cast<interp::context*>(handle);
+    i->clear_deadline();
 }
 
 /// ===========================================================================
@@ -76,7 +202,7 @@ interp_code interp_arg(
     interp_size_mask sz,
     interp_word* value
 ) {
-    auto i = static_cast<interp::interpreter*>(handle);
+    auto i = static_cast<interp::context*>(handle);
     try {
         if (value) *value = i->arg(index, sz);
         return INTERP_OK;
@@ -87,7 +213,7 @@ interp_code interp_arg(
 }
 
 interp_code interp_push(interp_handle handle, interp_word value) {
-    auto i = static_cast<interp::interpreter*>(handle);
+    auto i = static_cast<interp::context*>(handle);
     try {
         i->push(value);
         return INTERP_OK;
@@ -98,7 +224,7 @@ interp_code interp_push(interp_handle handle, interp_word value) {
 }
 
 interp_code interp_pop(interp_handle handle, interp_word* value) {
-    auto i = static_cast<interp::interpreter*>(handle);
+    auto i = static_cast<interp::context*>(handle);
     try {
         auto val = i->pop();
         if (value) *value = val;
@@ -110,7 +236,7 @@ interp_code interp_pop(interp_handle handle, interp_word* value) {
 }
 
 interp_code interp_get_register(interp_handle handle, interp_reg r, interp_word* value) {
-    auto i = static_cast<interp::interpreter*>(handle);
+    auto i = static_cast<interp::context*>(handle);
     try {
         if (value) *value = i->r(static_cast<reg>(r));
         return INTERP_OK;
@@ -121,7 +247,7 @@ interp_code interp_get_register(interp_handle handle, interp_reg r, interp_word*
 }
 
 interp_code interp_set_register(interp_handle handle, interp_reg r, interp_word value) {
-    auto i = static_cast<interp::interpreter*>(handle);
+    auto i = static_cast<interp::context*>(handle);
     try {
         i->r(static_cast<reg>(r), value);
         return INTERP_OK;
@@ -132,7 +258,7 @@ interp_code interp_set_register(interp_handle handle, interp_reg r, interp_word
 }
 
 void interp_set_return_value(interp_handle handle, interp_word value) {
-    auto i = static_cast<interp::interpreter*>(handle);
+    auto i = static_cast<interp::context*>(handle);
     i->set_return_value(value);
 }
 
@@ -235,6 +361,24 @@ interp_code interp_create_load_indirect(
     }
 }
 
+interp_code interp_create_load_indexed(
+    interp_handle handle,
+    interp_reg dest,
+    interp_reg base,
+    interp_reg index,
+    interp_word scale,
+    interp_word offs
+) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_load(static_cast<reg>(dest), static_cast<reg>(base), static_cast<reg>(index), scale, offs);
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
 interp_code interp_create_store(interp_handle handle, interp_address dest, interp_reg src) {
     auto i = static_cast<interp::interpreter*>(handle);
     try {
@@ -284,6 +428,215 @@ interp_code interp_create_store_indirect(
     }
 }
 
+interp_code interp_create_store_indexed(
+    interp_handle handle,
+    interp_reg base,
+    interp_reg index,
+    interp_word scale,
+    interp_word offs,
+    interp_reg src
+) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_store(static_cast<reg>(base), static_cast<reg>(index), scale, offs, static_cast<reg>(src));
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_create_memcopy(
+    interp_handle handle,
+    interp_reg dest,
+    interp_reg src,
+    interp_reg size
+) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_memcopy(static_cast<reg>(dest), static_cast<reg>(src), static_cast<reg>(size));
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_create_memfill(
+    interp_handle handle,
+    interp_reg dest,
+    interp_reg value,
+    interp_reg size
+) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_memfill(static_cast<reg>(dest), static_cast<reg>(value), static_cast<reg>(size));
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_create_memcompare(
+    interp_handle handle,
+    interp_reg result,
+    interp_reg lhs,
+    interp_reg rhs,
+    interp_reg size
+) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_memcompare(static_cast<reg>(result), static_cast<reg>(lhs), static_cast<reg>(rhs), static_cast<reg>(size));
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+/// ===========================================================================
+///  Vector operations.
+/// ===========================================================================
+interp_code interp_create_vload(interp_handle handle, interp_vreg dest, interp_reg src, uint8_t shape) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_vload(static_cast<interp::vreg>(dest), static_cast<reg>(src), shape);
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_create_vstore(interp_handle handle, interp_reg dest, interp_vreg src, uint8_t shape) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_vstore(static_cast<reg>(dest), static_cast<interp::vreg>(src), shape);
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_create_vsplat(interp_handle handle, interp_vreg dest, interp_reg src, uint8_t shape) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_vsplat(static_cast<interp::vreg>(dest), static_cast<reg>(src), shape);
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_create_atomic_load(interp_handle handle, interp_reg dest, interp_reg address, interp_memory_order order) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_atomic_load(static_cast<reg>(dest), static_cast<reg>(address), static_cast<interp::memory_order>(order));
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_create_atomic_store(interp_handle handle, interp_reg address, interp_reg src, interp_memory_order order) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_atomic_store(static_cast<reg>(address), static_cast<reg>(src), static_cast<interp::memory_order>(order));
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+#define CREATE_OP(name, ...)                                                                                                                      \
+    interp_code interp_create_##name(interp_handle handle, interp_reg dest, interp_reg address, interp_reg src, interp_memory_order order) {      \
+        auto i = static_cast<interp::interpreter*>(handle);                                                                                       \
+        try {                                                                                                                                     \
+            i->create_##name(static_cast<reg>(dest), static_cast<reg>(address), static_cast<reg>(src), static_cast<interp::memory_order>(order)); \
+            return INTERP_OK;                                                                                                                     \
+        } catch (const std::exception& e) {                                                                                                       \
+            i->last_error = e.what();                                                                                                             \
+            return INTERP_ERR;                                                                                                                    \
+        }                                                                                                                                         \
+    }
+
+INTERP_ALL_ATOMIC_RMW_INSTRUCTIONS(CREATE_OP)
+
+#undef CREATE_OP
+
+interp_code interp_create_atomic_cmpxchg(
+    interp_handle handle,
+    interp_reg dest,
+    interp_reg address,
+    interp_reg expected,
+    interp_reg desired,
+    interp_memory_order order
+) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_atomic_cmpxchg(
+            static_cast<reg>(dest),
+            static_cast<reg>(address),
+            static_cast<reg>(expected),
+            static_cast<reg>(desired),
+            static_cast<interp::memory_order>(order)
+        );
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_create_fence(interp_handle handle, interp_memory_order order) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_fence(static_cast<interp::memory_order>(order));
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+#define CREATE_OP(name, ...)                                                                                                     \
+    interp_code interp_create_##name(interp_handle handle, interp_vreg dest, interp_vreg src1, interp_vreg src2, uint8_t shape) { \
+        auto i = static_cast<interp::interpreter*>(handle);                                                                      \
+        try {                                                                                                                    \
+            using interp::vreg;                                                                                                  \
+            i->create_##name(static_cast<vreg>(dest), static_cast<vreg>(src1), static_cast<vreg>(src2), shape);                  \
+            return INTERP_OK;                                                                                                    \
+        } catch (const std::exception& e) {                                                                                      \
+            i->last_error = e.what();                                                                                            \
+            return INTERP_ERR;                                                                                                   \
+        }                                                                                                                        \
+    }
+
+INTERP_ALL_VECTOR_INSTRUCTIONS(CREATE_OP)
+
+#undef CREATE_OP
+
+#define CREATE_OP(name, ...)                                                                            \
+    interp_code interp_create_##name(interp_handle handle, interp_reg dest, interp_vreg src, uint8_t shape) { \
+        auto i = static_cast<interp::interpreter*>(handle);                                             \
+        try {                                                                                           \
+            i->create_##name(static_cast<reg>(dest), static_cast<interp::vreg>(src), shape);            \
+            return INTERP_OK;                                                                           \
+        } catch (const std::exception& e) {                                                             \
+            i->last_error = e.what();                                                                   \
+            return INTERP_ERR;                                                                          \
+        }                                                                                               \
+    }
+
+INTERP_ALL_VECTOR_REDUCTIONS(CREATE_OP)
+
+#undef CREATE_OP
+
 /// ===========================================================================
 ///  Operations.
 /// ===========================================================================
@@ -333,6 +686,29 @@ interp_code interp_create_call(interp_handle handle, const char* name) {
     }
 }
 
+interp_code interp_create_call_indirect(interp_handle handle, interp_reg index) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_call_indirect(static_cast<reg>(index));
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_function_index(interp_handle handle, const char* name, size_t* index) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        auto idx = i->function_index(name);
+        if (index) *index = idx;
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
 interp_code interp_create_branch(interp_handle handle, interp_address target) {
     auto i = static_cast<interp::interpreter*>(handle);
     try {
@@ -355,6 +731,206 @@ interp_code interp_create_branch_ifnz(interp_handle handle, interp_reg cond, int
     }
 }
 
+interp_code interp_create_branch_indirect(interp_handle handle, interp_reg target) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_branch_indirect(static_cast<reg>(target));
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_create_label(interp_handle handle, interp_label* label) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        auto l = i->create_label();
+        if (label) *label = +l;
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_bind_label(interp_handle handle, interp_label label) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->bind(interp::label(label));
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_create_branch_to_label(interp_handle handle, interp_label label) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_branch(interp::label(label));
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_create_branch_ifnz_to_label(interp_handle handle, interp_reg cond, interp_label label) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_branch_ifnz(static_cast<reg>(cond), interp::label(label));
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_relax(interp_handle handle) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->relax();
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_create_try(interp_handle handle, interp_address begin, interp_address end, interp_address handler) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_try(begin, end, handler);
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_create_throw(interp_handle handle, interp_reg value) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_throw(static_cast<reg>(value));
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_create_coroutine(interp_handle handle, interp_reg dest, interp_reg func) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_coroutine(static_cast<reg>(dest), static_cast<reg>(func));
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_create_resume(interp_handle handle, interp_reg status, interp_reg coroutine) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_resume(static_cast<reg>(status), static_cast<reg>(coroutine));
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_create_yield(interp_handle handle) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_yield();
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+void interp_set_coroutine_stack_size(interp_handle handle, size_t size) {
+    auto i = static_cast<interp::context*>(handle);
+    i->coroutine_stack_size = size;
+}
+
+interp_code interp_create_thread_spawn(interp_handle handle, interp_reg dest, interp_reg func, interp_reg arg) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_thread_spawn(static_cast<reg>(dest), static_cast<reg>(func), static_cast<reg>(arg));
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_create_thread_join(interp_handle handle, interp_reg dest, interp_reg thread) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_thread_join(static_cast<reg>(dest), static_cast<reg>(thread));
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_create_parallel_for(
+    interp_handle handle,
+    interp_reg dest,
+    interp_reg func,
+    interp_reg begin,
+    interp_reg end,
+    interp_reduction op
+) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_parallel_for(
+            static_cast<reg>(dest),
+            static_cast<reg>(func),
+            static_cast<reg>(begin),
+            static_cast<reg>(end),
+            static_cast<interp::reduction>(op)
+        );
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+void interp_set_thread_limits(interp_handle handle, size_t max_threads, size_t stack_size) {
+    auto i = static_cast<interp::context*>(handle);
+    i->max_guest_threads = max_threads;
+    i->guest_thread_stack_size = stack_size;
+}
+
+interp_code interp_create_switch(
+    interp_handle handle,
+    interp_reg index,
+    const uint64_t* keys,
+    const interp_address* targets,
+    size_t count,
+    interp_address default_target
+) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        std::vector<std::pair<interp::word, interp::addr>> cases;
+        cases.reserve(count);
+        for (size_t n = 0; n < count; n++) cases.emplace_back(keys[n], targets[n]);
+        i->create_switch(static_cast<reg>(index), std::move(cases), default_target);
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
 interp_code interp_create_function(interp_handle handle, const char* name) {
     auto i = static_cast<interp::interpreter*>(handle);
     try {
@@ -377,6 +953,28 @@ interp_code interp_create_xchg_rr(interp_handle handle, interp_reg r1, interp_re
     }
 }
 
+interp_code interp_create_pushregs(interp_handle handle, uint64_t mask) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_pushregs(mask);
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
+interp_code interp_create_popregs(interp_handle handle, uint64_t mask) {
+    auto i = static_cast<interp::interpreter*>(handle);
+    try {
+        i->create_popregs(mask);
+        return INTERP_OK;
+    } catch (const std::exception& e) {
+        i->last_error = e.what();
+        return INTERP_ERR;
+    }
+}
+
 interp_address interp_current_address(interp_handle handle) {
     auto i = static_cast<interp::interpreter*>(handle);
     return i->current_addr();
@@ -1,9 +1,15 @@
 #include <algorithm>
+#include <atomic>
+#include <bit>
+#include <condition_variable>
 #include <fmt/color.h>
 #include <interpreter/internal.hh>
 #include <interpreter/interp.hh>
 #include <ranges>
+#include <thread>
+#include <timer.hh>
 #include <utility>
+#include <vector.hh>
 
 #ifndef _WIN32
 #    include <dlfcn.h>
@@ -27,18 +33,19 @@ constexpr inline usz memory_cap = ~host_ptr_mask;
 /// ===========================================================================
 ///  Miscellaneous.
 /// ===========================================================================
-interp::interpreter::interpreter() {
+interp::module::module() {
     /// Push an invalid instruction to make sure jumps to 0 throw.
     bytecode.push_back(+opcode::invalid);
 
-    /// Make sure the bottommost address is unused so that NULL is always invalid.
-    gp = static_cast<ptr>(1);
+    /// Make sure the bottommost address is unused so that NULL is always invalid. Skip
+    /// an entire word so that globals and stack frames are aligned for atomic accesses.
+    gp = static_cast<ptr>(sizeof(word));
 
     /// Create the entry point.
     create_function("__entry__");
 }
 
-interp::interpreter::~interpreter() noexcept {
+interp::module::~module() noexcept {
     /// Unload all libraries.
     for (auto& [_, lib] : libraries) {
 #ifndef _WIN32
@@ -49,7 +56,62 @@ interp::interpreter::~interpreter() noexcept {
     }
 }
 
-void interp::interpreter::defun(const std::string& name, interp::native_function func) {
+interp::context::context(const module& m)
+    : mod(m), bytecode(m.bytecode), functions(m.functions) {}
+
+void interp::context::reset() {
+    reap_threads(true);
+
+    /// A blocked run may be waiting for I/O into memory we are about to clear.
+    cancel_io();
+    pending_task = {};
+    _registers_ = {};
+    _vregisters_ = {};
+    _memory_.reset();
+    call_caches.clear();
+    coroutines.clear();
+    free_coroutines.clear();
+    current_coroutine = 0;
+    stack_frame_count = 0;
+    last_error.clear();
+
+    /// Nothing that the last user set up may carry over to the next one.
+    channels.clear();
+    files.clear();
+    held_messages.clear();
+    clear_deadline();
+    interrupts->flags.store(0, std::memory_order_relaxed);
+    disable_fuel();
+    fuel = 0;
+    suspended = false;
+    resumable_run = false;
+    blocked = false;
+    charge_pending = false;
+    wakeup = {};
+    if (notifier) clear_events();
+}
+
+void interp::module::defun_parallel_for(const std::string& name) {
+    defun(name, [](context& c) {
+        auto op = c.arg(3, INTERP_SIZE_MASK_8);
+        if (op > word(reduction::max_signed)) throw error("Invalid reduction {}", op);
+        c.set_return_value(c.parallel_for(
+            c.arg(0, INTERP_SIZE_MASK_64),
+            c.arg(1, INTERP_SIZE_MASK_64),
+            c.arg(2, INTERP_SIZE_MASK_64),
+            reduction(op)
+        ));
+    });
+
+    /// The chunks run on guest threads.
+    spawns_threads = true;
+}
+
+void interp::module::defun(const std::string& name, async_native_function func) {
+    defun(name, native_function{[func = std::move(func)](context& c) { c.call_async(func); }});
+}
+
+void interp::module::defun(const std::string& name, interp::native_function func) {
     /// Function is already declared.
     if (auto it = functions_map.find(name); it != functions_map.end()) {
         /// Duplicate function definition.
@@ -68,7 +130,7 @@ void interp::interpreter::defun(const std::string& name, interp::native_function
     }
 }
 
-interp::word interp::interpreter::arg(usz index, interp_size_mask sz) const {
+interp::word interp::context::arg(usz index, interp_size_mask sz) const {
     /// r2 is the first argument register.
     index += 2;
 
@@ -80,7 +142,7 @@ interp::word interp::interpreter::arg(usz index, interp_size_mask sz) const {
     return read_register(static_cast<reg>(index) | sz);
 }
 
-interp::word interp::interpreter::load_mem(ptr p, usz sz) const {
+interp::word interp::context::load_mem(ptr p, usz sz) const {
     /// Make sure the pointer is valid.
     const bool is_host_ptr = +p & host_ptr_mask;
     if (not is_host_ptr and (not +p or +p >= _memory_.size())) [[unlikely]]
@@ -97,31 +159,31 @@ interp::word interp::interpreter::load_mem(ptr p, usz sz) const {
     }
 }
 
-void interp::interpreter::push(word value) {
-    if (+sp == max_memory) throw error("Stack overflow");
+void interp::context::push(word value) {
+    if (+sp + sizeof(word) > +stack_limit) throw error("Stack overflow");
     *reinterpret_cast<word*>(_memory_.data() + +sp) = value;
     sp = static_cast<ptr>(+sp + sizeof(word));
 }
 
-auto interp::interpreter::pop() -> word {
-    if (sp <= gp) throw error("Stack underflow");
+auto interp::context::pop() -> word {
+    if (sp <= mod.gp) throw error("Stack underflow");
     sp = static_cast<ptr>(+sp - sizeof(word));
     return *reinterpret_cast<word*>(_memory_.data() + +sp);
 }
 
-interp::word interp::interpreter::r(reg r) const {
+interp::word interp::context::r(reg r) const {
     return read_register(r);
 }
 
-void interp::interpreter::r(reg r, word value) {
+void interp::context::r(reg r, word value) {
     set_register(r, value);
 }
 
-void interp::interpreter::set_return_value(word value) {
+void interp::context::set_return_value(word value) {
     _registers_[1] = value;
 }
 
-void interp::interpreter::store_mem(ptr p, word value, usz sz) {
+void interp::context::store_mem(ptr p, word value, usz sz) {
     /// Make sure the pointer is valid.
     const bool is_host_ptr = +p & host_ptr_mask;
     if (not is_host_ptr and (not +p or +p >= _memory_.size())) [[unlikely]]
@@ -138,6 +200,52 @@ void interp::interpreter::store_mem(ptr p, word value, usz sz) {
     }
 }
 
+u8* interp::context::mem_range(ptr p, usz size) {
+    /// Host pointers are not checked.
+    if (+p & host_ptr_mask) return reinterpret_cast<u8*>(+p & ~host_ptr_mask);
+
+    /// Make sure the entire range is valid.
+    if (not +p or +p > _memory_.size() or size > _memory_.size() - +p) [[unlikely]]
+        throw error("Segmentation fault. Invalid memory range: {:#08x}, size {}", +p, size);
+    return _memory_.data() + +p;
+}
+
+auto interp::context::memory(ptr p, usz size) -> std::span<u8> {
+    return {mem_range(p, size), size};
+}
+
+u8* interp::context::atomic_mem(ptr p, usz size) {
+    auto mem = mem_range(p, size);
+    if (reinterpret_cast<std::uintptr_t>(mem) & (size - 1)) [[unlikely]]
+        throw error("Misaligned atomic access: {:#08x}, size {}", +p, size);
+    return mem;
+}
+
+/// Convert a memory order operand to a std::memory_order.
+static std::memory_order std_memory_order(u8 order) {
+    switch (static_cast<interp::memory_order>(order)) {
+        case interp::memory_order::relaxed: return std::memory_order_relaxed;
+        case interp::memory_order::acquire: return std::memory_order_acquire;
+        case interp::memory_order::release: return std::memory_order_release;
+        case interp::memory_order::acq_rel: return std::memory_order_acq_rel;
+        case interp::memory_order::seq_cst: return std::memory_order_seq_cst;
+    }
+
+    throw interp::error("Invalid memory order: {}", order);
+}
+
+/// Perform an atomic operation on a value of `size` bytes. The callback
+/// is passed a `std::atomic_ref` of the appropriate type.
+static interp::word visit_atomic(u8* mem, usz size, auto&& fn) {
+    switch (size) {
+        case 1: return fn(std::atomic_ref<u8>{*mem});
+        case 2: return fn(std::atomic_ref<u16>{*reinterpret_cast<u16*>(mem)});
+        case 4: return fn(std::atomic_ref<u32>{*reinterpret_cast<u32*>(mem)});
+        case 8: return fn(std::atomic_ref<u64>{*reinterpret_cast<u64*>(mem)});
+        default: std::unreachable();
+    }
+}
+
 /// ===========================================================================
 ///  Instruction Decoder/Encoder.
 /// ===========================================================================
@@ -151,6 +259,8 @@ constexpr static usz address_operand_size(interp::opcode op) {
         case interp::opcode::store8:
         case interp::opcode::load_rel8:
         case interp::opcode::store_rel8:
+        case interp::opcode::load_idx8:
+        case interp::opcode::store_idx8:
             return 1;
 
         case interp::opcode::call16:
@@ -160,6 +270,8 @@ constexpr static usz address_operand_size(interp::opcode op) {
         case interp::opcode::store16:
         case interp::opcode::load_rel16:
         case interp::opcode::store_rel16:
+        case interp::opcode::load_idx16:
+        case interp::opcode::store_idx16:
             return 2;
 
         case interp::opcode::call32:
@@ -169,6 +281,8 @@ constexpr static usz address_operand_size(interp::opcode op) {
         case interp::opcode::store32:
         case interp::opcode::load_rel32:
         case interp::opcode::store_rel32:
+        case interp::opcode::load_idx32:
+        case interp::opcode::store_idx32:
             return 4;
 
         case interp::opcode::call64:
@@ -178,6 +292,8 @@ constexpr static usz address_operand_size(interp::opcode op) {
         case interp::opcode::store64:
         case interp::opcode::load_rel64:
         case interp::opcode::store_rel64:
+        case interp::opcode::load_idx64:
+        case interp::opcode::store_idx64:
             return 8;
 
         default: return 0;
@@ -196,6 +312,189 @@ constexpr static usz register_size(interp::reg r) {
 
 constexpr static bool is_imm(interp::reg r) { return index(r) == 0; }
 
+/// Decode the widths byte of a switch instruction into the sizes of
+/// an address and a key.
+constexpr static std::pair<usz, usz> switch_widths(u8 widths) {
+    return {usz(1) << (widths & 0b11), usz(1) << ((widths >> 2) & 0b11)};
+}
+
+/// Check whether an instruction ends a straight-line run of code.
+constexpr static bool is_control_transfer(interp::opcode op) {
+    using interp::opcode;
+    switch (op) {
+        case opcode::ret:
+        case opcode::call8:
+        case opcode::call16:
+        case opcode::call32:
+        case opcode::call64:
+        case opcode::call_indirect:
+        case opcode::jmp8:
+        case opcode::jmp16:
+        case opcode::jmp32:
+        case opcode::jmp64:
+        case opcode::jnz8:
+        case opcode::jnz16:
+        case opcode::jnz32:
+        case opcode::jnz64:
+        case opcode::jmp_indirect:
+        case opcode::switch_dense:
+        case opcode::switch_sparse:
+        case opcode::throw_:
+        case opcode::resume:
+        case opcode::yield:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/// Get the size of the instruction at an address.
+static usz instruction_size(const std::vector<u8>& bytecode, interp::addr i) {
+    using interp::opcode;
+    using interp::reg;
+
+    /// Size of an immediate operand, if any.
+    const auto imm_size = [&](usz reg_offset) -> usz {
+        if (i + reg_offset >= bytecode.size()) return 0;
+        auto r = static_cast<reg>(bytecode[i + reg_offset]);
+        return is_imm(r) ? register_size(r) : 0;
+    };
+
+    switch (auto op = static_cast<opcode>(bytecode[i])) {
+        static_assert(interp::opcode_t(opcode::max_opcode) == 89);
+        case opcode::invalid:
+        case opcode::nop:
+        case opcode::ret:
+            return 1;
+
+        case opcode::mov: return 3 + imm_size(2);
+
+        case opcode::add:
+        case opcode::sub:
+        case opcode::muli:
+        case opcode::mulu:
+        case opcode::divi:
+        case opcode::divu:
+        case opcode::remi:
+        case opcode::remu:
+        case opcode::shift_left:
+        case opcode::shift_right_arithmetic:
+        case opcode::shift_right_logical:
+            return 4 + imm_size(2) + imm_size(3);
+
+        case opcode::call8:
+        case opcode::call16:
+        case opcode::call32:
+        case opcode::call64:
+        case opcode::jmp8:
+        case opcode::jmp16:
+        case opcode::jmp32:
+        case opcode::jmp64:
+            return 1 + address_operand_size(op);
+
+        case opcode::jnz8:
+        case opcode::jnz16:
+        case opcode::jnz32:
+        case opcode::jnz64:
+        case opcode::load8:
+        case opcode::load16:
+        case opcode::load32:
+        case opcode::load64:
+        case opcode::store8:
+        case opcode::store16:
+        case opcode::store32:
+        case opcode::store64:
+            return 2 + address_operand_size(op);
+
+        case opcode::load_rel8:
+        case opcode::load_rel16:
+        case opcode::load_rel32:
+        case opcode::load_rel64:
+        case opcode::store_rel8:
+        case opcode::store_rel16:
+        case opcode::store_rel32:
+        case opcode::store_rel64:
+            return 3 + address_operand_size(op);
+
+        case opcode::load_idx8:
+        case opcode::load_idx16:
+        case opcode::load_idx32:
+        case opcode::load_idx64:
+        case opcode::store_idx8:
+        case opcode::store_idx16:
+        case opcode::store_idx32:
+        case opcode::store_idx64:
+            return 5 + address_operand_size(op);
+
+        case opcode::xchg: return 3;
+        case opcode::pushregs:
+        case opcode::popregs:
+            return 1 + sizeof(u64);
+        case opcode::memcopy: return 4;
+        case opcode::memfill: return 4;
+        case opcode::memcompare: return 5;
+
+        case opcode::atomic_load:
+        case opcode::atomic_store:
+            return 4;
+
+        case opcode::atomic_xchg:
+        case opcode::atomic_fetch_add:
+        case opcode::atomic_fetch_sub:
+        case opcode::atomic_fetch_and:
+        case opcode::atomic_fetch_or:
+            return 5;
+
+        case opcode::atomic_cmpxchg: return 6;
+        case opcode::fence: return 2;
+
+        case opcode::vload:
+        case opcode::vstore:
+        case opcode::vsplat:
+        case opcode::vreduce_add:
+        case opcode::vreduce_min:
+        case opcode::vreduce_max:
+            return 4;
+
+        case opcode::vadd:
+        case opcode::vsub:
+        case opcode::vmul:
+        case opcode::vcmpeq:
+        case opcode::vcmplt:
+        case opcode::vmin:
+        case opcode::vmax:
+            return 5;
+
+        case opcode::call_indirect: return 2 + sizeof(u32);
+        case opcode::jmp_indirect: return 2;
+
+        case opcode::coro_create:
+        case opcode::resume:
+        case opcode::thread_join:
+            return 3;
+
+        case opcode::thread_spawn: return 4;
+
+        case opcode::yield: return 1;
+        case opcode::throw_: return 2;
+
+        case opcode::switch_dense:
+        case opcode::switch_sparse: {
+            if (i + 7 > bytecode.size()) return 7;
+            u32 count;
+            std::memcpy(&count, bytecode.data() + i + 3, sizeof(u32));
+            auto [tsz, ksz] = switch_widths(bytecode[i + 2]);
+            return op == opcode::switch_dense
+                       ? 7 + ksz + tsz * (count + 1)
+                       : 7 + tsz + (ksz + tsz) * count;
+        }
+
+        case opcode::max_opcode: break;
+    }
+
+    throw interp::error("Invalid opcode {} at address {}", bytecode[i], i);
+}
+
 static void write_word(std::vector<u8>& bytecode, interp::word imm) {
     usz sz;
     if (imm < UINT8_MAX) sz = 1;
@@ -206,7 +505,47 @@ static void write_word(std::vector<u8>& bytecode, interp::word imm) {
     std::memcpy(bytecode.data() + bytecode.size() - sz, &imm, sz);
 }
 
-void interp::interpreter::encode_arithmetic(opcode op, reg rdest, reg r1, reg r2) {
+/// Get log2 of the smallest size that can hold a value.
+static u8 operand_size_log2(interp::word value) {
+    if (value < UINT8_MAX) return 0;
+    if (value < UINT16_MAX) return 1;
+    if (value < UINT32_MAX) return 2;
+    return 3;
+}
+
+/// Write a value using exactly `sz` bytes.
+static void write_sized(std::vector<u8>& bytecode, interp::word value, usz sz) {
+    bytecode.resize(bytecode.size() + sz);
+    std::memcpy(bytecode.data() + bytecode.size() - sz, &value, sz);
+}
+
+/// Read a value of `sz` bytes.
+static interp::word read_sized(const u8* data, usz sz) {
+    interp::word value{};
+    std::memcpy(&value, data, sz);
+    return value;
+}
+
+/// Sign-extend a value of `sz` bytes.
+static i64 sign_extend(interp::word value, usz sz) {
+    const auto unused_bits = 64 - 8 * sz;
+    return i64(value << unused_bits) >> unused_bits;
+}
+
+/// Get the size of the smallest displacement that can hold a value.
+static usz displacement_size(i64 d) {
+    if (d >= INT8_MIN and d <= INT8_MAX) return 1;
+    if (d >= INT16_MIN and d <= INT16_MAX) return 2;
+    if (d >= INT32_MIN and d <= INT32_MAX) return 4;
+    return 8;
+}
+
+/// Get the jmp or jnz opcode for a displacement size.
+static interp::opcode sized_branch(interp::opcode base, usz sz) {
+    return interp::opcode(+base + std::countr_zero(sz));
+}
+
+void interp::module::encode_arithmetic(opcode op, reg rdest, reg r1, reg r2) {
     /// These are invalid here.
     if (is_imm(r1) or is_imm(r2))
         throw error("This overload of encode_arithmetic() cannot be used with source registers 0 or arith_imm_64.");
@@ -221,7 +560,7 @@ void interp::interpreter::encode_arithmetic(opcode op, reg rdest, reg r1, reg r2
     bytecode.push_back(+r2);
 }
 
-void interp::interpreter::encode_arithmetic(opcode op, reg dest, reg src, word imm) {
+void interp::module::encode_arithmetic(opcode op, reg dest, reg src, word imm) {
     /// Invalid here.
     if (is_imm(src)) throw error("Source register may not be 0 or reg::arith_imm_64.");
 
@@ -242,7 +581,7 @@ void interp::interpreter::encode_arithmetic(opcode op, reg dest, reg src, word i
     write_word(bytecode, imm);
 }
 
-void interp::interpreter::encode_arithmetic(opcode op, reg dest, word imm, reg src) {
+void interp::module::encode_arithmetic(opcode op, reg dest, word imm, reg src) {
     /// Invalid here.
     if (is_imm(src)) throw error("Source register may not be 0 or reg::arith_imm_64.");
 
@@ -262,7 +601,7 @@ void interp::interpreter::encode_arithmetic(opcode op, reg dest, word imm, reg s
     write_word(bytecode, imm);
 }
 
-interp::word interp::interpreter::decode_register_operand(reg r) {
+interp::word interp::context::decode_register_operand(reg r) {
     if (is_imm(r)) {
         switch (+r & osz_mask) {
             case INTERP_SIZE_MASK_8: return bytecode[ip++];
@@ -291,7 +630,7 @@ interp::word interp::interpreter::decode_register_operand(reg r) {
     return read_register(r);
 }
 
-interp::interpreter::arith_t interp::interpreter::decode_arithmetic() {
+interp::context::arith_t interp::context::decode_arithmetic() {
     /// Decode the registers.
     auto dest = bytecode[ip++];
     auto reg_src1 = static_cast<reg>(bytecode[ip++]);
@@ -309,7 +648,7 @@ interp::interpreter::arith_t interp::interpreter::decode_arithmetic() {
     return {static_cast<reg>(dest), src1, src2};
 }
 
-interp::word interp::interpreter::read_sized_address_at_ip(opcode op) {
+interp::word interp::context::read_sized_address_at_ip(opcode op) {
     usz sz = address_operand_size(op);
     if (not sz) throw error("Opcode {} does not support read_sized_address_at_ip()", static_cast<u8>(op));
 
@@ -319,7 +658,17 @@ interp::word interp::interpreter::read_sized_address_at_ip(opcode op) {
     return value;
 }
 
-void interp::interpreter::set_register(reg r, word value) {
+u8 interp::module::encode_scale(word scale) {
+    switch (scale) {
+        case 1: return 0;
+        case 2: return 1;
+        case 4: return 2;
+        case 8: return 3;
+        default: throw error("Invalid scale: {}. Scale must be 1, 2, 4, or 8.", scale);
+    }
+}
+
+void interp::context::set_register(reg r, word value) {
     switch (+r & osz_mask) {
         case INTERP_SIZE_MASK_8: *reinterpret_cast<u8*>(&_registers_[index(r)]) = static_cast<u8>(value); break;
         case INTERP_SIZE_MASK_16: *reinterpret_cast<u16*>(&_registers_[index(r)]) = static_cast<u16>(value); break;
@@ -329,7 +678,7 @@ void interp::interpreter::set_register(reg r, word value) {
     }
 }
 
-interp::word interp::interpreter::read_register(reg r) const {
+interp::word interp::context::read_register(reg r) const {
     switch (+r & osz_mask) {
         case INTERP_SIZE_MASK_8: return *reinterpret_cast<const u8*>(&_registers_[index(r)]);
         case INTERP_SIZE_MASK_16: return *reinterpret_cast<const u16*>(&_registers_[index(r)]);
@@ -339,13 +688,88 @@ interp::word interp::interpreter::read_register(reg r) const {
     }
 }
 
+void interp::context::copy_registers(u64 mask, word* mem, bool save) {
+    /// A contiguous run of registers can be copied in one go.
+    const auto first = usz(std::countr_zero(mask));
+    const auto count = usz(std::popcount(mask));
+    if (first + count == usz(64 - std::countl_zero(mask))) {
+        if (save) std::memcpy(mem, _registers_.data() + first, count * sizeof(word));
+        else std::memcpy(_registers_.data() + first, mem, count * sizeof(word));
+        return;
+    }
+
+    /// Otherwise, copy them one by one.
+    for (; mask; mask &= mask - 1, mem++) {
+        auto r = usz(std::countr_zero(mask));
+        if (save) *mem = _registers_[r];
+        else _registers_[r] = *mem;
+    }
+}
+
+void interp::module::finalize() const {
+    std::unique_lock _{finalize_mutex};
+
+    /// A branch to a label that isn’t bound would go nowhere.
+    if (not unbound_branches.empty())
+        throw error("Label {} is branched to, but never bound", unbound_branches.begin()->first);
+
+    /// Code is only ever appended, so we only need to look at new instructions.
+    if (instruction_starts.size() == bytecode.size()) return;
+    auto i = instruction_starts.size();
+    instruction_starts.resize(bytecode.size());
+    while (i < bytecode.size()) {
+        instruction_starts[i] = true;
+        i += instruction_size(bytecode, i);
+    }
+
+    /// Compute the cost of the straight-line run of code that starts at
+    /// each instruction, i.e. the number of instructions up to and including
+    /// the next control transfer. New code may extend the last run of the
+    /// old code, so this is recomputed from scratch. Addresses that aren’t
+    /// the start of an instruction cost 1 so that nothing is ever free.
+    block_costs.assign(bytecode.size(), 1);
+    u32 cost = 0;
+    for (auto j = bytecode.size(); j-- > ip_start_addr;) {
+        if (not instruction_starts[j]) continue;
+        if (is_control_transfer(static_cast<opcode>(bytecode[j]))) cost = 0;
+        block_costs[j] = ++cost;
+    }
+}
+
 /// ===========================================================================
 ///  Linker.
 /// ===========================================================================
 /// TODO: Write a tool that uses libtooling to generate
 ///       signatures and allow for type-safe-ish calls?
-void interp::interpreter::create_library_call_unsafe(const std::string& library_path, const std::string& function_name, usz num_params) {
-    /// Load the library.
+void interp::module::create_library_call_unsafe(const std::string& library_path, const std::string& function_name, usz num_params) {
+    auto index = library_function_index(library_path, function_name, num_params);
+    create_call_internal(owner ? static_cast<function_builder*>(this)->callee(index) : index);
+}
+
+interp::usz interp::module::library_function_index(const std::string& library_path, const std::string& function_name, usz num_params) {
+    /// Libraries belong to the module.
+    if (owner) {
+        auto& known = static_cast<function_builder*>(this)->known_library_functions;
+        auto key = library_path + '\0' + function_name;
+        if (auto it = known.find(key); it != known.end()) return it->second;
+        auto _ = static_cast<function_builder*>(this)->lock_owner();
+        return known[key] = owner->library_function_index(library_path, function_name, num_params);
+    }
+
+    /// If the function has already been added, just use it.
+    auto& lib = load_library(library_path);
+    if (auto f = lib.functions.find(function_name); f != lib.functions.end()) return f->second;
+
+    /// Create the function.
+    functions.push_back({});
+    functions.back().address = library_function{find_library_symbol(lib, library_path, function_name), num_params, function_name};
+
+    /// Add the function to the library.
+    lib.functions[function_name] = functions.size() - 1;
+    return functions.size() - 1;
+}
+
+auto interp::module::load_library(const std::string& library_path) -> library& {
     library* lib;
     if (auto it = libraries.find(library_path); it != libraries.end()) {
         lib = &it->second;
@@ -362,38 +786,27 @@ void interp::interpreter::create_library_call_unsafe(const std::string& library_
         lib->handle = handle;
     }
 
-    /// If the function has already been added, just call it.
-    if (auto f = lib->functions.find(function_name); f != lib->functions.end()) {
-        create_call_internal(f->second);
-        return;
-    }
+    return *lib;
+}
 
-    /// Otherwise, search for the function.
+void* interp::module::find_library_symbol(library& lib, const std::string& library_path, const std::string& function_name) {
 #ifndef _WIN32
-    auto sym = dlsym(lib->handle, function_name.c_str());
+    auto sym = dlsym(lib.handle, function_name.c_str());
     if (not sym) throw error("Failed to load function \"{}\" from library {}: {}", function_name, library_path, dlerror());
 #else
-    auto sym = (void*) GetProcAddress((HMODULE) lib->handle, function_name.c_str());
+    auto sym = (void*) GetProcAddress((HMODULE) lib.handle, function_name.c_str());
     if (not sym) throw error("Failed to load function \"{}\" from library {}: {}", function_name, library_path, GetLastError());
 #endif
-
-    /// Create the function.
-    functions.push_back({});
-    functions.back().address = library_function{sym, num_params, function_name};
-
-    /// Add the function to the library.
-    lib->functions[function_name] = functions.size() - 1;
-
-    /// Create the call.
-    create_call_internal(functions.size() - 1);
+    return sym;
 }
 
 /// ===========================================================================
 ///  Memory.
 /// ===========================================================================
 /// Allocate memory on the stack.
-interp::word interp::interpreter::create_alloca(usz size) {
+interp::word interp::module::create_alloca(usz size) {
     size = std::max(size, sizeof(word));
+    size = (size + sizeof(word) - 1) & ~(sizeof(word) - 1);
     auto& f = functions[current_function];
     auto p = f.locals_size;
     f.locals_size += size;
@@ -401,8 +814,15 @@ interp::word interp::interpreter::create_alloca(usz size) {
 }
 
 /// Create a global variable.
-interp::ptr interp::interpreter::create_global(usz size) {
+interp::ptr interp::module::create_global(usz size) {
+    /// Globals belong to the module.
+    if (owner) {
+        auto _ = static_cast<function_builder*>(this)->lock_owner();
+        return owner->create_global(size);
+    }
+
     size = std::max(size, sizeof(word));
+    size = (size + sizeof(word) - 1) & ~(sizeof(word) - 1);
     if (+gp + size > std::min(max_memory, memory_cap)) throw error("Global memory overflow.");
     auto p = gp;
     gp = static_cast<ptr>(+gp + size);
@@ -410,7 +830,7 @@ interp::ptr interp::interpreter::create_global(usz size) {
 }
 
 /// Load from memory.
-void interp::interpreter::create_load(reg dest, ptr src) {
+void interp::module::create_load(reg dest, ptr src) {
     /// Check that the pointer is valid.
     if (not +src or +src >= std::min(max_memory, memory_cap)) throw error("Segmentation fault. Invalid pointer: {}", +src);
 
@@ -433,7 +853,7 @@ void interp::interpreter::create_load(reg dest, ptr src) {
 /// The encoding of this instruction is an implementation detail
 /// and not part of the interface. That the pointer operand is a
 /// host pointer is encoded by setting the MSB of the pointer.
-void interp::interpreter::create_load(reg dest, integer auto* src) {
+void interp::module::create_load(reg dest, integer auto* src) {
     /// Make sure the destination is a register.
     check_regs(dest);
 
@@ -458,13 +878,13 @@ void interp::interpreter::create_load(reg dest, integer auto* src) {
 }
 
 /// Explicitly instantiate all supported versions of this function.
-template void interp::interpreter::create_load<u8>(reg, u8*);
-template void interp::interpreter::create_load<u16>(reg, u16*);
-template void interp::interpreter::create_load<u32>(reg, u32*);
-template void interp::interpreter::create_load<u64>(reg, u64*);
+template void interp::module::create_load<u8>(reg, u8*);
+template void interp::module::create_load<u16>(reg, u16*);
+template void interp::module::create_load<u32>(reg, u32*);
+template void interp::module::create_load<u64>(reg, u64*);
 
 /// Indirect load from memory.
-void interp::interpreter::create_load(reg dest, reg src, word offs) {
+void interp::module::create_load(reg dest, reg src, word offs) {
     /// Make sure the registers are valid.
     check_regs(dest, src);
 
@@ -482,8 +902,31 @@ void interp::interpreter::create_load(reg dest, reg src, word offs) {
     write_word(bytecode, offs);
 }
 
+/// Indexed load from memory.
+void interp::module::create_load(reg dest, reg base, reg index, word scale, word offs) {
+    /// Make sure the registers are valid.
+    check_regs(dest, base, index);
+    if (is_imm(index)) throw error("Index register may not be r0.");
+    auto sc = encode_scale(scale);
+
+    /// Write the opcode.
+    if (offs < UINT8_MAX) bytecode.push_back(+opcode::load_idx8);
+    else if (offs < UINT16_MAX) bytecode.push_back(+opcode::load_idx16);
+    else if (offs < UINT32_MAX) bytecode.push_back(+opcode::load_idx32);
+    else bytecode.push_back(+opcode::load_idx64);
+
+    /// Write the destination, base, and index registers, and the scale.
+    bytecode.push_back(+dest);
+    bytecode.push_back(+base);
+    bytecode.push_back(+index);
+    bytecode.push_back(sc);
+
+    /// Write the offset.
+    write_word(bytecode, offs);
+}
+
 /// Store to memory.
-void interp::interpreter::create_store(ptr dest, reg src) {
+void interp::module::create_store(ptr dest, reg src) {
     /// Check that the pointer is valid.
     if (not +dest or +dest >= std::min(max_memory, memory_cap)) throw error("Segmentation fault. Invalid pointer: {}", +dest);
 
@@ -506,7 +949,7 @@ void interp::interpreter::create_store(ptr dest, reg src) {
 /// The encoding of this instruction is an implementation detail
 /// and not part of the interface. That the pointer operand is a
 /// host pointer is encoded by setting the MSB of the pointer.
-void interp::interpreter::create_store(integer auto* dest, reg src) {
+void interp::module::create_store(integer auto* dest, reg src) {
     /// Make sure the destination is a register.
     check_regs(src);
 
@@ -531,13 +974,13 @@ void interp::interpreter::create_store(integer auto* dest, reg src) {
 }
 
 /// Explicitly instantiate all supported versions of this function.
-template void interp::interpreter::create_store<u8>(u8*, reg);
-template void interp::interpreter::create_store<u16>(u16*, reg);
-template void interp::interpreter::create_store<u32>(u32*, reg);
-template void interp::interpreter::create_store<u64>(u64*, reg);
+template void interp::module::create_store<u8>(u8*, reg);
+template void interp::module::create_store<u16>(u16*, reg);
+template void interp::module::create_store<u32>(u32*, reg);
+template void interp::module::create_store<u64>(u64*, reg);
 
 /// Indirect store to memory.
-void interp::interpreter::create_store(reg dest, word offs, reg src) {
+void interp::module::create_store(reg dest, word offs, reg src) {
     /// Make sure the registers are valid.
     check_regs(dest, src);
 
@@ -555,146 +998,1197 @@ void interp::interpreter::create_store(reg dest, word offs, reg src) {
     write_word(bytecode, offs);
 }
 
+/// Indexed store to memory.
+void interp::module::create_store(reg base, reg index, word scale, word offs, reg src) {
+    /// Make sure the registers are valid.
+    check_regs(base, index, src);
+    if (is_imm(index)) throw error("Index register may not be r0.");
+    auto sc = encode_scale(scale);
+
+    /// Write the opcode.
+    if (offs < UINT8_MAX) bytecode.push_back(+opcode::store_idx8);
+    else if (offs < UINT16_MAX) bytecode.push_back(+opcode::store_idx16);
+    else if (offs < UINT32_MAX) bytecode.push_back(+opcode::store_idx32);
+    else bytecode.push_back(+opcode::store_idx64);
+
+    /// Write the base and index registers, the scale, and the source register.
+    bytecode.push_back(+base);
+    bytecode.push_back(+index);
+    bytecode.push_back(sc);
+    bytecode.push_back(+src);
+
+    /// Write the offset.
+    write_word(bytecode, offs);
+}
+
+/// Copy a block of memory.
+void interp::module::create_memcopy(reg dest, reg src, reg size) {
+    /// Make sure the registers are valid.
+    check_regs(dest, src, size);
+    if (is_imm(size)) throw error("Size register may not be r0.");
+
+    /// Encode the instruction.
+    bytecode.push_back(+opcode::memcopy);
+    bytecode.push_back(+dest);
+    bytecode.push_back(+src);
+    bytecode.push_back(+size);
+}
+
+/// Fill a block of memory.
+void interp::module::create_memfill(reg dest, reg value, reg size) {
+    /// Make sure the registers are valid.
+    check_regs(dest, value, size);
+    if (is_imm(value) or is_imm(size)) throw error("Value and size registers may not be r0.");
+
+    /// Encode the instruction.
+    bytecode.push_back(+opcode::memfill);
+    bytecode.push_back(+dest);
+    bytecode.push_back(+value);
+    bytecode.push_back(+size);
+}
+
+/// Compare two blocks of memory.
+void interp::module::create_memcompare(reg result, reg lhs, reg rhs, reg size) {
+    /// Make sure the registers are valid.
+    check_regs(result, lhs, rhs, size);
+    if (is_imm(size)) throw error("Size register may not be r0.");
+
+    /// Encode the instruction.
+    bytecode.push_back(+opcode::memcompare);
+    bytecode.push_back(+result);
+    bytecode.push_back(+lhs);
+    bytecode.push_back(+rhs);
+    bytecode.push_back(+size);
+}
+
+/// ===========================================================================
+///  Atomic operations.
+/// ===========================================================================
+void interp::module::create_atomic_load(reg dest, reg address, memory_order order) {
+    /// Make sure the registers and memory order are valid.
+    check_regs(dest, address);
+    if (order == memory_order::release or order == memory_order::acq_rel)
+        throw error("Invalid memory order for atomic load.");
+
+    /// Encode the instruction.
+    bytecode.push_back(+opcode::atomic_load);
+    bytecode.push_back(u8(order));
+    bytecode.push_back(+dest);
+    bytecode.push_back(+address);
+}
+
+void interp::module::create_atomic_store(reg address, reg src, memory_order order) {
+    /// Make sure the registers and memory order are valid.
+    check_regs(address, src);
+    if (is_imm(src)) throw error("Source register may not be r0.");
+    if (order == memory_order::acquire or order == memory_order::acq_rel)
+        throw error("Invalid memory order for atomic store.");
+
+    /// Encode the instruction.
+    bytecode.push_back(+opcode::atomic_store);
+    bytecode.push_back(u8(order));
+    bytecode.push_back(+address);
+    bytecode.push_back(+src);
+}
+
+#define ATOMIC(name, ...)                                                                                     \
+    void interp::module::INTERP_CAT(create_, name)(reg dest, reg address, reg src, memory_order order) { \
+        /* Make sure the registers are valid. */                                                              \
+        check_regs(dest, address, src);                                                                       \
+        if (is_imm(src)) throw error("Source register may not be r0.");                                       \
+                                                                                                              \
+        /* Encode the instruction. */                                                                         \
+        bytecode.push_back(+opcode::name);                                                                    \
+        bytecode.push_back(u8(order));                                                                        \
+        bytecode.push_back(+dest);                                                                            \
+        bytecode.push_back(+address);                                                                         \
+        bytecode.push_back(+src);                                                                             \
+    }
+INTERP_ALL_ATOMIC_RMW_INSTRUCTIONS(ATOMIC)
+#undef ATOMIC
+
+void interp::module::create_atomic_cmpxchg(reg dest, reg address, reg expected, reg desired, memory_order order) {
+    /// Make sure the registers are valid.
+    check_regs(dest, address, expected, desired);
+    if (is_imm(expected) or is_imm(desired)) throw error("Expected and desired registers may not be r0.");
+
+    /// Encode the instruction.
+    bytecode.push_back(+opcode::atomic_cmpxchg);
+    bytecode.push_back(u8(order));
+    bytecode.push_back(+dest);
+    bytecode.push_back(+address);
+    bytecode.push_back(+expected);
+    bytecode.push_back(+desired);
+}
+
+void interp::module::create_fence(memory_order order) {
+    bytecode.push_back(+opcode::fence);
+    bytecode.push_back(u8(order));
+}
+
+/// ===========================================================================
+///  Vector operations.
+/// ===========================================================================
+void interp::module::create_vload(vreg dest, reg src, u8 shape) {
+    /// Make sure the registers are valid.
+    check_regs(src);
+    check_vregs(shape, dest);
+
+    /// Encode the instruction.
+    bytecode.push_back(+opcode::vload);
+    bytecode.push_back(shape);
+    bytecode.push_back(+dest);
+    bytecode.push_back(+src);
+}
+
+void interp::module::create_vstore(reg dest, vreg src, u8 shape) {
+    /// Make sure the registers are valid.
+    check_regs(dest);
+    check_vregs(shape, src);
+
+    /// Encode the instruction.
+    bytecode.push_back(+opcode::vstore);
+    bytecode.push_back(shape);
+    bytecode.push_back(+dest);
+    bytecode.push_back(+src);
+}
+
+void interp::module::create_vsplat(vreg dest, reg src, u8 shape) {
+    /// Make sure the registers are valid.
+    check_regs(src);
+    check_vregs(shape, dest);
+    if (is_imm(src)) throw error("Source register may not be r0.");
+
+    /// Encode the instruction.
+    bytecode.push_back(+opcode::vsplat);
+    bytecode.push_back(shape);
+    bytecode.push_back(+dest);
+    bytecode.push_back(+src);
+}
+
+#define VECTOR(name, ...)                                                                             \
+    void interp::module::INTERP_CAT(create_, name)(vreg dest, vreg src1, vreg src2, u8 shape) { \
+        check_vregs(shape, dest, src1, src2);                                                        \
+        bytecode.push_back(+opcode::name);                                                           \
+        bytecode.push_back(shape);                                                                   \
+        bytecode.push_back(+dest);                                                                   \
+        bytecode.push_back(+src1);                                                                   \
+        bytecode.push_back(+src2);                                                                   \
+    }
+INTERP_ALL_VECTOR_INSTRUCTIONS(VECTOR)
+#undef VECTOR
+
+#define VECTOR(name, ...)                                                                \
+    void interp::module::INTERP_CAT(create_, name)(reg dest, vreg src, u8 shape) { \
+        check_regs(dest);                                                               \
+        check_vregs(shape, src);                                                        \
+        bytecode.push_back(+opcode::name);                                              \
+        bytecode.push_back(shape);                                                      \
+        bytecode.push_back(+dest);                                                      \
+        bytecode.push_back(+src);                                                       \
+    }
+INTERP_ALL_VECTOR_REDUCTIONS(VECTOR)
+#undef VECTOR
+
 /// ===========================================================================
 ///  Operations.
 /// ===========================================================================
-void interp::interpreter::create_return() { bytecode.push_back(+opcode::ret); }
+void interp::module::create_return() { bytecode.push_back(+opcode::ret); }
+
+void interp::module::create_move(reg dest, reg src) {
+    /// Make sure the registers are valid.
+    check_regs(dest, src);
+
+    /// Encode the instruction.
+    bytecode.push_back(+opcode::mov);
+    bytecode.push_back(+dest);
+    bytecode.push_back(+src);
+}
+
+void interp::module::create_move(reg dest, word imm) {
+    /// Make sure the registers are valid.
+    check_regs(dest);
+
+    /// Encode the instruction.
+    bytecode.push_back(+opcode::mov);
+    bytecode.push_back(+dest);
+    if (imm < UINT8_MAX) bytecode.push_back(0 | INTERP_SIZE_MASK_8);
+    else if (imm < UINT16_MAX) bytecode.push_back(0 | INTERP_SIZE_MASK_16);
+    else if (imm < UINT32_MAX) bytecode.push_back(0 | INTERP_SIZE_MASK_32);
+    else bytecode.push_back(0 | INTERP_SIZE_MASK_64);
+
+    /// Encode the immediate.
+    write_word(bytecode, imm);
+}
+
+#define ARITH(name, ...)                                                                   \
+    void interp::module::INTERP_CAT(create_, name)(reg dest, reg src1, reg src2) /**/ \
+    { encode_arithmetic(opcode::name, dest, src1, src2); }                                 \
+    void interp::module::INTERP_CAT(create_, name)(reg dest, reg src, word imm) /**/  \
+    { encode_arithmetic(opcode::name, dest, src, imm); }                                   \
+    void interp::module::INTERP_CAT(create_, name)(reg dest, word imm, reg src) /**/  \
+    { encode_arithmetic(opcode::name, dest, imm, src); }
+INTERP_ALL_ARITHMETIC_INSTRUCTIONS(ARITH)
+#undef ARITH
+
+void interp::module::create_call_internal(usz index) {
+    /// Calls in a builder are fixed up in place when it is linked.
+    if (owner) {
+        bytecode.push_back(+opcode::call32);
+        write_sized(bytecode, index, sizeof(u32));
+        return;
+    }
+
+    if (index < UINT8_MAX) bytecode.push_back(+opcode::call8);
+    else if (index < UINT16_MAX) bytecode.push_back(+opcode::call16);
+    else if (index < UINT32_MAX) bytecode.push_back(+opcode::call32);
+    else bytecode.push_back(+opcode::call64);
+    write_word(bytecode, index);
+}
+
+void interp::module::create_call(const std::string& name) {
+    /// In a builder, the function is looked up when the builder is linked.
+    if (owner) return create_call_internal(static_cast<function_builder*>(this)->callee(name));
+
+    /// Declare the function if it doesn’t exist yet.
+    create_call_internal(function_index(name));
+}
+
+void interp::module::create_call_indirect(reg index) {
+    /// Make sure the register is valid.
+    check_regs(index);
+    if (is_imm(index)) throw error("Index register may not be r0.");
+
+    /// Push the opcode, register, and cache slot.
+    auto slot = indirect_call_sites++;
+    bytecode.push_back(+opcode::call_indirect);
+    bytecode.push_back(+index);
+    bytecode.resize(bytecode.size() + sizeof(u32));
+    std::memcpy(bytecode.data() + bytecode.size() - sizeof(u32), &slot, sizeof(u32));
+}
+
+interp::usz interp::module::function_index(const std::string& name) {
+    /// Functions belong to the module.
+    if (owner) {
+        auto& known = static_cast<function_builder*>(this)->known_functions;
+        if (auto it = known.find(name); it != known.end()) return it->second;
+        auto _ = static_cast<function_builder*>(this)->lock_owner();
+        return known[name] = owner->function_index(name);
+    }
+
+    if (auto it = functions_map.find(name); it != functions_map.end()) return it->second;
+
+    /// Function not found. Add an empty record.
+    functions_map[name] = functions.size();
+    functions.push_back({});
+    return functions.size() - 1;
+}
+
+/// Branch targets are encoded as a displacement from the start of the
+/// branch, so that short branches are short no matter where they are.
+void interp::module::create_branch(addr target) {
+    /// Push the opcode and displacement.
+    auto d = i64(target - current_addr());
+    auto sz = displacement_size(d);
+    bytecode.push_back(+sized_branch(opcode::jmp8, sz));
+    write_sized(bytecode, word(d), sz);
+}
+
+void interp::module::create_branch_ifnz(reg cond, addr target) {
+    /// Push the opcode, condition and displacement.
+    auto d = i64(target - current_addr());
+    auto sz = displacement_size(d);
+    bytecode.push_back(+sized_branch(opcode::jnz8, sz));
+    bytecode.push_back(+cond);
+    write_sized(bytecode, word(d), sz);
+}
+
+void interp::module::create_branch(label target) {
+    create_label_branch(opcode::jmp32, std::nullopt, target);
+}
+
+void interp::module::create_branch_ifnz(reg cond, label target) {
+    create_label_branch(opcode::jnz32, cond, target);
+}
+
+void interp::module::create_label_branch(opcode op, std::optional<reg> cond, label target) {
+    if (+target >= labels.size()) throw error("Invalid label {}", +target);
+
+    /// The displacement is filled in once we know where the label is.
+    const auto at = current_addr();
+    label_branches.emplace_back(at, target);
+    bytecode.push_back(+op);
+    if (cond) bytecode.push_back(+*cond);
+    if (labels[+target]) write_sized(bytecode, word(i64(*labels[+target] - at)), sizeof(u32));
+    else {
+        write_sized(bytecode, 0, sizeof(u32));
+        unbound_branches[+target].push_back(at);
+    }
+}
+
+auto interp::module::create_label() -> label {
+    if (labels.size() > UINT32_MAX) throw error("Too many labels.");
+    labels.emplace_back();
+    return label(labels.size() - 1);
+}
+
+void interp::module::bind(label l) {
+    if (+l >= labels.size()) throw error("Invalid label {}", +l);
+    if (labels[+l]) throw error("Label {} is already bound", +l);
+    const auto target = current_addr();
+    labels[+l] = target;
+
+    /// Fill in the branches to it that we’ve already emitted.
+    auto it = unbound_branches.find(+l);
+    if (it == unbound_branches.end()) return;
+    for (auto at : it->second) {
+        auto operand = at + (opcode(bytecode[at]) == opcode::jnz32 ? 2 : 1);
+        auto d = u32(i64(target - at));
+        std::memcpy(bytecode.data() + operand, &d, sizeof(u32));
+    }
+    unbound_branches.erase(it);
+}
+
+auto interp::module::label_address(label l) const -> addr {
+    if (+l >= labels.size() or not labels[+l]) throw error("Label {} is not bound", +l);
+    return *labels[+l];
+}
+
+void interp::module::relax() {
+    std::unique_lock _{finalize_mutex};
+    relax_branches();
+}
+
+void interp::module::relax_branches() {
+    if (not unbound_branches.empty())
+        throw error("Label {} is branched to, but never bound", unbound_branches.begin()->first);
+
+    /// Code must not move if it contains indirect branches, since their
+    /// targets could be anywhere, or if a context may be in the middle of
+    /// it. The displacements are already filled in.
+    if (label_branches.empty()) return;
+    if (has_indirect_branches or code_in_use.load(std::memory_order_relaxed)) {
+        label_branches.clear();
+        return;
+    }
+
+    /// Size of the displacement of each branch. Branches are recorded in
+    /// the order they were emitted, so their addresses are sorted.
+    const auto n = label_branches.size();
+    std::vector<usz> sizes(n, sizeof(u32));
+
+    /// Bytes saved by shrinking the first `i` branches.
+    std::vector<usz> saved(n + 1);
+    const auto update_saved = [&] {
+        for (usz i = 0; i < n; i++) saved[i + 1] = saved[i] + sizeof(u32) - sizes[i];
+    };
+
+    /// Get the new address of an old address.
+    const auto moved = [&](addr a) -> addr {
+        auto it = ranges::lower_bound(label_branches, a, {}, &std::pair<addr, label>::first);
+        return a - saved[usz(it - label_branches.begin())];
+    };
+
+    /// Shrinking a branch never moves two addresses apart, so sizes only
+    /// ever go down, and this terminates.
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (usz i = 0; i < n; i++) {
+            auto& [at, l] = label_branches[i];
+            auto sz = displacement_size(i64(moved(*labels[+l]) - moved(at)));
+            if (sz < sizes[i]) {
+                sizes[i] = sz;
+                changed = true;
+            }
+        }
+        update_saved();
+    }
+
+    /// Rewrite the code. Other branches and switch tables that point across
+    /// moved code are updated as well.
+    std::vector<u8> code;
+    code.reserve(bytecode.size() - saved[n]);
+    usz next = 0;
+    for (addr p = 0; p < bytecode.size();) {
+        const auto size = instruction_size(bytecode, p);
+        const auto op = opcode(bytecode[p]);
+        const auto start = code.size();
+
+        /// Branch to a label.
+        if (next < n and label_branches[next].first == p) {
+            auto& [_, l] = label_branches[next];
+            auto sz = sizes[next++];
+            code.push_back(+sized_branch(op == opcode::jmp32 ? opcode::jmp8 : opcode::jnz8, sz));
+            if (op == opcode::jnz32) code.push_back(bytecode[p + 1]);
+            write_sized(code, word(i64(moved(*labels[+l]) - start)), sz);
+            p += size;
+            continue;
+        }
+
+        code.insert(code.end(), bytecode.begin() + isz(p), bytecode.begin() + isz(p + size));
+        switch (op) {
+            default: break;
+
+            case opcode::jmp8:
+            case opcode::jmp16:
+            case opcode::jmp32:
+            case opcode::jmp64:
+            case opcode::jnz8:
+            case opcode::jnz16:
+            case opcode::jnz32:
+            case opcode::jnz64: {
+                auto sz = address_operand_size(op);
+                auto operand = start + size - sz;
+                auto target = addr(i64(p) + sign_extend(read_sized(code.data() + operand, sz), sz));
+                auto d = word(i64(moved(target) - start));
+                std::memcpy(code.data() + operand, &d, sz);
+            } break;
+
+            case opcode::switch_dense:
+            case opcode::switch_sparse: {
+                u32 count;
+                std::memcpy(&count, code.data() + start + 3, sizeof(u32));
+                auto [tsz, ksz] = switch_widths(code[start + 2]);
+                const auto retarget = [&](usz at) {
+                    auto t = moved(read_sized(code.data() + at, tsz));
+                    std::memcpy(code.data() + at, &t, tsz);
+                };
+
+                auto table = start + 7;
+                if (op == opcode::switch_dense) {
+                    for (usz i = 0; i <= count; i++) retarget(table + ksz + tsz * i);
+                } else {
+                    retarget(table);
+                    for (usz i = 0; i < count; i++) retarget(table + tsz + (ksz + tsz) * i + ksz);
+                }
+            } break;
+        }
+
+        p += size;
+    }
+
+    /// Update everything else that refers to code.
+    for (auto& f : functions)
+        if (auto a = std::get_if<addr>(&f.address))
+            *a = moved(*a);
+
+    for (auto& r : try_regions) {
+        r.begin = moved(r.begin);
+        r.end = moved(r.end);
+        r.handler = moved(r.handler);
+    }
+
+    for (auto& l : labels)
+        if (l) l = moved(*l);
+
+    bytecode = std::move(code);
+    label_branches.clear();
+    instruction_starts.clear();
+    block_costs.clear();
+}
+
+void interp::module::create_branch_indirect(reg target) {
+    /// Make sure the register is valid.
+    check_regs(target);
+    if (is_imm(target)) throw error("Target register may not be r0.");
+
+    /// Push the opcode and register.
+    bytecode.push_back(+opcode::jmp_indirect);
+    bytecode.push_back(+target);
+    has_indirect_branches = true;
+}
+
+void interp::module::create_try(addr begin, addr end, addr handler) {
+    if (begin >= end) throw error("Invalid try region: [{:#x}, {:#x})", begin, end);
+    try_regions.push_back({begin, end, handler, current_function});
+}
+
+void interp::module::create_throw(reg value) {
+    /// Make sure the register is valid.
+    check_regs(value);
+    if (is_imm(value)) throw error("Value register may not be r0.");
+
+    /// Encode the instruction.
+    bytecode.push_back(+opcode::throw_);
+    bytecode.push_back(+value);
+}
+
+void interp::module::create_coroutine(reg dest, reg func) {
+    /// Make sure the registers are valid.
+    check_regs(dest, func);
+    if (is_imm(func)) throw error("Function register may not be r0.");
+
+    /// Encode the instruction.
+    bytecode.push_back(+opcode::coro_create);
+    bytecode.push_back(+dest);
+    bytecode.push_back(+func);
+}
+
+void interp::module::create_resume(reg status, reg handle) {
+    /// Make sure the registers are valid.
+    check_regs(status, handle);
+    if (is_imm(handle)) throw error("Coroutine register may not be r0.");
+
+    /// Encode the instruction.
+    bytecode.push_back(+opcode::resume);
+    bytecode.push_back(+status);
+    bytecode.push_back(+handle);
+}
+
+void interp::module::create_yield() {
+    bytecode.push_back(+opcode::yield);
+}
+
+void interp::module::create_thread_spawn(reg dest, reg func, reg arg) {
+    /// Make sure the registers are valid.
+    check_regs(dest, func, arg);
+    if (is_imm(func)) throw error("Function register may not be r0.");
+
+    /// Encode the instruction.
+    bytecode.push_back(+opcode::thread_spawn);
+    bytecode.push_back(+dest);
+    bytecode.push_back(+func);
+    bytecode.push_back(+arg);
+    spawns_threads = true;
+}
+
+void interp::module::create_parallel_for(reg dest, reg func, reg begin, reg end, reduction op) {
+    /// Make sure the registers are valid.
+    check_regs(dest, func, begin, end);
+    if (is_imm(func)) throw error("Function register may not be r0.");
+
+    /// Moving the operands into place must not overwrite any of them.
+    const reg args[]{func, begin, end};
+    for (usz i = 0; i < 3; i++) {
+        usz n = +args[i] & reg_mask;
+        if (n >= 2 and n <= 5 and n != i + 2) throw error("Operand r{} of parallel_for would be overwritten.", n);
+    }
+
+    /// Define the native if it doesn’t exist yet. In a function builder,
+    /// it belongs to the module and is defined when the builder is linked.
+    if (owner) {
+        static_cast<function_builder*>(this)->calls_parallel_for = true;
+    } else if (not functions_map.contains("parallel_for")) {
+        defun_parallel_for();
+    }
+
+    /// Call it.
+    for (usz i = 0; i < 3; i++)
+        if (+args[i] != i + 2) create_move(static_cast<reg>(i + 2), args[i]);
+    create_move(static_cast<reg>(5), word(op));
+    create_call("parallel_for");
+    if (+dest != 1) create_move(dest, static_cast<reg>(1));
+}
+
+void interp::module::create_thread_join(reg dest, reg handle) {
+    /// Make sure the registers are valid.
+    check_regs(dest, handle);
+    if (is_imm(handle)) throw error("Thread register may not be r0.");
+
+    /// Encode the instruction.
+    bytecode.push_back(+opcode::thread_join);
+    bytecode.push_back(+dest);
+    bytecode.push_back(+handle);
+}
+
+void interp::module::create_switch(reg index, std::vector<std::pair<word, addr>> cases, addr default_target) {
+    /// Make sure the register is valid.
+    check_regs(index);
+    if (is_imm(index)) throw error("Index register may not be r0.");
+
+    /// Nothing to switch on.
+    if (cases.empty()) return create_branch(default_target);
+
+    /// Sort the cases and check for duplicates.
+    ranges::sort(cases, {}, &std::pair<word, addr>::first);
+    if (auto it = ranges::adjacent_find(cases, {}, &std::pair<word, addr>::first); it != cases.end())
+        throw error("Duplicate switch case {}", it->first);
+    if (cases.size() > UINT32_MAX) throw error("Too many switch cases.");
+
+    /// Use a jump table if at least half of the range between the smallest
+    /// and largest key is populated; otherwise, use a sorted table.
+    const word low = cases.front().first;
+    const word range = cases.back().first - low;
+    const bool dense = range < UINT32_MAX and range / 2 < cases.size();
+
+    /// Determine the sizes of the keys and addresses.
+    addr max_target = default_target;
+    for (auto& [_, target] : cases) max_target = std::max(max_target, target);
+    /// In a builder, targets must have room for the address they are moved
+    /// to when the function is linked.
+    const u8 tsz_log2 = std::max<u8>(operand_size_log2(max_target), owner ? 2 : 0);
+    const u8 ksz_log2 = operand_size_log2(dense ? low : cases.back().first);
+    const usz tsz = usz(1) << tsz_log2;
+    const usz ksz = usz(1) << ksz_log2;
+
+    /// Push the opcode, register, widths, and count.
+    const u32 count = dense ? u32(range + 1) : u32(cases.size());
+    bytecode.push_back(+(dense ? opcode::switch_dense : opcode::switch_sparse));
+    bytecode.push_back(+index);
+    bytecode.push_back(u8(tsz_log2 | ksz_log2 << 2));
+    write_sized(bytecode, count, sizeof(u32));
+
+    /// Dense table. Holes jump to the default target.
+    if (dense) {
+        write_sized(bytecode, low, ksz);
+        write_sized(bytecode, default_target, tsz);
+        auto it = cases.begin();
+        for (word key = low; key <= cases.back().first; key++) {
+            if (it->first == key) write_sized(bytecode, (it++)->second, tsz);
+            else write_sized(bytecode, default_target, tsz);
+        }
+    }
+
+    /// Sparse table.
+    else {
+        write_sized(bytecode, default_target, tsz);
+        for (auto& [key, target] : cases) {
+            write_sized(bytecode, key, ksz);
+            write_sized(bytecode, target, tsz);
+        }
+    }
+}
+
+void interp::module::create_function(const std::string& name) {
+    /// Make sure the function doesn’t already exist.
+    if (auto it = functions_map.find(name); it != functions_map.end()) {
+        if (not std::holds_alternative<std::monostate>(functions[it->second].address)) throw error("Function already exists.");
+        functions[it->second].address = addr{bytecode.size()};
+        current_function = it->second;
+    }
+
+    /// Add the function.
+    else {
+        functions_map[name] = current_function = functions.size();
+        functions.push_back({});
+        functions.back().address = addr{bytecode.size()};
+    }
+}
+
+interp::function_builder::function_builder(module& m, usz function_index)
+    : index(function_index) {
+    owner = &m;
+    max_memory = m.max_memory;
+}
+
+auto interp::function_builder::callee(const std::string& name) -> u32 {
+    auto [it, inserted] = callees_by_name.try_emplace(name, u32(callees.size()));
+    if (inserted) callees.emplace_back(name);
+    return it->second;
+}
+
+auto interp::function_builder::callee(usz function_index) -> u32 {
+    callees.emplace_back(function_index);
+    return u32(callees.size() - 1);
+}
+
+auto interp::function_builder::lock_owner() -> std::unique_lock<std::mutex> {
+    std::unique_lock lock{owner->build_mutex};
+    if (owner->code_in_use) throw error("Cannot change a module once a context has started running it.");
+    return lock;
+}
+
+auto interp::module::build_function(const std::string& name) -> std::unique_ptr<function_builder> {
+    std::unique_lock _{build_mutex};
+    if (code_in_use) throw error("Cannot build function '{}' once a context has started running the module.", name);
+    auto index = function_index(name);
+    if (not std::holds_alternative<std::monostate>(functions[index].address)) throw error("Function already exists.");
+    return std::unique_ptr<function_builder>(new function_builder(*this, index));
+}
+
+void interp::module::link(function_builder& f) {
+    if (f.owner != this) throw error("Function builder belongs to a different module.");
+    if (f.linked) throw error("Function builder has already been linked.");
+
+    /// Shrink branches to labels while the code is still on its own.
+    if (not f.label_branches.empty()) f.relax_branches();
+
+    std::unique_lock _{build_mutex};
+    if (code_in_use) throw error("Cannot link a function once a context has started running the module.");
+    if (not std::holds_alternative<std::monostate>(functions[f.index].address)) throw error("Function already exists.");
+
+    /// Look up the functions that the builder calls.
+    if (f.calls_parallel_for and not functions_map.contains("parallel_for")) defun_parallel_for();
+    std::vector<usz> callees;
+    callees.reserve(f.callees.size());
+    for (auto& c : f.callees) {
+        auto index = std::holds_alternative<usz>(c) ? std::get<usz>(c) : function_index(std::get<std::string>(c));
+        if (index >= UINT32_MAX) throw error("Function index {} is out of range for a call from a function builder.", index);
+        callees.push_back(index);
+    }
+
+    /// Code after the builder’s invalid instruction is appended as is; branches
+    /// are relative, so only calls, absolute addresses, and cache slots need
+    /// to be fixed up.
+    const addr base = bytecode.size();
+    const auto moved = [&](addr a) { return a - ip_start_addr + base; };
+    bytecode.insert(bytecode.end(), f.bytecode.begin() + isz(ip_start_addr), f.bytecode.end());
+    for (addr p = ip_start_addr; p < f.bytecode.size();) {
+        const auto size = instruction_size(f.bytecode, p);
+        const auto at = moved(p);
+        switch (opcode(f.bytecode[p])) {
+            default: break;
+
+            case opcode::call32: {
+                u32 callee;
+                std::memcpy(&callee, bytecode.data() + at + 1, sizeof(u32));
+                callee = u32(callees[callee]);
+                std::memcpy(bytecode.data() + at + 1, &callee, sizeof(u32));
+            } break;
+
+            case opcode::call_indirect: {
+                u32 slot;
+                std::memcpy(&slot, bytecode.data() + at + 2, sizeof(u32));
+                slot += indirect_call_sites;
+                std::memcpy(bytecode.data() + at + 2, &slot, sizeof(u32));
+            } break;
+
+            case opcode::switch_dense:
+            case opcode::switch_sparse: {
+                u32 count;
+                std::memcpy(&count, bytecode.data() + at + 3, sizeof(u32));
+                auto [tsz, ksz] = switch_widths(bytecode[at + 2]);
+                const auto retarget = [&](usz where) {
+                    auto t = moved(read_sized(bytecode.data() + where, tsz));
+                    if (tsz < sizeof(word) and t >> (8 * tsz)) throw error("Switch target {} out of range.", t);
+                    std::memcpy(bytecode.data() + where, &t, tsz);
+                };
+
+                auto table = at + 7;
+                if (opcode(f.bytecode[p]) == opcode::switch_dense) {
+                    for (usz i = 0; i <= count; i++) retarget(table + ksz + tsz * i);
+                } else {
+                    retarget(table);
+                    for (usz i = 0; i < count; i++) retarget(table + tsz + (ksz + tsz) * i + ksz);
+                }
+            } break;
+        }
+
+        p += size;
+    }
+
+    /// Define the function.
+    auto& fn = functions[f.index];
+    fn.address = addr{base};
+    fn.locals_size = f.functions[0].locals_size;
+    for (auto& r : f.try_regions) try_regions.push_back({moved(r.begin), moved(r.end), moved(r.handler), f.index});
+    indirect_call_sites += f.indirect_call_sites;
+    spawns_threads |= f.spawns_threads;
+    instruction_starts.clear();
+    block_costs.clear();
+    f.linked = true;
+}
+
+void interp::module::create_xchg(reg r1, reg r2) {
+    /// Make sure the registers are valid.
+    check_regs(r1, r2);
+
+    /// Encode the instruction.
+    bytecode.push_back(+opcode::xchg);
+    bytecode.push_back(+r1);
+    bytecode.push_back(+r2);
+}
+
+void interp::module::create_pushregs(u64 mask) {
+    if (mask & 1) throw error("Register mask may not include r0.");
+    bytecode.push_back(+opcode::pushregs);
+    write_sized(bytecode, mask, sizeof(u64));
+}
+
+void interp::module::create_popregs(u64 mask) {
+    if (mask & 1) throw error("Register mask may not include r0.");
+    bytecode.push_back(+opcode::popregs);
+    write_sized(bytecode, mask, sizeof(u64));
+}
+
+auto interp::module::current_addr() const -> addr { return bytecode.size(); }
+
+/// ===========================================================================
+///  Execute bytecode.
+/// ===========================================================================
+void interp::context::call_function(usz index) {
+    /// Make sure the index is valid.
+    if (index >= functions.size()) [[unlikely]] { throw error("Call index out of bounds"); }
+
+    /// If it’s a native function, call it.
+    auto& func = functions[index];
+    if (std::holds_alternative<native_function>(func.address)) {
+        std::get<native_function>(func.address)(*this);
+    }
+
+    /// Otherwise, push the return address and jump to the function.
+    else if (std::holds_alternative<addr>(func.address)) {
+        enter_function(std::get<addr>(func.address), func.locals_size);
+    }
+
+    /// If it’s a library function, we need to do some black magic.
+    else if (std::holds_alternative<module::library_function>(func.address)) {
+        auto& lib_func = std::get<module::library_function>(func.address);
+        do_library_call_unsafe(lib_func);
+    }
+
+    /// Unknown function.
+    else {
+        /// Try to get the function name.
+        auto it = ranges::find_if(mod.functions_map, [&](auto& f) { return f.second == index; });
+        if (it != mod.functions_map.end()) throw error("Unknown function \"{}\" called.", it->first);
+        else throw error("Unknown function with index {} called.", index);
+    }
+}
+
+void interp::context::enter_function(addr target, usz locals_size) {
+    push(ip);
+    push(static_cast<word>(stack_base));
+    stack_base = sp;
+    sp = static_cast<ptr>(+sp + locals_size);
+    ip = target;
+
+    /// Make sure we didn’t overflow the stack.
+    if (+sp >= +stack_limit) [[unlikely]] { throw error("Stack overflow"); }
+}
+
+auto interp::context::new_coroutine(word function_index) -> u32 {
+    /// Only functions defined in bytecode can be coroutines.
+    if (function_index >= functions.size() or not std::holds_alternative<addr>(functions[function_index].address))
+        throw error("Cannot create a coroutine from function {}", function_index);
+
+    /// Reuse the stack of a coroutine that has returned if possible.
+    u32 handle;
+    if (not free_coroutines.empty()) {
+        handle = free_coroutines.back();
+        free_coroutines.pop_back();
+    }
+
+    /// Otherwise, carve a new stack from the top of the main stack.
+    else {
+        const usz size = (coroutine_stack_size + sizeof(word) - 1) & ~(sizeof(word) - 1);
+        auto& main_limit = current_coroutine == 0 ? stack_limit : coroutines[0].stack_limit;
+        auto main_sp = current_coroutine == 0 ? sp : coroutines[0].sp;
+        if (+coroutine_stacks_end < +main_sp + size) throw error("Out of memory for coroutine stacks");
+
+        /// Shrink the main stack.
+        coroutine_stacks_end = static_cast<ptr>(+coroutine_stacks_end - size);
+        main_limit = coroutine_stacks_end;
+
+        handle = u32(coroutines.size());
+        auto& c = coroutines.emplace_back();
+        c.stack_slice = coroutine_stacks_end;
+        c.stack_limit = static_cast<ptr>(+coroutine_stacks_end + size);
+    }
+
+    /// Set up the stack so that returning from the function ends the coroutine.
+    auto& c = coroutines[handle];
+    auto& f = functions[function_index];
+    c.ip = std::get<addr>(f.address);
+    c.stack_base = c.bottom_frame = c.stack_slice;
+    c.sp = c.stack_slice + f.locals_size;
+    c.st = coroutine::state::suspended;
+    c.registers = {};
+    if (+c.sp >= +c.stack_limit) throw error("Stack overflow");
+    return handle;
+}
+
+void interp::context::switch_coroutine(u32 to) {
+    /// Save the current stack.
+    auto& from = coroutines[current_coroutine];
+    from.ip = ip;
+    from.sp = sp;
+    from.stack_base = stack_base;
+    from.bottom_frame = bottom_frame;
+    from.stack_limit = stack_limit;
+    std::memcpy(from.registers.data(), _registers_.data() + coroutine_register_base, sizeof from.registers);
+
+    /// Switch to the new one.
+    auto& c = coroutines[to];
+    ip = c.ip;
+    sp = c.sp;
+    stack_base = c.stack_base;
+    bottom_frame = c.bottom_frame;
+    stack_limit = c.stack_limit;
+    std::memcpy(_registers_.data() + coroutine_register_base, c.registers.data(), sizeof c.registers);
+    current_coroutine = to;
+}
+
+auto interp::context::finish_coroutine() -> u32 {
+    auto done = current_coroutine;
+    auto to = coroutines[done].resumer;
+    coroutines[done].st = coroutine::state::free;
+    free_coroutines.push_back(done);
+    switch_coroutine(to);
+    return to;
+}
+
+void interp::context::unwind(addr at, word value) {
+    for (;;) {
+        /// Find the innermost region that contains the address.
+        const module::try_region* found = nullptr;
+        for (auto& r : mod.try_regions) {
+            if (at < r.begin or at >= r.end) continue;
+            if (not found or r.end - r.begin < found->end - found->begin) found = &r;
+        }
+
+        /// Found a handler. Discard everything above the locals of its frame.
+        if (found) {
+            sp = stack_base + functions[found->function].locals_size;
+            ip = found->handler;
+            _registers_[1] = value;
+            return;
+        }
+
+        /// Bottommost frame of a stack.
+        if (stack_base == bottom_frame) {
+            if (current_coroutine == 0) throw error("Uncaught exception: {}", value);
+
+            /// The exception ends the coroutine; keep unwinding in its resumer.
+            finish_coroutine();
+            at = ip - 1;
+            continue;
+        }
+
+        /// Pop the stack frame. The return address is just past the call.
+        sp = stack_base;
+        stack_base = static_cast<ptr>(pop());
+        at = pop() - 1;
+    }
+}
+
+interp::word interp::context::run() {
+    return run(0);
+}
+
+interp::word interp::context::run(usz function_index) {
+    return run(function_index, {});
+}
+
+interp::word interp::context::run(usz function_index, std::span<const word> args) {
+    if (args.size() > register_count - 2) throw error("Too many arguments: {}", args.size());
+    start(function_index);
+    ranges::copy(args, _registers_.begin() + 2);
+    resumable_run = false;
+    budget = std::numeric_limits<u64>::max();
+    if (auto st = execute(); st != run_status::finished) throw interrupted(st);
+    return _registers_[1];
+}
+
+auto interp::context::run_for(u64 max_ticks) -> run_status {
+    start(0);
+    resumable_run = true;
+    suspended = true;
+    return resume(max_ticks);
+}
+
+auto interp::context::resume(u64 max_ticks) -> run_status {
+    if (not suspended) throw error("There is no suspended run to resume");
+    if (not max_ticks) return run_status::suspended;
+    if (notifier) clear_events();
+    suspended = false;
+    budget = max_ticks;
+    return execute();
+}
+
+auto interp::context::result() const -> word {
+    if (suspended) throw error("The run has not finished yet");
+    return _registers_[1];
+}
+
+void interp::context::start(usz function_index) {
+    /// Only functions defined in bytecode can be run.
+    if (function_index >= functions.size() or not std::holds_alternative<addr>(functions[function_index].address))
+        throw error("Cannot run function {}", function_index);
+
+    /// Threads and I/O left over from the last run must not touch memory anymore.
+    reap_threads(true);
+    cancel_io();
+
+    /// Make sure the memory has the right size.
+    const auto max_memory = std::min(mod.max_memory, memory_cap);
+    _memory_.resize(max_memory);
+
+    /// Find instruction boundaries. From now on, code doesn’t move anymore.
+    mod.finalize();
+    mod.code_in_use.store(true, std::memory_order_relaxed);
+
+    /// Set the instruction pointer to the start of the function.
+    auto& func = functions[function_index];
+    ip = std::get<addr>(func.address);
+
+    /// Allocate memory on the stack for the local variables of the function.
+    const auto zero_frame_ptr = static_cast<ptr>(+mod.gp + func.locals_size);
+    sp = zero_frame_ptr;
+
+    /// Set the base of the stack.
+    stack_base = bottom_frame = zero_frame_ptr;
+    stack_limit = static_cast<ptr>(max_memory);
+
+    /// There are no coroutines yet.
+    coroutines.assign(1, {});
+    coroutines[0].st = coroutine::state::running;
+    free_coroutines.clear();
+    current_coroutine = 0;
+    coroutine_stacks_end = stack_limit;
+
+    /// Threads get their stacks from the top of memory, too.
+    if (mod.spawns_threads) reserve_thread_stacks();
+
+    /// Initialise registers.
+    for (auto& reg : _registers_) reg = 0;
 
-void interp::interpreter::create_move(reg dest, reg src) {
-    /// Make sure the registers are valid.
-    check_regs(dest, src);
+    /// Reset the call site caches.
+    call_caches.assign(mod.indirect_call_sites, {});
+    suspended = false;
+    blocked = false;
+    pending_task = {};
+    charge_pending = true;
+}
 
-    /// Encode the instruction.
-    bytecode.push_back(+opcode::mov);
-    bytecode.push_back(+dest);
-    bytecode.push_back(+src);
+void interp::context::charge_fuel() {
+    auto cost = ip < mod.block_costs.size() ? mod.block_costs[ip] : 1;
+    if (cost > fuel) [[unlikely]] {
+        suspended = true;
+        charge_pending = true;
+        throw out_of_fuel();
+    }
+
+    fuel -= cost;
 }
 
-void interp::interpreter::create_move(reg dest, word imm) {
-    /// Make sure the registers are valid.
-    check_regs(dest);
+void interp::context::set_fuel(u64 amount) {
+    fuel = amount;
+    metered = true;
+}
 
-    /// Encode the instruction.
-    bytecode.push_back(+opcode::mov);
-    bytecode.push_back(+dest);
-    if (imm < UINT8_MAX) bytecode.push_back(0 | INTERP_SIZE_MASK_8);
-    else if (imm < UINT16_MAX) bytecode.push_back(0 | INTERP_SIZE_MASK_16);
-    else if (imm < UINT32_MAX) bytecode.push_back(0 | INTERP_SIZE_MASK_32);
-    else bytecode.push_back(0 | INTERP_SIZE_MASK_64);
+void interp::context::disable_fuel() {
+    metered = false;
+}
 
-    /// Encode the immediate.
-    write_word(bytecode, imm);
+auto interp::context::remaining_fuel() const -> std::optional<u64> {
+    if (not metered) return std::nullopt;
+    return fuel;
 }
 
-#define ARITH(name, ...)                                                                   \
-    void interp::interpreter::INTERP_CAT(create_, name)(reg dest, reg src1, reg src2) /**/ \
-    { encode_arithmetic(opcode::name, dest, src1, src2); }                                 \
-    void interp::interpreter::INTERP_CAT(create_, name)(reg dest, reg src, word imm) /**/  \
-    { encode_arithmetic(opcode::name, dest, src, imm); }                                   \
-    void interp::interpreter::INTERP_CAT(create_, name)(reg dest, word imm, reg src) /**/  \
-    { encode_arithmetic(opcode::name, dest, imm, src); }
-INTERP_ALL_ARITHMETIC_INSTRUCTIONS(ARITH)
-#undef ARITH
+bool interp::task::notify(std::function<void()> callback) {
+    auto& p = handle.promise();
+    p.on_done = std::move(callback);
+    auto st = promise_type::running;
+    if (p.state.compare_exchange_strong(st, promise_type::awaited, std::memory_order_acq_rel)) return true;
+
+    /// It is finishing or done. Finishing takes no time at all, since the
+    /// callback isn’t called, but the frame may not be destroyed before it
+    /// is done.
+    while (p.state.load(std::memory_order_acquire) != promise_type::done) std::this_thread::yield();
+    return false;
+}
 
-void interp::interpreter::create_call_internal(usz index) {
-    if (index < UINT8_MAX) bytecode.push_back(+opcode::call8);
-    else if (index < UINT16_MAX) bytecode.push_back(+opcode::call16);
-    else if (index < UINT32_MAX) bytecode.push_back(+opcode::call32);
-    else bytecode.push_back(+opcode::call64);
-    write_word(bytecode, index);
+void interp::task::wait() {
+    /// The state of the frame can’t be waited on, since it may be destroyed
+    /// as soon as it is done; wait for the callback instead.
+    std::mutex m;
+    std::condition_variable cv;
+    bool finished = false;
+    if (not notify([&] {
+            std::unique_lock _{m};
+            finished = true;
+            cv.notify_all();
+        })) return;
+
+    std::unique_lock lock{m};
+    cv.wait(lock, [&] { return finished; });
 }
 
-void interp::interpreter::create_call(const std::string& name) {
-    /// Make sure the function exists.
-    auto it = functions_map.find(name);
+void interp::context::call_async(const async_native_function& func) {
+    /// The run was blocked on this call and has been resumed.
+    if (pending_task) {
+        if (not pending_task.done()) return block();
+        auto t = std::move(pending_task);
+        t.get();
+        return;
+    }
 
-    /// Function not found. Add an empty record.
-    if (it == functions_map.end()) {
-        /// Push the opcode and call index.
-        create_call_internal(functions.size());
+    /// Start the coroutine. Most of the time, it won’t have to wait.
+    auto t = func(*this);
+    if (t.done()) return t.get();
 
-        /// Add the record.
-        functions_map[name] = functions.size();
-        functions.push_back({});
+    /// If we can’t stop the run, wait for it here.
+    if (not resumable_run) {
+        t.wait();
+        return t.get();
     }
 
-    /// Function found. Push the opcode and call index.
-    else { create_call_internal(it->second); }
+    /// Stop the run until it is done. It may finish before we get to
+    /// register the callback, in which case we can just keep going.
+    if (not t.notify(waker())) return t.get();
+    pending_task = std::move(t);
+    block();
 }
 
-void interp::interpreter::create_branch(addr target) {
-    /// Push the opcode and target.
-    if (target < UINT8_MAX) bytecode.push_back(+opcode::jmp8);
-    else if (target < UINT16_MAX) bytecode.push_back(+opcode::jmp16);
-    else if (target < UINT32_MAX) bytecode.push_back(+opcode::jmp32);
-    else bytecode.push_back(+opcode::jmp64);
-    write_word(bytecode, target);
+void interp::context::block() {
+    if (not resumable_run) throw error("Cannot block in a run that can’t be resumed");
+    blocked = true;
 }
 
-void interp::interpreter::create_branch_ifnz(reg cond, addr target) {
-    /// Push the opcode, condition and target.
-    if (target < UINT8_MAX) bytecode.push_back(+opcode::jnz8);
-    else if (target < UINT16_MAX) bytecode.push_back(+opcode::jnz16);
-    else if (target < UINT32_MAX) bytecode.push_back(+opcode::jnz32);
-    else bytecode.push_back(+opcode::jnz64);
-    bytecode.push_back(+cond);
-    write_word(bytecode, target);
+void interp::context::interrupt() {
+    interrupts->flags.fetch_or(interrupt_state::cancel, std::memory_order_relaxed);
 }
 
-void interp::interpreter::create_function(const std::string& name) {
-    /// Make sure the function doesn’t already exist.
-    if (auto it = functions_map.find(name); it != functions_map.end()) {
-        if (not std::holds_alternative<std::monostate>(functions[it->second].address)) throw error("Function already exists.");
-        functions[it->second].address = addr{bytecode.size()};
-        current_function = it->second;
-    }
-
-    /// Add the function.
-    else {
-        functions_map[name] = current_function = functions.size();
-        functions.push_back({});
-        functions.back().address = addr{bytecode.size()};
-    }
+void interp::context::set_deadline(std::chrono::steady_clock::time_point when) {
+    timer::schedule(when, interrupts);
 }
 
-void interp::interpreter::create_xchg(reg r1, reg r2) {
-    /// Make sure the registers are valid.
-    check_regs(r1, r2);
-
-    /// Encode the instruction.
-    bytecode.push_back(+opcode::xchg);
-    bytecode.push_back(+r1);
-    bytecode.push_back(+r2);
+void interp::context::clear_deadline() {
+    timer::cancel(*interrupts);
 }
 
-auto interp::interpreter::current_addr() const -> addr { return bytecode.size(); }
+auto interp::context::stop_reason() -> run_status {
+    auto flags = interrupts->flags.load(std::memory_order_relaxed);
 
-/// ===========================================================================
-///  Execute bytecode.
-/// ===========================================================================
-interp::word interp::interpreter::run() {
-    /// Make sure the memory has the right size.
-    tempset max_memory = std::min(max_memory, memory_cap);
-    _memory_.resize(max_memory);
+    /// The deadline stays exceeded until it is changed.
+    if (flags & interrupt_state::deadline) return run_status::deadline_exceeded;
 
-    /// Set the instruction pointer to the entry point.
-    ip = ip_start_addr;
+    /// Cancelling only stops one run. Guest threads leave the flag set so
+    /// that it also stops the other threads and the program itself.
+    if (flags & interrupt_state::cancel) {
+        if (not guest_thread) interrupts->flags.fetch_and(u8(~interrupt_state::cancel), std::memory_order_relaxed);
+        return run_status::cancelled;
+    }
 
-    /// Allocate memory on the stack for the local variables of the entry point.
-    const auto zero_frame_ptr = static_cast<ptr>(+gp + functions[0].locals_size);
-    sp = zero_frame_ptr;
+    return run_status::suspended;
+}
 
-    /// Set the base of the stack.
-    stack_base = zero_frame_ptr;
+auto interp::context::execute() -> run_status {
+/// Charge a back-edge or call against the budget and check if we’ve
+/// been interrupted. If either is the case, stop; ip already points
+/// to the next instruction to execute.
+#define TICK()                                                                            \
+    if (not --budget or interrupts->flags.load(std::memory_order_relaxed)) [[unlikely]] { \
+        suspended = true;                                                                 \
+        return stop_reason();                                                             \
+    }
 
-    /// Initialise registers.
-    for (auto& reg : _registers_) reg = 0;
+/// Pay for the straight-line run of code that starts at ip.
+#define CHARGE() \
+    if (metered) [[unlikely]] charge_fuel();
+
+/// Stop if a native function asked us to, and go back to the call at
+/// `at` so it is executed again when the run is resumed.
+#define CHECK_BLOCKED(at)           \
+    if (blocked) [[unlikely]] {     \
+        blocked = false;            \
+        ip = at;                    \
+        suspended = true;           \
+        return run_status::blocked; \
+    }
+
+    /// Pay for the first run of code if we haven’t already.
+    if (charge_pending) {
+        charge_pending = false;
+        CHARGE();
+    }
 
     /// Run the code.
     for (;;) {
         if (ip >= bytecode.size()) [[unlikely]] { throw error("Instruction pointer out of bounds."); }
         switch (auto op = static_cast<opcode>(bytecode[ip++])) {
-            static_assert(opcode_t(opcode::max_opcode) == 44);
+            static_assert(opcode_t(opcode::max_opcode) == 89);
             default: throw error("Invalid opcode {}", u8(op));
 
             /// Do nothing.
@@ -702,13 +2196,27 @@ interp::word interp::interpreter::run() {
 
             /// Return from a function.
             case opcode::ret: {
-                /// Top stack frame. Halt the interpreter and return the value in the return register.
-                if (stack_base == zero_frame_ptr) return _registers_[1];
+                /// Bottommost stack frame.
+                if (stack_base == bottom_frame) [[unlikely]] {
+                    /// Main stack. Halt the interpreter and return the value in the return register.
+                    /// The program isn’t done until all of its threads are.
+                    if (current_coroutine == 0) {
+                        if (threads and not guest_thread) reap_threads(false);
+                        return run_status::finished;
+                    }
+
+                    /// Coroutine. Return to the resumer; the return value stays in r1.
+                    auto to = finish_coroutine();
+                    set_register(coroutines[to].status_reg, 0);
+                    CHARGE();
+                    break;
+                }
 
                 /// Pop the stack frame.
                 sp = stack_base;
                 stack_base = static_cast<ptr>(pop());
                 ip = pop();
+                CHARGE();
             } break;
 
             /// Move an immediate or a value from one register to another.
@@ -776,6 +2284,212 @@ interp::word interp::interpreter::run() {
                 store_mem(dest_address, read_register(src), register_size(src));
             } break;
 
+            /// Indexed load from memory.
+            case opcode::load_idx8:
+            case opcode::load_idx16:
+            case opcode::load_idx32:
+            case opcode::load_idx64: {
+                auto dest = static_cast<reg>(bytecode[ip++]);
+                auto base = static_cast<reg>(bytecode[ip++]);
+                auto index = static_cast<reg>(bytecode[ip++]);
+                auto shift = bytecode[ip++] & 3;
+                auto offset = read_sized_address_at_ip(op);
+
+                /// Compute the source address. Here, r0 is the stack base pointer.
+                auto base_address = +base == 0 ? stack_base : static_cast<ptr>(read_register(base));
+                auto source_address = base_address + ((read_register(index) << shift) + offset);
+
+                /// Load the value.
+                set_register(dest, load_mem(source_address, register_size(dest)));
+            } break;
+
+            /// Indexed store to memory.
+            case opcode::store_idx8:
+            case opcode::store_idx16:
+            case opcode::store_idx32:
+            case opcode::store_idx64: {
+                auto base = static_cast<reg>(bytecode[ip++]);
+                auto index = static_cast<reg>(bytecode[ip++]);
+                auto shift = bytecode[ip++] & 3;
+                auto src = static_cast<reg>(bytecode[ip++]);
+                auto offset = read_sized_address_at_ip(op);
+
+                /// Compute the destination address. Here, r0 is the stack base pointer.
+                auto base_address = +base == 0 ? stack_base : static_cast<ptr>(read_register(base));
+                auto dest_address = base_address + ((read_register(index) << shift) + offset);
+
+                /// Store the value.
+                store_mem(dest_address, read_register(src), register_size(src));
+            } break;
+
+            /// Copy a block of memory.
+            case opcode::memcopy: {
+                auto dest = static_cast<reg>(bytecode[ip++]);
+                auto src = static_cast<reg>(bytecode[ip++]);
+                auto size = read_register(static_cast<reg>(bytecode[ip++]));
+                if (not size) break;
+
+                /// Check both ranges once. Here, r0 is the stack base pointer.
+                auto d = mem_range(+dest == 0 ? stack_base : static_cast<ptr>(read_register(dest)), size);
+                auto s = mem_range(+src == 0 ? stack_base : static_cast<ptr>(read_register(src)), size);
+                std::memmove(d, s, size);
+            } break;
+
+            /// Fill a block of memory.
+            case opcode::memfill: {
+                auto dest = static_cast<reg>(bytecode[ip++]);
+                auto value = read_register(static_cast<reg>(bytecode[ip++]));
+                auto size = read_register(static_cast<reg>(bytecode[ip++]));
+                if (not size) break;
+
+                /// Check the range once. Here, r0 is the stack base pointer.
+                auto d = mem_range(+dest == 0 ? stack_base : static_cast<ptr>(read_register(dest)), size);
+                std::memset(d, static_cast<u8>(value), size);
+            } break;
+
+            /// Compare two blocks of memory.
+            case opcode::memcompare: {
+                auto result = static_cast<reg>(bytecode[ip++]);
+                auto lhs = static_cast<reg>(bytecode[ip++]);
+                auto rhs = static_cast<reg>(bytecode[ip++]);
+                auto size = read_register(static_cast<reg>(bytecode[ip++]));
+                if (not size) {
+                    set_register(result, 0);
+                    break;
+                }
+
+                /// Check both ranges once. Here, r0 is the stack base pointer.
+                auto l = mem_range(+lhs == 0 ? stack_base : static_cast<ptr>(read_register(lhs)), size);
+                auto r = mem_range(+rhs == 0 ? stack_base : static_cast<ptr>(read_register(rhs)), size);
+                auto cmp = std::memcmp(l, r, size);
+                set_register(result, word(i64(cmp > 0) - i64(cmp < 0)));
+            } break;
+
+            /// Atomically load a value.
+            case opcode::atomic_load: {
+                auto order = std_memory_order(bytecode[ip++]);
+                auto dest = static_cast<reg>(bytecode[ip++]);
+                auto address = static_cast<reg>(bytecode[ip++]);
+                auto mem = atomic_mem(+address == 0 ? stack_base : static_cast<ptr>(read_register(address)), register_size(dest));
+                set_register(dest, visit_atomic(mem, register_size(dest), [&](auto a) -> word { return a.load(order); }));
+            } break;
+
+            /// Atomically store a value.
+            case opcode::atomic_store: {
+                auto order = std_memory_order(bytecode[ip++]);
+                auto address = static_cast<reg>(bytecode[ip++]);
+                auto src = static_cast<reg>(bytecode[ip++]);
+                auto mem = atomic_mem(+address == 0 ? stack_base : static_cast<ptr>(read_register(address)), register_size(src));
+                visit_atomic(mem, register_size(src), [&](auto a) -> word {
+                    using T = decltype(a)::value_type;
+                    a.store(T(read_register(src)), order);
+                    return 0;
+                });
+            } break;
+
+            /// Atomic read-modify-write operations.
+            case opcode::atomic_xchg:
+            case opcode::atomic_fetch_add:
+            case opcode::atomic_fetch_sub:
+            case opcode::atomic_fetch_and:
+            case opcode::atomic_fetch_or: {
+                auto order = std_memory_order(bytecode[ip++]);
+                auto dest = static_cast<reg>(bytecode[ip++]);
+                auto address = static_cast<reg>(bytecode[ip++]);
+                auto value = read_register(static_cast<reg>(bytecode[ip++]));
+                auto mem = atomic_mem(+address == 0 ? stack_base : static_cast<ptr>(read_register(address)), register_size(dest));
+                set_register(dest, visit_atomic(mem, register_size(dest), [&](auto a) -> word {
+                    using T = decltype(a)::value_type;
+                    switch (op) {
+                        case opcode::atomic_xchg: return a.exchange(T(value), order);
+                        case opcode::atomic_fetch_add: return a.fetch_add(T(value), order);
+                        case opcode::atomic_fetch_sub: return a.fetch_sub(T(value), order);
+                        case opcode::atomic_fetch_and: return a.fetch_and(T(value), order);
+                        case opcode::atomic_fetch_or: return a.fetch_or(T(value), order);
+                        default: std::unreachable();
+                    }
+                }));
+            } break;
+
+            /// Atomic compare-and-swap.
+            case opcode::atomic_cmpxchg: {
+                auto order = std_memory_order(bytecode[ip++]);
+                auto dest = static_cast<reg>(bytecode[ip++]);
+                auto address = static_cast<reg>(bytecode[ip++]);
+                auto expected = read_register(static_cast<reg>(bytecode[ip++]));
+                auto desired = read_register(static_cast<reg>(bytecode[ip++]));
+                auto mem = atomic_mem(+address == 0 ? stack_base : static_cast<ptr>(read_register(address)), register_size(dest));
+                set_register(dest, visit_atomic(mem, register_size(dest), [&](auto a) -> word {
+                    using T = decltype(a)::value_type;
+                    auto old = T(expected);
+                    a.compare_exchange_strong(old, T(desired), order);
+                    return old;
+                }));
+            } break;
+
+            /// Memory fence.
+            case opcode::fence: {
+                std::atomic_thread_fence(std_memory_order(bytecode[ip++]));
+            } break;
+
+            /// Load a vector from memory.
+            case opcode::vload: {
+                auto shape = u8(bytecode[ip++] & vector_shape_mask);
+                auto& dest = _vregisters_[bytecode[ip++] % vector_register_count];
+                auto src = static_cast<reg>(bytecode[ip++]);
+                auto width = vector::width(shape);
+
+                /// Check the range once. Here, r0 is the stack base pointer.
+                auto p = mem_range(+src == 0 ? stack_base : static_cast<ptr>(read_register(src)), width);
+                std::memcpy(dest.bytes.data(), p, width);
+                if (width != dest.bytes.size()) std::memset(dest.bytes.data() + width, 0, dest.bytes.size() - width);
+            } break;
+
+            /// Store a vector to memory.
+            case opcode::vstore: {
+                auto shape = u8(bytecode[ip++] & vector_shape_mask);
+                auto dest = static_cast<reg>(bytecode[ip++]);
+                auto& src = _vregisters_[bytecode[ip++] % vector_register_count];
+                auto width = vector::width(shape);
+
+                /// Check the range once. Here, r0 is the stack base pointer.
+                auto p = mem_range(+dest == 0 ? stack_base : static_cast<ptr>(read_register(dest)), width);
+                std::memcpy(p, src.bytes.data(), width);
+            } break;
+
+            /// Broadcast a register to every lane of a vector.
+            case opcode::vsplat: {
+                auto shape = u8(bytecode[ip++] & vector_shape_mask);
+                auto& dest = _vregisters_[bytecode[ip++] % vector_register_count];
+                auto src = static_cast<reg>(bytecode[ip++]);
+                vector::splats[shape](dest, read_register(src));
+            } break;
+
+            /// Lane-wise vector operations.
+            case opcode::vadd:
+            case opcode::vsub:
+            case opcode::vmul:
+            case opcode::vcmpeq:
+            case opcode::vcmplt:
+            case opcode::vmin:
+            case opcode::vmax: {
+                auto shape = u8(bytecode[ip++] & vector_shape_mask);
+                auto& dest = _vregisters_[bytecode[ip++] % vector_register_count];
+                auto& src1 = _vregisters_[bytecode[ip++] % vector_register_count];
+                auto& src2 = _vregisters_[bytecode[ip++] % vector_register_count];
+                vector::binary_ops[+op - +opcode::vadd][shape](dest, src1, src2);
+            } break;
+
+            /// Horizontal reductions.
+            case opcode::vreduce_add:
+            case opcode::vreduce_min:
+            case opcode::vreduce_max: {
+                auto shape = u8(bytecode[ip++] & vector_shape_mask);
+                auto dest = static_cast<reg>(bytecode[ip++]);
+                auto& src = _vregisters_[bytecode[ip++] % vector_register_count];
+                set_register(dest, vector::reductions[+op - +opcode::vreduce_add][shape](src));
+            } break;
+
             /// Add two integers.
             case opcode::add: {
                 auto [dest, src1, src2] = decode_arithmetic();
@@ -847,42 +2561,161 @@ interp::word interp::interpreter::run() {
             case opcode::call16:
             case opcode::call32:
             case opcode::call64: {
-                auto index = read_sized_address_at_ip(op);
-
-                /// Make sure the index is valid.
-                if (index >= functions.size()) [[unlikely]] { throw error("Call index out of bounds"); }
+                auto at = ip - 1;
+                call_function(read_sized_address_at_ip(op));
+                CHECK_BLOCKED(at);
+                CHARGE();
+                TICK();
+            } break;
 
-                /// If it’s a native function, call it.
-                auto& func = functions.at(index);
-                if (std::holds_alternative<native_function>(func.address)) {
-                    std::get<native_function>(func.address)(*this);
+            /// Call a function through a register.
+            case opcode::call_indirect: {
+                auto at = ip - 1;
+                auto index = read_register(static_cast<reg>(bytecode[ip++]));
+                u32 slot;
+                std::memcpy(&slot, bytecode.data() + ip, sizeof(u32));
+                ip += sizeof(u32);
+                if (slot >= call_caches.size()) [[unlikely]] {
+                    throw error("Indirect call site {} has no cache; was the module linked after this run started?", slot);
                 }
 
-                /// Otherwise, push the return address and jump to the function.
-                else if (std::holds_alternative<addr>(func.address)) {
-                    push(ip);
-                    push(static_cast<word>(stack_base));
-                    stack_base = sp;
-                    sp = static_cast<ptr>(+sp + func.locals_size);
-                    ip = std::get<addr>(func.address);
+                /// Fast path: same function as last time.
+                auto& cache = call_caches[slot];
+                if (cache.valid and cache.index == index) [[likely]] {
+                    enter_function(cache.target, cache.locals_size);
+                    CHARGE();
+                    TICK();
+                    break;
+                }
 
-                    /// Make sure we didn’t overflow the stack.
-                    if (+sp >= max_memory) [[unlikely]] { throw error("Stack overflow"); }
+                /// Slow path. Cache the target if it’s defined in bytecode.
+                call_function(index);
+                CHECK_BLOCKED(at);
+                if (auto a = std::get_if<addr>(&functions[index].address)) {
+                    cache.index = index;
+                    cache.valid = true;
+                    cache.target = *a;
+                    cache.locals_size = functions[index].locals_size;
                 }
+                CHARGE();
+                TICK();
+            } break;
 
-                /// If it’s a library function, we need to do some black magic.
-                else if (std::holds_alternative<library_function>(func.address)) {
-                    auto& lib_func = std::get<library_function>(func.address);
-                    do_library_call_unsafe(lib_func);
+            /// Jump to an address in a register.
+            case opcode::jmp_indirect: {
+                auto target = read_register(static_cast<reg>(bytecode[ip++]));
+                if (target >= mod.instruction_starts.size() or not mod.instruction_starts[target]) [[unlikely]] {
+                    throw error("Invalid indirect jump target {:#x}", target);
                 }
 
-                /// Unknown function.
-                else {
-                    /// Try to get the function name.
-                    auto it = ranges::find_if(functions_map, [&](auto& f) { return f.second == index; });
-                    if (it != functions_map.end()) throw error("Unknown function \"{}\" called.", it->first);
-                    else throw error("Unknown function with index {} called.", index);
+                auto at = ip;
+                ip = target;
+                CHARGE();
+                if (ip < at) TICK();
+            } break;
+
+            /// Throw an exception.
+            case opcode::throw_: {
+                auto value = read_register(static_cast<reg>(bytecode[ip]));
+                unwind(ip - 1, value);
+                CHARGE();
+            } break;
+
+            /// Create a coroutine.
+            case opcode::coro_create: {
+                auto dest = static_cast<reg>(bytecode[ip++]);
+                auto index = read_register(static_cast<reg>(bytecode[ip++]));
+                set_register(dest, new_coroutine(index));
+            } break;
+
+            /// Resume a coroutine.
+            case opcode::resume: {
+                auto status = static_cast<reg>(bytecode[ip++]);
+                auto handle = read_register(static_cast<reg>(bytecode[ip++]));
+                if (handle == 0 or handle >= coroutines.size() or coroutines[handle].st != coroutine::state::suspended) [[unlikely]]
+                    throw error("Cannot resume coroutine {}", handle);
+
+                coroutines[current_coroutine].status_reg = status;
+                coroutines[handle].resumer = current_coroutine;
+                coroutines[handle].st = coroutine::state::running;
+                switch_coroutine(u32(handle));
+                CHARGE();
+            } break;
+
+            /// Return to the resumer of the current coroutine.
+            case opcode::yield: {
+                if (current_coroutine == 0) [[unlikely]] { throw error("Cannot yield outside of a coroutine"); }
+                auto to = coroutines[current_coroutine].resumer;
+                coroutines[current_coroutine].st = coroutine::state::suspended;
+                switch_coroutine(to);
+                set_register(coroutines[to].status_reg, 1);
+                CHARGE();
+            } break;
+
+            /// Start a guest thread.
+            case opcode::thread_spawn: {
+                auto dest = static_cast<reg>(bytecode[ip++]);
+                auto index = read_register(static_cast<reg>(bytecode[ip++]));
+                auto arg = read_register(static_cast<reg>(bytecode[ip++]));
+                set_register(dest, spawn_thread(index, arg));
+            } break;
+
+            /// Wait for a guest thread.
+            case opcode::thread_join: {
+                auto dest = static_cast<reg>(bytecode[ip++]);
+                auto handle = read_register(static_cast<reg>(bytecode[ip++]));
+                set_register(dest, join_thread(handle));
+            } break;
+
+            /// Jump through a jump table.
+            case opcode::switch_dense: {
+                auto value = read_register(static_cast<reg>(bytecode[ip++]));
+                auto [tsz, ksz] = switch_widths(bytecode[ip++]);
+                u32 count;
+                std::memcpy(&count, bytecode.data() + ip, sizeof(u32));
+                ip += sizeof(u32);
+
+                /// Keys below the lowest key wrap around and are out of range too.
+                auto table = bytecode.data() + ip + ksz;
+                auto offs = value - read_sized(bytecode.data() + ip, ksz);
+                auto at = ip;
+                ip = offs < count
+                         ? read_sized(table + tsz * (offs + 1), tsz)
+                         : read_sized(table, tsz);
+                if (ip >= bytecode.size()) [[unlikely]] { throw error("Jump target out of bounds"); }
+                CHARGE();
+                if (ip < at) TICK();
+            } break;
+
+            /// Jump through a sorted table.
+            case opcode::switch_sparse: {
+                auto value = read_register(static_cast<reg>(bytecode[ip++]));
+                auto [tsz, ksz] = switch_widths(bytecode[ip++]);
+                u32 count;
+                std::memcpy(&count, bytecode.data() + ip, sizeof(u32));
+                ip += sizeof(u32);
+
+                /// Binary search for the key.
+                auto entries = bytecode.data() + ip + tsz;
+                auto target = read_sized(bytecode.data() + ip, tsz);
+                for (usz lo = 0, hi = count; lo < hi;) {
+                    auto mid = lo + (hi - lo) / 2;
+                    auto entry = entries + mid * (ksz + tsz);
+                    auto key = read_sized(entry, ksz);
+                    if (key == value) {
+                        target = read_sized(entry + ksz, tsz);
+                        break;
+                    }
+
+                    if (key < value) lo = mid + 1;
+                    else hi = mid;
                 }
+
+                auto at = ip;
+                ip = target;
+                if (ip >= bytecode.size()) [[unlikely]] { throw error("Jump target out of bounds"); }
+                CHARGE();
+                if (ip < at) TICK();
             } break;
 
             /// Jump to an address.
@@ -890,8 +2723,12 @@ interp::word interp::interpreter::run() {
             case opcode::jmp16:
             case opcode::jmp32:
             case opcode::jmp64: {
-                ip = read_sized_address_at_ip(op);
+                auto at = ip;
+                auto sz = address_operand_size(op);
+                ip = addr(i64(at - 1) + sign_extend(read_sized(bytecode.data() + ip, sz), sz));
                 if (ip >= bytecode.size()) [[unlikely]] { throw error("Jump target out of bounds"); }
+                CHARGE();
+                if (ip < at) TICK();
             } break;
 
             /// Jump to an address if the top of the stack is not zero.
@@ -899,10 +2736,39 @@ interp::word interp::interpreter::run() {
             case opcode::jnz16:
             case opcode::jnz32:
             case opcode::jnz64: {
-                reg r = static_cast<reg>(bytecode[ip++]);
-                auto target = read_sized_address_at_ip(op);
+                auto sz = address_operand_size(op);
+                auto target = addr(i64(ip - 1) + sign_extend(read_sized(bytecode.data() + ip + 1, sz), sz));
                 if (target >= bytecode.size()) [[unlikely]] { throw error("Jump target out of bounds"); }
+                reg r = static_cast<reg>(bytecode[ip++]);
+                ip += sz;
+                auto at = ip;
                 if (read_register(r)) ip = target;
+                CHARGE();
+                if (ip < at) TICK();
+            } break;
+
+            /// Push several registers.
+            case opcode::pushregs: {
+                auto mask = read_sized(bytecode.data() + ip, sizeof(u64));
+                ip += sizeof(u64);
+
+                /// Check the stack once for all registers.
+                auto size = usz(std::popcount(mask)) * sizeof(word);
+                if (+sp + size > +stack_limit) [[unlikely]] { throw error("Stack overflow"); }
+                copy_registers(mask, reinterpret_cast<word*>(_memory_.data() + +sp), true);
+                sp = static_cast<ptr>(+sp + size);
+            } break;
+
+            /// Pop several registers.
+            case opcode::popregs: {
+                auto mask = read_sized(bytecode.data() + ip, sizeof(u64));
+                ip += sizeof(u64);
+
+                /// Check the stack once for all registers.
+                auto size = usz(std::popcount(mask)) * sizeof(word);
+                if (+sp < +mod.gp + size) [[unlikely]] { throw error("Stack underflow"); }
+                sp = static_cast<ptr>(+sp - size);
+                copy_registers(mask, reinterpret_cast<word*>(_memory_.data() + +sp), false);
             } break;
 
             /// Exchange the values of two registers.
@@ -915,6 +2781,9 @@ interp::word interp::interpreter::run() {
             } break;
         }
     }
+#undef TICK
+#undef CHARGE
+#undef CHECK_BLOCKED
 }
 
 /// ===========================================================================
@@ -931,8 +2800,9 @@ interp::word interp::interpreter::run() {
 ///      in N.
 ///    - When printing a mnemonic, add exactly one leading space before
 ///      the mnemonic.
-std::string interp::interpreter::disassemble() const {
+std::string interp::module::disassemble() const {
     std::string result;
+    finalize();
 
     /*/// Determine the number of nonzero bytes of the greatest number in the bytecode.
     auto padd_to = ranges::max(bytecode | views::transform(std::bind_front(number_width, 16)));
@@ -1052,6 +2922,66 @@ std::string interp::interpreter::disassemble() const {
         print_rest_of_word(magenta, imm_sz, 4);
     };
 
+    /// String representation of a vector register and shape.
+    const auto vreg_str = [](u8 r) { return fmt::format(fg(red), "v{}", r); };
+    const auto shape_str = [](u8 shape) {
+        auto lane_bits = vector::lane_size(shape) * 8;
+        return fmt::format(
+            "{}{}x{}",
+            shape & INTERP_VECTOR_SIGNED ? 'i' : 'u',
+            lane_bits,
+            vector::width(shape) * 8 / lane_bits
+        );
+    };
+
+    /// Print a vector instruction. Vector instructions don’t have immediates.
+    const auto print_vector = [&](std::string_view name, bool dest_is_vreg, bool src_is_vreg, bool binary) {
+        auto shape = bytecode[i++];
+        auto dest = bytecode[i++];
+        auto src1 = bytecode[i++];
+        auto src2 = binary ? bytecode[i++] : u8(0);
+        result += fmt::format(fg(magenta), " {:02x}", shape);
+        result += fmt::format(fg(red), " {:02x} {:02x}", dest, src1);
+        if (binary) result += fmt::format(fg(red), " {:02x}", src2);
+        padding(binary ? 5 : 4);
+        result += fmt::format(
+            " {}{} {}{} {}",
+            styled(name, fg(yellow)),
+            styled(fmt::format(".{}", shape_str(shape)), fg(magenta)),
+            dest_is_vreg ? vreg_str(dest) : reg_str(dest),
+            comma,
+            src_is_vreg ? vreg_str(src1) : reg_str(src1)
+        );
+        if (binary) result += fmt::format("{} {}", comma, vreg_str(src2));
+        result += "\n";
+    };
+
+    /// Print an atomic instruction. The address operand is printed in brackets.
+    const auto print_atomic = [&](std::string_view name, usz nregs, bool address_first) {
+        static constexpr std::string_view orders[]{"relaxed", "acquire", "release", "acq_rel", "seq_cst"};
+        auto order = bytecode[i++];
+        result += fmt::format(fg(magenta), " {:02x}", order);
+
+        /// Registers. The address is the second operand, or the first if there is no dest.
+        std::string operands;
+        const usz address_index = address_first ? 1 : nregs == 2 ? 0 : 1;
+        for (usz n = 0; n < nregs; n++) {
+            auto r = bytecode[i++];
+            result += fmt::format(fg(red), " {:02x}", r);
+            if (n) operands += fmt::format("{} ", comma);
+            operands += n == address_index ? fmt::format("{}{}{}", lbrack, reg_str(r), rbrack) : reg_str(r);
+        }
+
+        padding(2 + nregs);
+        result += fmt::format(
+            " {}{}{}{}\n",
+            styled(name, fg(yellow)),
+            styled(fmt::format(".{}", order < std::size(orders) ? orders[order] : "???"), fg(magenta)),
+            operands.empty() ? "" : " ",
+            operands
+        );
+    };
+
     /// Stringify a pointer.
     auto pointer = [&](addr a) {
         if (a & host_ptr_mask) return fmt::format(fg(dark_green), "native:{:#08x}", a & ~host_ptr_mask);
@@ -1073,6 +3003,11 @@ std::string interp::interpreter::disassemble() const {
             result += fmt::format(fg(green), "{}{}\n", func->first, styled(":", fg(orange)));
         }
 
+        /// Print any try regions that start here.
+        for (auto& r : try_regions)
+            if (r.begin == i)
+                result += fmt::format(fg(white), "            .try {:08x}..{:08x} -> {:08x}\n", r.begin, r.end, r.handler);
+
         /// Print address.
         result += fmt::format(fg(orange), "[{:08x}]: ", i);
         if (i == 0) result += fmt::format(fg(white), "00", bytecode[i]);
@@ -1081,7 +3016,7 @@ std::string interp::interpreter::disassemble() const {
 
         /// Print the instruction mnemonic.
         switch (auto op = static_cast<opcode>(bytecode[i++])) {
-            static_assert(opcode_t(opcode::max_opcode) == 44);
+            static_assert(opcode_t(opcode::max_opcode) == 89);
             default:
                 padding(1);
                 if (i == 1 and op == opcode::invalid) result += fmt::format(fg(white), " .sentinel\n");
@@ -1194,6 +3129,51 @@ std::string interp::interpreter::disassemble() const {
                 print_rest_of_word(dark_green, sz, 3);
             } break;
 
+            case opcode::load_idx8:
+            case opcode::load_idx16:
+            case opcode::load_idx32:
+            case opcode::load_idx64: {
+                /// Print the dest, base, index, and scale.
+                auto dest = bytecode[i++];
+                auto base = bytecode[i++];
+                auto index = bytecode[i++];
+                auto scale = u8(1 << (bytecode[i++] & 3));
+                result += fmt::format(fg(red), " {:02x} {:02x} {:02x}", dest, base, index);
+                result += fmt::format(fg(magenta), " {:02x}", bytecode[i - 1]);
+
+                /// Print the address.
+                auto sz = address_operand_size(op);
+                auto addr = read_word(sz);
+                print_word(dark_green, sz, 5);
+
+                /// Align and print the mnemonic.
+                result += fmt::format(fg(yellow), " ld {}{} {}{} {} {} * {} {} {}{}\n", reg_str(dest), comma, lbrack, reg_str(base), plus, reg_str(index), styled(scale, fg(magenta)), plus, styled(addr, fg(dark_green)), rbrack);
+                print_rest_of_word(dark_green, sz, 5);
+            } break;
+
+            case opcode::store_idx8:
+            case opcode::store_idx16:
+            case opcode::store_idx32:
+            case opcode::store_idx64: {
+                /// Print the base, index, scale, and source.
+                auto base = bytecode[i++];
+                auto index = bytecode[i++];
+                auto scale = u8(1 << (bytecode[i++] & 3));
+                auto src = bytecode[i++];
+                result += fmt::format(fg(red), " {:02x} {:02x}", base, index);
+                result += fmt::format(fg(magenta), " {:02x}", bytecode[i - 2]);
+                result += fmt::format(fg(red), " {:02x}", src);
+
+                /// Print the address.
+                auto sz = address_operand_size(op);
+                auto addr = read_word(sz);
+                print_word(dark_green, sz, 5);
+
+                /// Align and print the mnemonic.
+                result += fmt::format(fg(yellow), " st {}{} {} {} * {} {} {}{}{} {}\n", lbrack, reg_str(base), plus, reg_str(index), styled(scale, fg(magenta)), plus, styled(addr, fg(dark_green)), rbrack, comma, reg_str(src));
+                print_rest_of_word(dark_green, sz, 5);
+            } break;
+
             case opcode::add: print_arith("add"); break;
             case opcode::sub: print_arith("sub"); break;
             case opcode::muli: print_arith("muli"); break;
@@ -1243,12 +3223,114 @@ std::string interp::interpreter::disassemble() const {
             case opcode::jmp32:
             case opcode::jmp64: {
                 auto sz = address_operand_size(op);
-                auto a = read_word(sz);
+                auto a = addr(i64(i - 1) + sign_extend(read_word(sz), sz));
                 print_word(orange, sz, 1);
                 result += fmt::format(" {} {:08x}\n", styled("jmp", fg(yellow)), styled(a, fg(orange)));
                 print_rest_of_word(orange, sz, 1);
             } break;
 
+            case opcode::call_indirect: {
+                auto r = bytecode[i++];
+                result += fmt::format(fg(red), " {:02x}", r);
+                u32 slot = u32(read_word(sizeof(u32)));
+                print_word(white, sizeof(u32), 2);
+                result += fmt::format(" {} {} {}\n", styled("call", fg(yellow)), reg_str(r), styled(fmt::format("@ cache {}", slot), fg(orange)));
+            } break;
+
+            case opcode::jmp_indirect: {
+                auto r = bytecode[i++];
+                result += fmt::format(fg(red), " {:02x}", r);
+                padding(2);
+                result += fmt::format(" {} {}\n", styled("jmp", fg(yellow)), reg_str(r));
+            } break;
+
+            case opcode::coro_create:
+            case opcode::resume: {
+                auto r1 = bytecode[i++];
+                auto r2 = bytecode[i++];
+                result += fmt::format(fg(red), " {:02x} {:02x}", r1, r2);
+                padding(3);
+                auto name = op == opcode::coro_create ? "coro.create" : "resume";
+                result += fmt::format(" {} {}{} {}\n", styled(name, fg(yellow)), reg_str(r1), comma, reg_str(r2));
+            } break;
+
+            case opcode::thread_spawn: {
+                auto r1 = bytecode[i++];
+                auto r2 = bytecode[i++];
+                auto r3 = bytecode[i++];
+                result += fmt::format(fg(red), " {:02x} {:02x} {:02x}", r1, r2, r3);
+                padding(4);
+                result += fmt::format(" {} {}{} {}{} {}\n", styled("thread.spawn", fg(yellow)), reg_str(r1), comma, reg_str(r2), comma, reg_str(r3));
+            } break;
+
+            case opcode::thread_join: {
+                auto r1 = bytecode[i++];
+                auto r2 = bytecode[i++];
+                result += fmt::format(fg(red), " {:02x} {:02x}", r1, r2);
+                padding(3);
+                result += fmt::format(" {} {}{} {}\n", styled("thread.join", fg(yellow)), reg_str(r1), comma, reg_str(r2));
+            } break;
+
+            case opcode::yield:
+                padding(1);
+                result += fmt::format(fg(yellow), " yield\n");
+                break;
+
+            case opcode::throw_: {
+                auto r = bytecode[i++];
+                result += fmt::format(fg(red), " {:02x}", r);
+                padding(2);
+                result += fmt::format(" {} {}\n", styled("throw", fg(yellow)), reg_str(r));
+            } break;
+
+            case opcode::switch_dense:
+            case opcode::switch_sparse: {
+                const bool dense = op == opcode::switch_dense;
+                auto r = bytecode[i++];
+                auto widths = bytecode[i++];
+                auto [tsz, ksz] = switch_widths(widths);
+                result += fmt::format(fg(red), " {:02x}", r);
+                result += fmt::format(fg(white), " {:02x}", widths);
+                u32 count = u32(read_word(sizeof(u32)));
+                print_word(white, sizeof(u32), 3);
+                result += fmt::format(
+                    " {} {}{} {}\n",
+                    styled(dense ? "switch" : "switch.sparse", fg(yellow)),
+                    reg_str(r),
+                    comma,
+                    styled(fmt::format("{} cases", count), fg(white))
+                );
+
+                /// Print a table entry on a line of its own.
+                const auto print_entry = [&](std::string_view key, usz entry_size) {
+                    auto target = read_sized(bytecode.data() + i + entry_size - tsz, tsz);
+                    result += fmt::format(fg(orange), "[{:08x}]:   ", i);
+                    print_word(white, entry_size, 1);
+                    result += fmt::format(" {} {:08x}\n", key, styled(target, fg(orange)));
+                    print_rest_of_word(white, entry_size, 1);
+                };
+
+                /// Dense tables have a low key followed by all targets.
+                if (dense) {
+                    auto low = read_word(ksz);
+                    result += fmt::format(fg(orange), "[{:08x}]:   ", i);
+                    print_word(magenta, ksz, 1);
+                    result += fmt::format(" {} {}\n", styled("low", fg(white)), styled(low, fg(magenta)));
+                    print_rest_of_word(magenta, ksz, 1);
+                    print_entry(fmt::format(fg(white), "default"), tsz);
+                    for (u32 n = 0; n < count; n++) print_entry(fmt::format("{}", styled(low + n, fg(magenta))), tsz);
+                }
+
+                /// Sparse tables have key/target pairs.
+                else {
+                    print_entry(fmt::format(fg(white), "default"), tsz);
+                    for (u32 n = 0; n < count; n++) {
+                        auto key = read_word(ksz);
+                        print_entry(fmt::format("{}", styled(key, fg(magenta))), ksz + tsz);
+                    }
+                }
+            } break;
+
             case opcode::jnz8:
             case opcode::jnz16:
             case opcode::jnz32:
@@ -1256,7 +3338,7 @@ std::string interp::interpreter::disassemble() const {
                 auto r = bytecode[i++];
                 result += fmt::format(fg(red), " {:02x}", r);
                 auto sz = address_operand_size(op);
-                auto a = read_word(sz);
+                auto a = addr(i64(i - 2) + sign_extend(read_word(sz), sz));
                 print_word(orange, sz, 2);
                 result += fmt::format(" {} {}{} {:08x}\n", styled("jnz", fg(yellow)), reg_str(r), comma, styled(a, fg(orange)));
                 print_rest_of_word(orange, sz, 2);
@@ -1269,6 +3351,73 @@ std::string interp::interpreter::disassemble() const {
                 padding(3);
                 result += fmt::format(" {} {}{} {}\n", styled("xchg", fg(yellow)), reg_str(r1), comma, reg_str(r2));
             } break;
+
+            case opcode::pushregs:
+            case opcode::popregs: {
+                auto mask = read_word(sizeof(u64));
+                print_word(white, sizeof(u64), 1);
+
+                /// Print runs of registers as ranges.
+                std::string regs;
+                for (u64 m = mask; m;) {
+                    auto first = std::countr_zero(m);
+                    auto len = std::countr_one(m >> first);
+                    if (not regs.empty()) regs += fmt::format("{} ", comma);
+                    regs += len == 1
+                                ? fmt::format(fg(red), "r{}", first)
+                                : fmt::format(fg(red), "r{}-r{}", first, first + len - 1);
+                    m &= len == 64 ? 0 : ~(((u64(1) << len) - 1) << first);
+                }
+
+                auto name = op == opcode::pushregs ? "pushregs" : "popregs";
+                result += fmt::format(" {} {}{}{}\n", styled(name, fg(yellow)), styled("{", fg(white)), regs, styled("}", fg(white)));
+                print_rest_of_word(white, sizeof(u64), 1);
+            } break;
+
+            case opcode::memcopy:
+            case opcode::memfill: {
+                auto dest = bytecode[i++];
+                auto src = bytecode[i++];
+                auto size = bytecode[i++];
+                result += fmt::format(fg(red), " {:02x} {:02x} {:02x}", dest, src, size);
+                padding(4);
+                auto name = op == opcode::memcopy ? "memcopy" : "memfill";
+                result += fmt::format(" {} {}{} {}{} {}\n", styled(name, fg(yellow)), reg_str(dest), comma, reg_str(src), comma, reg_str(size));
+            } break;
+
+            case opcode::atomic_load: print_atomic("atomic.ld", 2, true); break;
+            case opcode::atomic_store: print_atomic("atomic.st", 2, false); break;
+            case opcode::atomic_xchg: print_atomic("atomic.xchg", 3, false); break;
+            case opcode::atomic_fetch_add: print_atomic("atomic.add", 3, false); break;
+            case opcode::atomic_fetch_sub: print_atomic("atomic.sub", 3, false); break;
+            case opcode::atomic_fetch_and: print_atomic("atomic.and", 3, false); break;
+            case opcode::atomic_fetch_or: print_atomic("atomic.or", 3, false); break;
+            case opcode::atomic_cmpxchg: print_atomic("atomic.cmpxchg", 4, false); break;
+            case opcode::fence: print_atomic("fence", 0, false); break;
+
+            case opcode::vload: print_vector("vload", true, false, false); break;
+            case opcode::vstore: print_vector("vstore", false, true, false); break;
+            case opcode::vsplat: print_vector("vsplat", true, false, false); break;
+            case opcode::vadd: print_vector("vadd", true, true, true); break;
+            case opcode::vsub: print_vector("vsub", true, true, true); break;
+            case opcode::vmul: print_vector("vmul", true, true, true); break;
+            case opcode::vcmpeq: print_vector("vcmpeq", true, true, true); break;
+            case opcode::vcmplt: print_vector("vcmplt", true, true, true); break;
+            case opcode::vmin: print_vector("vmin", true, true, true); break;
+            case opcode::vmax: print_vector("vmax", true, true, true); break;
+            case opcode::vreduce_add: print_vector("vreduce.add", false, true, false); break;
+            case opcode::vreduce_min: print_vector("vreduce.min", false, true, false); break;
+            case opcode::vreduce_max: print_vector("vreduce.max", false, true, false); break;
+
+            case opcode::memcompare: {
+                auto res = bytecode[i++];
+                auto lhs = bytecode[i++];
+                auto rhs = bytecode[i++];
+                auto size = bytecode[i++];
+                result += fmt::format(fg(red), " {:02x} {:02x} {:02x} {:02x}", res, lhs, rhs, size);
+                padding(5);
+                result += fmt::format(" {} {}{} {}{} {}{} {}\n", styled("memcmp", fg(yellow)), reg_str(res), comma, reg_str(lhs), comma, reg_str(rhs), comma, reg_str(size));
+            } break;
         }
     }
 
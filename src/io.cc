@@ -0,0 +1,427 @@
+#include <algorithm>
+#include <cstring>
+#include <interpreter/executor.hh>
+#include <interpreter/io.hh>
+
+#ifndef _WIN32
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+#ifdef __linux__
+#    include <linux/io_uring.h>
+#    include <sys/mman.h>
+#    include <sys/syscall.h>
+#endif
+
+/// ===========================================================================
+///  io_uring.
+/// ===========================================================================
+#ifdef __linux__
+namespace {
+/// user_data of entries that cancel an operation. Operations are aligned,
+/// so this never collides with one.
+constexpr interp::u64 cancel_tag = 1;
+
+/// Access a value shared with the kernel.
+template <typename t>
+auto shared(t* p) { return std::atomic_ref<t>(*p); }
+
+int io_uring_enter(int fd, interp::u32 to_submit, interp::u32 min_complete, interp::u32 flags) {
+    return int(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+} // namespace
+
+struct interp::io_service::ring {
+    int fd = -1;
+    u32 entries{};
+
+    /// Mappings of the submission queue, completion queue, and submission entries.
+    void* sq_ptr = MAP_FAILED;
+    void* cq_ptr = MAP_FAILED;
+    void* sqe_ptr = MAP_FAILED;
+    usz sq_size{}, cq_size{}, sqe_size{};
+
+    u32* sq_head{};
+    u32* sq_tail{};
+    u32* sq_mask{};
+    u32* sq_array{};
+    io_uring_sqe* sqes{};
+
+    u32* cq_head{};
+    u32* cq_tail{};
+    u32* cq_mask{};
+    io_uring_cqe* cqes{};
+
+    /// Only one thread at a time may fill in entries.
+    std::mutex mutex;
+
+    /// Entries that have been filled in, but not handed to the kernel.
+    u32 unsubmitted{};
+    u32 local_tail{};
+
+    /// Set up a ring. Returns false if io_uring isn’t available.
+    bool init(u32 depth);
+
+    /// Get an entry to fill in, handing queued entries to the kernel if
+    /// the queue is full. Must be called with the lock held.
+    io_uring_sqe& next();
+
+    /// Hand queued entries to the kernel. Must be called with the lock held.
+    void submit();
+
+    ~ring() noexcept;
+};
+
+bool interp::io_service::ring::init(u32 depth) {
+    io_uring_params p{};
+    fd = int(syscall(__NR_io_uring_setup, depth, &p));
+    if (fd < 0) return false;
+    entries = p.sq_entries;
+
+    /// Map the rings. Newer kernels put both queues in one mapping.
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(u32);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) sq_size = cq_size = std::max(sq_size, cq_size);
+    sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) return false;
+    if (single) cq_ptr = sq_ptr;
+    else {
+        cq_ptr = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) return false;
+    }
+
+    sqe_size = p.sq_entries * sizeof(io_uring_sqe);
+    sqe_ptr = mmap(nullptr, sqe_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqe_ptr == MAP_FAILED) return false;
+
+    auto sq = static_cast<char*>(sq_ptr);
+    auto cq = static_cast<char*>(cq_ptr);
+    sq_head = reinterpret_cast<u32*>(sq + p.sq_off.head);
+    sq_tail = reinterpret_cast<u32*>(sq + p.sq_off.tail);
+    sq_mask = reinterpret_cast<u32*>(sq + p.sq_off.ring_mask);
+    sq_array = reinterpret_cast<u32*>(sq + p.sq_off.array);
+    sqes = static_cast<io_uring_sqe*>(sqe_ptr);
+    cq_head = reinterpret_cast<u32*>(cq + p.cq_off.head);
+    cq_tail = reinterpret_cast<u32*>(cq + p.cq_off.tail);
+    cq_mask = reinterpret_cast<u32*>(cq + p.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+    local_tail = shared(sq_tail).load(std::memory_order_relaxed);
+    return true;
+}
+
+interp::io_service::ring::~ring() noexcept {
+    if (sqe_ptr != MAP_FAILED) munmap(sqe_ptr, sqe_size);
+    if (cq_ptr != MAP_FAILED and cq_ptr != sq_ptr) munmap(cq_ptr, cq_size);
+    if (sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_size);
+    if (fd >= 0) close(fd);
+}
+
+auto interp::io_service::ring::next() -> io_uring_sqe& {
+    /// The kernel consumes everything we submit, so this makes room.
+    if (local_tail - shared(sq_head).load(std::memory_order_acquire) == entries) submit();
+
+    auto idx = local_tail & *sq_mask;
+    auto& sqe = sqes[idx];
+    std::memset(&sqe, 0, sizeof sqe);
+    sq_array[idx] = idx;
+    local_tail++;
+    unsubmitted++;
+    return sqe;
+}
+
+void interp::io_service::ring::submit() {
+    /// Publish the new entries.
+    shared(sq_tail).store(local_tail, std::memory_order_release);
+
+    /// Without SQPOLL, the kernel consumes entries during the call.
+    while (unsubmitted) {
+        auto n = io_uring_enter(fd, unsubmitted, 0, 0);
+        if (n < 0) {
+            if (errno == EINTR or errno == EAGAIN or errno == EBUSY) continue;
+            throw error("io_uring_enter failed: {}", std::strerror(errno));
+        }
+
+        unsubmitted -= u32(n);
+    }
+}
+#else
+struct interp::io_service::ring {};
+#endif
+
+/// ===========================================================================
+///  Service.
+/// ===========================================================================
+interp::io_service::io_service(backend b, u32 queue_depth, usz threads) : kind(b) {
+#ifdef _WIN32
+    throw error("Asynchronous I/O is not supported on this platform");
+#endif
+
+#ifdef __linux__
+    if (kind != backend::threads) {
+        uring = std::make_unique<ring>();
+        if (uring->init(std::max<u32>(queue_depth, 1))) {
+            kind = backend::io_uring;
+            pool = std::make_unique<executor>(threads);
+            reaper = std::thread([this] { reap(); });
+            return;
+        }
+
+        if (kind == backend::io_uring) throw error("io_uring is not available: {}", std::strerror(errno));
+        uring.reset();
+    }
+#else
+    if (kind == backend::io_uring) throw error("io_uring is not available on this platform");
+#endif
+
+    kind = backend::threads;
+    pool = std::make_unique<executor>(threads);
+}
+
+interp::io_service::~io_service() noexcept {
+#ifdef __linux__
+    /// Stop the reaper once everything before it is done.
+    if (uring) {
+        try {
+            std::unique_lock _{uring->mutex};
+            auto& sqe = uring->next();
+            sqe.opcode = IORING_OP_NOP;
+            sqe.flags = IOSQE_IO_DRAIN;
+            sqe.user_data = 0;
+            uring->submit();
+        } catch (const std::exception&) {
+            std::terminate();
+        }
+
+        reaper.join();
+    }
+#endif
+
+    /// Finish the blocking calls and resumptions while everything they
+    /// use is still there. No more are added once the reaper is gone.
+    pool.reset();
+}
+
+void interp::io_service::complete(const operation* o, i64 result) {
+    std::shared_ptr<operation> op;
+    {
+        std::unique_lock _{ops_mutex};
+        auto it = in_flight.find(o);
+        if (it == in_flight.end()) return;
+        op = std::move(it->second);
+        in_flight.erase(it);
+    }
+
+    /// If someone is already waiting, it’s our job to wake them up, unless
+    /// the operation has been cancelled. Do that on the pool so that we
+    /// don’t run the rest of the coroutine on the reaper.
+    const auto settle = [](operation& settled_op) {
+        settled_op.settled.store(true, std::memory_order_release);
+        settled_op.settled.notify_all();
+    };
+
+    op->result = result;
+    if (op->state.exchange(operation::done, std::memory_order_acq_rel) != operation::awaited) return settle(*op);
+    pool->post([op = std::move(op), settle] {
+        op->waiter.resume();
+        settle(*op);
+    });
+}
+
+bool interp::io_service::completion::await_suspend(std::coroutine_handle<> h) {
+    op->waiter = h;
+    auto st = operation::pending;
+    return op->state.compare_exchange_strong(st, operation::awaited, std::memory_order_acq_rel);
+}
+
+void interp::io_service::reap() {
+#ifdef __linux__
+    auto& r = *uring;
+    for (;;) {
+        if (io_uring_enter(r.fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 and errno != EINTR) std::terminate();
+
+        /// Only we consume completions.
+        auto head = shared(r.cq_head).load(std::memory_order_relaxed);
+        auto tail = shared(r.cq_tail).load(std::memory_order_acquire);
+        bool stop = false;
+        for (; head != tail; head++) {
+            auto& cqe = r.cqes[head & *r.cq_mask];
+            if (cqe.user_data == 0) stop = true;
+            else if (cqe.user_data != cancel_tag) complete(reinterpret_cast<const operation*>(cqe.user_data), cqe.res);
+        }
+
+        shared(r.cq_head).store(head, std::memory_order_release);
+        if (stop) return;
+    }
+#endif
+}
+
+auto interp::io_service::submit(bool write, int fd, u8* data, usz size, i64 offset, const context* owner) -> word {
+    auto op = std::make_shared<operation>();
+    op->owner = owner;
+    word ticket;
+    {
+        std::unique_lock _{ops_mutex};
+        ticket = next_ticket++;
+        ops.emplace(ticket, op);
+        in_flight.emplace(op.get(), op);
+    }
+
+#ifdef __linux__
+    if (uring) {
+        std::unique_lock _{uring->mutex};
+        auto& sqe = uring->next();
+        sqe.opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<u64>(data);
+        sqe.len = u32(std::min<usz>(size, std::numeric_limits<u32>::max()));
+        sqe.off = u64(offset);
+        sqe.user_data = reinterpret_cast<u64>(op.get());
+        return ticket;
+    }
+#endif
+
+#ifndef _WIN32
+    /// Only start blocking calls that are sure to return.
+    struct stat st {};
+    if (fstat(fd, &st) != 0) {
+        complete(op.get(), -i64(errno));
+        return ticket;
+    }
+
+    if (not S_ISREG(st.st_mode) and not S_ISBLK(st.st_mode)) {
+        complete(op.get(), -i64(EOPNOTSUPP));
+        return ticket;
+    }
+
+    pool->post([this, op = op.get(), write, fd, data, size, offset] {
+        ssize_t n;
+        if (offset < 0) n = write ? ::write(fd, data, size) : ::read(fd, data, size);
+        else n = write ? pwrite(fd, data, size, offset) : pread(fd, data, size, offset);
+        complete(op, n < 0 ? -i64(errno) : i64(n));
+    });
+#endif
+
+    return ticket;
+}
+
+auto interp::io_service::submit_read(int fd, std::span<u8> buffer, i64 offset, const context* owner) -> word {
+    return submit(false, fd, buffer.data(), buffer.size(), offset, owner);
+}
+
+auto interp::io_service::submit_write(int fd, std::span<const u8> buffer, i64 offset, const context* owner) -> word {
+    return submit(true, fd, const_cast<u8*>(buffer.data()), buffer.size(), offset, owner);
+}
+
+void interp::io_service::flush() {
+#ifdef __linux__
+    if (not uring) return;
+    std::unique_lock _{uring->mutex};
+    if (uring->unsubmitted) uring->submit();
+#endif
+}
+
+auto interp::io_service::wait(word ticket, const context* owner) -> completion {
+    flush();
+    std::unique_lock _{ops_mutex};
+    auto it = ops.find(ticket);
+    if (it == ops.end() or (owner and it->second->owner != owner)) throw error("Invalid I/O ticket {}", ticket);
+    completion c{std::move(it->second)};
+    ops.erase(it);
+    return c;
+}
+
+void interp::io_service::cancel(const context& owner) {
+    std::vector<std::shared_ptr<operation>> cancelled;
+    {
+        std::unique_lock _{ops_mutex};
+        std::erase_if(ops, [&](auto& entry) { return entry.second->owner == &owner; });
+        for (auto& entry : in_flight)
+            if (entry.second->owner == &owner) cancelled.push_back(entry.second);
+    }
+
+    if (cancelled.empty()) return;
+
+    /// Make sure no one is resumed anymore. An operation that is already
+    /// done may still be resuming its waiter, so wait for it below.
+    for (auto& op : cancelled) {
+        auto st = op->state.load(std::memory_order_acquire);
+        while (st != operation::done and not op->state.compare_exchange_weak(st, operation::abandoned, std::memory_order_acq_rel)) {}
+    }
+
+#ifdef __linux__
+    /// Ask the kernel to stop. Operations that are still queued are handed
+    /// to it first, so it knows about every one of them.
+    if (uring) {
+        std::unique_lock _{uring->mutex};
+        for (auto& op : cancelled) {
+            auto& sqe = uring->next();
+            sqe.opcode = IORING_OP_ASYNC_CANCEL;
+            sqe.addr = reinterpret_cast<u64>(op.get());
+            sqe.user_data = cancel_tag;
+        }
+
+        uring->submit();
+    }
+#endif
+
+    for (auto& op : cancelled) op->settled.wait(false, std::memory_order_acquire);
+}
+
+void interp::context::use_io(const std::shared_ptr<io_service>& io) {
+    if (std::ranges::find(io_services, io) == io_services.end()) io_services.push_back(io);
+}
+
+/// ===========================================================================
+///  Guest API.
+/// ===========================================================================
+auto interp::context::attach_file(int fd) -> word {
+    if (fd < 0) throw error("Cannot attach invalid file descriptor {}", fd);
+    files.push_back(fd);
+    return files.size();
+}
+
+int interp::context::attached_file(word handle) const {
+    if (handle == 0 or handle > files.size()) throw error("Invalid file handle {}", handle);
+    return files[handle - 1];
+}
+
+void interp::module::defun_io(std::shared_ptr<io_service> io) {
+    if (not io) throw error("I/O service must not be null");
+
+    /// Arguments of a read or write: file, buffer, size, offset. Guests
+    /// only get to use the descriptors the host has attached.
+    const auto buffer = [](context& c) { return c.memory(static_cast<ptr>(c.arg(1, INTERP_SIZE_MASK_64)), c.arg(2, INTERP_SIZE_MASK_64)); };
+    const auto fd = [](context& c) { return c.attached_file(c.arg(0, INTERP_SIZE_MASK_64)); };
+    const auto offset = [](context& c) { return i64(c.arg(3, INTERP_SIZE_MASK_64)); };
+
+    /// Operations are tied to the context so that they can be cancelled
+    /// before its memory is reused.
+    defun("io.submit_read", [=](context& c) {
+        c.use_io(io);
+        c.set_return_value(io->submit_read(fd(c), buffer(c), offset(c), &c));
+    });
+
+    defun("io.submit_write", [=](context& c) {
+        c.use_io(io);
+        c.set_return_value(io->submit_write(fd(c), buffer(c), offset(c), &c));
+    });
+
+    defun("io.wait", [io](context& c) -> task {
+        auto res = co_await io->wait(c.arg(0, INTERP_SIZE_MASK_64), &c);
+        c.set_return_value(word(res));
+    });
+
+    defun("io.read", [=](context& c) -> task {
+        c.use_io(io);
+        auto res = co_await io->wait(io->submit_read(fd(c), buffer(c), offset(c), &c), &c);
+        c.set_return_value(word(res));
+    });
+
+    defun("io.write", [=](context& c) -> task {
+        c.use_io(io);
+        auto res = co_await io->wait(io->submit_write(fd(c), buffer(c), offset(c), &c), &c);
+        c.set_return_value(word(res));
+    });
+}
@@ -0,0 +1,131 @@
+#include <cstring>
+#include <interpreter/interp.hh>
+#include <utility>
+
+#ifndef _WIN32
+#    include <sys/mman.h>
+#else
+#    include <windows.h>
+#endif
+
+using namespace interp::integers;
+
+namespace {
+/// Map zeroed memory.
+u8* map(usz size) {
+#ifndef _WIN32
+    auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) throw interp::error("Failed to map {} bytes of memory: {}", size, std::strerror(errno));
+#else
+    auto p = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (not p) throw interp::error("Failed to map {} bytes of memory: {}", size, GetLastError());
+#endif
+    return static_cast<u8*>(p);
+}
+
+/// Unmap memory.
+void unmap(u8* data, usz size) {
+    if (not data) return;
+#ifndef _WIN32
+    munmap(data, size);
+#else
+    VirtualFree(data, 0, MEM_RELEASE);
+#endif
+}
+} // namespace
+
+interp::guest_memory::guest_memory(guest_memory&& other) noexcept
+    : _data_(std::exchange(other._data_, nullptr)),
+      _size_(std::exchange(other._size_, 0)),
+      _file_backed_(std::exchange(other._file_backed_, false)),
+      _owned_(std::exchange(other._owned_, true)) {}
+
+auto interp::guest_memory::operator=(guest_memory&& other) noexcept -> guest_memory& {
+    if (this == &other) return *this;
+    if (_owned_) unmap(_data_, _size_);
+    _data_ = std::exchange(other._data_, nullptr);
+    _size_ = std::exchange(other._size_, 0);
+    _file_backed_ = std::exchange(other._file_backed_, false);
+    _owned_ = std::exchange(other._owned_, true);
+    return *this;
+}
+
+interp::guest_memory::~guest_memory() noexcept {
+    if (_owned_) unmap(_data_, _size_);
+}
+
+auto interp::guest_memory::alias(const guest_memory& other) -> guest_memory {
+    guest_memory m;
+    m._data_ = other._data_;
+    m._size_ = other._size_;
+    m._file_backed_ = other._file_backed_;
+    m._owned_ = false;
+    return m;
+}
+
+void interp::guest_memory::resize(usz new_size) {
+    if (new_size == _size_) return;
+    if (not _owned_) throw error("Cannot resize memory that belongs to another context");
+
+    /// Free the memory.
+    if (not new_size) {
+        unmap(_data_, _size_);
+        _data_ = nullptr;
+        _size_ = 0;
+        _file_backed_ = false;
+        return;
+    }
+
+    /// A new mapping would lose the file, and resetting the memory would
+    /// zero it instead of restoring the file’s contents.
+    if (_file_backed_) throw error("Cannot resize memory that is mapped from a file");
+
+    /// Nothing to preserve.
+    if (not _data_) {
+        _data_ = map(new_size);
+        _size_ = new_size;
+        return;
+    }
+
+#ifdef __linux__
+    /// Let the kernel move the pages for us.
+    auto p = mremap(_data_, _size_, new_size, MREMAP_MAYMOVE);
+    if (p == MAP_FAILED) throw error("Failed to map {} bytes of memory: {}", new_size, std::strerror(errno));
+    _data_ = static_cast<u8*>(p);
+#else
+    auto p = map(new_size);
+    std::memcpy(p, _data_, std::min(_size_, new_size));
+    unmap(_data_, _size_);
+    _data_ = p;
+#endif
+    _size_ = new_size;
+}
+
+void interp::guest_memory::map_private(int fd, usz new_size) {
+#ifndef _WIN32
+    auto p = mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+    if (p == MAP_FAILED) throw error("Failed to map {} bytes of memory: {}", new_size, std::strerror(errno));
+    if (_owned_) unmap(_data_, _size_);
+    _data_ = static_cast<u8*>(p);
+    _size_ = new_size;
+    _file_backed_ = true;
+    _owned_ = true;
+#else
+    throw error("Mapping files is not supported on this platform");
+#endif
+}
+
+void interp::guest_memory::reset() {
+    if (not _data_ or not _owned_) return;
+
+    /// Dropping the pages of a private mapping zeroes them, or, for a file
+    /// mapping, reverts them to the contents of the file. This only costs
+    /// anything for pages that are actually resident.
+#ifndef _WIN32
+    if (madvise(_data_, _size_, MADV_DONTNEED) != 0) std::memset(_data_, 0, _size_);
+#else
+    VirtualFree(_data_, _size_, MEM_DECOMMIT);
+    if (not VirtualAlloc(_data_, _size_, MEM_COMMIT, PAGE_READWRITE))
+        throw error("Failed to map {} bytes of memory: {}", _size_, GetLastError());
+#endif
+}
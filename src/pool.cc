@@ -0,0 +1,86 @@
+#include <interpreter/pool.hh>
+#include <interpreter/snapshot.hh>
+
+interp::context_pool::context_pool(const module& m, usz max_idle_contexts)
+    : create([&m] { return std::make_unique<context>(m); }),
+      max_idle(max_idle_contexts) {}
+
+interp::context_pool::context_pool(const snapshot& s, usz max_idle_contexts)
+    : create([&s] { return s.spawn(); }),
+      max_idle(max_idle_contexts) {}
+
+auto interp::context_pool::acquire() -> lease {
+    std::unique_lock lock{mutex};
+    stats.acquired++;
+    stats.in_use++;
+
+    /// Reuse an idle context if there is one.
+    if (not idle.empty()) {
+        auto ctx = std::move(idle.back());
+        idle.pop_back();
+        stats.idle = idle.size();
+        return {this, std::move(ctx)};
+    }
+
+    /// Otherwise, create a new one. Don’t hold the lock while doing so.
+    stats.created++;
+    lock.unlock();
+    return {this, create()};
+}
+
+void interp::context_pool::reserve(usz count) {
+    std::unique_lock lock{mutex};
+    if (idle.size() >= count) return;
+    auto missing = count - idle.size();
+
+    /// Don’t hold the lock while creating the contexts.
+    lock.unlock();
+    std::vector<std::unique_ptr<context>> created;
+    created.reserve(missing);
+    while (created.size() < missing) created.push_back(create());
+
+    lock.lock();
+    stats.created += missing;
+    for (auto& ctx : created) idle.push_back(std::move(ctx));
+    stats.idle = idle.size();
+}
+
+auto interp::context_pool::get_metrics() const -> metrics {
+    std::unique_lock _{mutex};
+    return stats;
+}
+
+void interp::context_pool::release(std::unique_ptr<context> ctx) noexcept {
+    /// Reset the context outside the lock.
+    auto start = std::chrono::steady_clock::now();
+    try {
+        ctx->reset();
+    } catch (const std::exception&) {
+        ctx.reset();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    std::unique_lock _{mutex};
+    stats.released++;
+    stats.in_use--;
+    stats.reset_time += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+    if (not ctx or idle.size() >= max_idle) {
+        stats.discarded++;
+        return;
+    }
+
+    idle.push_back(std::move(ctx));
+    stats.idle = idle.size();
+}
+
+auto interp::context_pool::lease::operator=(lease&& other) noexcept -> lease& {
+    if (this == &other) return *this;
+    if (ctx) pool->release(std::move(ctx));
+    pool = other.pool;
+    ctx = std::move(other.ctx);
+    return *this;
+}
+
+interp::context_pool::lease::~lease() noexcept {
+    if (ctx) pool->release(std::move(ctx));
+}
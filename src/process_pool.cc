@@ -0,0 +1,695 @@
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <ranges>
+#include <interpreter/process_pool.hh>
+
+#ifdef __linux__
+#    include <fcntl.h>
+#    include <poll.h>
+#    include <sys/eventfd.h>
+#    include <sys/mman.h>
+#    include <sys/socket.h>
+#    include <sys/wait.h>
+#    include <unistd.h>
+#endif
+
+using namespace interp::integers;
+
+/// ===========================================================================
+///  Framing.
+/// ===========================================================================
+/// A frame is a header of two u32s, the size of the payload and the number
+/// of records in it, followed by the payload. Both ends run on the same
+/// machine, so everything is in host byte order.
+///
+/// A request record is the index of a function, the number of arguments,
+/// and the arguments. A response record is a status, followed by the
+/// return value if the status is 0, or by an error message otherwise.
+/// Responses are sent in the order of the requests.
+namespace {
+struct frame_header {
+    u32 size;
+    u32 count;
+};
+
+/// Error messages are cut off so that a frame of responses stays small.
+constexpr usz max_error_size = 1024;
+
+struct frame_builder {
+    std::vector<u8> buf;
+    u32 count{};
+
+    frame_builder() { buf.resize(sizeof(frame_header)); }
+
+    void put(const void* data, usz size) {
+        auto p = static_cast<const u8*>(data);
+        buf.insert(buf.end(), p, p + size);
+    }
+
+    void put(u64 value) { put(&value, sizeof value); }
+
+    /// Fill in the header and get the frame.
+    std::span<const u8> finish() {
+        frame_header h{u32(buf.size() - sizeof(frame_header)), count};
+        std::memcpy(buf.data(), &h, sizeof h);
+        return buf;
+    }
+};
+
+struct frame_parser {
+    std::span<const u8> payload;
+    usz pos{};
+
+    u64 get() {
+        if (payload.size() - pos < sizeof(u64)) throw interp::error("Malformed frame");
+        u64 value;
+        std::memcpy(&value, payload.data() + pos, sizeof value);
+        pos += sizeof value;
+        return value;
+    }
+
+    std::span<const u8> get(usz size) {
+        if (payload.size() - pos < size) throw interp::error("Malformed frame");
+        auto s = payload.subspan(pos, size);
+        pos += size;
+        return s;
+    }
+};
+
+#ifdef __linux__
+/// Send all of a buffer. Returns false if the other end is gone.
+bool send_all(int fd, std::span<const u8> data) {
+    while (not data.empty()) {
+        auto n = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data = data.subspan(usz(n));
+    }
+    return true;
+}
+
+/// Read exactly `size` bytes. Returns false on end of file or error.
+bool read_all(int fd, u8* data, usz size) {
+    while (size) {
+        auto n = ::read(fd, data, size);
+        if (n < 0 and errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= usz(n);
+    }
+    return true;
+}
+
+/// Main loop of a worker process.
+[[noreturn]] void worker_main(
+    int fd,
+    interp::module& m,
+    std::atomic<u64>& started,
+    const interp::process_pool::setup_function& setup
+) {
+    int status = 0;
+    try {
+        if (setup) setup(m);
+        interp::context ctx{m};
+
+        std::vector<u8> payload;
+        std::vector<interp::word> args;
+        u64 runs = 0;
+        for (;;) {
+            frame_header h;
+            if (not read_all(fd, reinterpret_cast<u8*>(&h), sizeof h)) break;
+            payload.resize(h.size);
+            if (not read_all(fd, payload.data(), payload.size())) break;
+
+            frame_parser in{payload};
+            frame_builder out;
+            for (u32 i = 0; i < h.count; i++) {
+                auto function = usz(in.get());
+                args.resize(usz(in.get()));
+                for (auto& a : args) a = in.get();
+                started.store(++runs, std::memory_order_relaxed);
+
+                try {
+                    auto value = ctx.run(function, args);
+                    out.put(0);
+                    out.put(value);
+                } catch (const std::exception& e) {
+                    std::string_view msg = e.what();
+                    msg = msg.substr(0, max_error_size);
+                    out.put(1);
+                    out.put(msg.size());
+                    out.put(msg.data(), msg.size());
+                }
+
+                out.count++;
+                ctx.reset();
+            }
+
+            if (not send_all(fd, out.finish())) break;
+        }
+    } catch (...) {
+        status = 1;
+    }
+
+    /// Don’t run the destructors and atexit handlers of the host.
+    _exit(status);
+}
+
+/// Requests to the helper process, and its replies. The reply to a spawn
+/// request carries the host’s end of the socket of the new worker.
+struct helper_request {
+    enum : u64 { spawn, reap } kind;
+
+    /// Index of the worker to spawn, or pid of the worker to reap.
+    u64 value;
+};
+
+struct helper_reply {
+    /// Pid of the new worker, or exit status of the reaped one.
+    i64 value;
+
+    /// An errno value if the request failed.
+    i64 error;
+};
+
+bool send_reply(int fd, helper_reply r, int passed_fd = -1) {
+    iovec iov{&r, sizeof r};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+    if (passed_fd >= 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof control;
+        auto cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), &passed_fd, sizeof(int));
+    }
+
+    while (sendmsg(fd, &msg, MSG_NOSIGNAL) < 0)
+        if (errno != EINTR) return false;
+    return true;
+}
+
+/// Receive a reply, and the descriptor passed with it, if any.
+std::optional<helper_reply> receive_reply(int fd, int& passed_fd) {
+    helper_reply r{};
+    iovec iov{&r, sizeof r};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+
+    passed_fd = -1;
+    isz n;
+    while ((n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) < 0)
+        if (errno != EINTR) return std::nullopt;
+    if (usz(n) != sizeof r) return std::nullopt;
+
+    if (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg and cmsg->cmsg_level == SOL_SOCKET and cmsg->cmsg_type == SCM_RIGHTS)
+        std::memcpy(&passed_fd, CMSG_DATA(cmsg), sizeof(int));
+    return r;
+}
+
+/// Main loop of the helper process. It loads the module once, and every
+/// worker starts out with a copy of it.
+[[noreturn]] void helper_main(
+    int fd,
+    int image_fd,
+    usz image_size,
+    void* counters,
+    usz workers,
+    const interp::process_pool::setup_function& setup
+) {
+    interp::module m;
+    try {
+        auto image = mmap(nullptr, image_size, PROT_READ, MAP_SHARED, image_fd, 0);
+        if (image == MAP_FAILED) throw interp::error("Failed to map module image: {}", std::strerror(errno));
+        m.deserialize({static_cast<const u8*>(image), image_size});
+        munmap(image, image_size);
+        close(image_fd);
+    } catch (...) {
+        send_reply(fd, {0, EINVAL});
+        _exit(1);
+    }
+
+    /// Tell the host we’re ready.
+    if (not send_reply(fd, {0, 0})) _exit(1);
+
+    for (;;) {
+        helper_request r;
+        auto n = recv(fd, &r, sizeof r, 0);
+        if (n < 0 and errno == EINTR) continue;
+        if (n != sizeof r) break;
+
+        if (r.kind == helper_request::reap) {
+            int status = 0;
+            while (waitpid(pid_t(r.value), &status, 0) < 0 and errno == EINTR) {}
+            send_reply(fd, {status, 0});
+            continue;
+        }
+
+        if (r.value >= workers) {
+            send_reply(fd, {-1, EINVAL});
+            continue;
+        }
+
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+            send_reply(fd, {-1, errno});
+            continue;
+        }
+
+        auto pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            close(fd);
+            auto started = reinterpret_cast<std::atomic<u64>*>(static_cast<u8*>(counters) + r.value * 64);
+            worker_main(fds[1], m, *started, setup);
+        }
+
+        auto err = errno;
+        close(fds[1]);
+        if (pid < 0) send_reply(fd, {-1, err});
+        else send_reply(fd, {pid, 0}, fds[0]);
+        close(fds[0]);
+    }
+
+    /// The host is gone. Workers exit once their sockets are closed.
+    while (wait(nullptr) > 0 or errno == EINTR) {}
+    _exit(0);
+}
+#endif
+} // namespace
+
+/// ===========================================================================
+///  Pool.
+/// ===========================================================================
+interp::process_pool::process_pool(const module& m, usz processes, setup_function setup_fn, usz batch)
+    : setup(std::move(setup_fn)), max_batch(std::max<usz>(batch, 1)) {
+#ifdef __linux__
+    /// Write the image to a file that no one can change afterwards.
+    auto image = m.serialize();
+    image_size = image.size();
+    image_fd = memfd_create("interp-module", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (image_fd < 0) throw error("Failed to create module image: {}", std::strerror(errno));
+    for (usz written = 0; written < image.size();) {
+        auto n = pwrite(image_fd, image.data() + written, image.size() - written, off_t(written));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            close(image_fd);
+            throw error("Failed to create module image: {}", std::strerror(errno));
+        }
+        written += usz(n);
+    }
+    if (fcntl(image_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+        close(image_fd);
+        throw error("Failed to seal module image: {}", std::strerror(errno));
+    }
+
+    /// Load the module here, too, both to look up functions and to find
+    /// problems with the image or the setup function before forking.
+    try {
+        loaded.deserialize(image);
+        if (setup) setup(loaded);
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wake_fd < 0) throw error("Failed to create eventfd: {}", std::strerror(errno));
+
+        /// One counter per cache line.
+        workers = std::vector<worker>(std::max<usz>(processes, 1));
+        counters_size = workers.size() * 64;
+        counters = mmap(nullptr, counters_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (counters == MAP_FAILED) {
+            counters = nullptr;
+            throw error("Failed to map shared memory: {}", std::strerror(errno));
+        }
+
+        for (usz i = 0; i < workers.size(); i++)
+            workers[i].started = new (static_cast<u8*>(counters) + i * 64) std::atomic<u64>{};
+
+        start_helper();
+        for (auto& w : workers) spawn(w);
+    } catch (...) {
+        for (auto& w : workers)
+            if (w.fd >= 0) close(w.fd);
+        if (helper_fd >= 0) close(helper_fd);
+        if (helper_pid > 0) waitpid(helper_pid, nullptr, 0);
+        if (counters) munmap(counters, counters_size);
+        if (wake_fd >= 0) close(wake_fd);
+        close(image_fd);
+        throw;
+    }
+
+    dispatcher = std::thread{[this] { run_dispatcher(); }};
+#else
+    throw error("Process pools are not supported on this platform");
+#endif
+}
+
+interp::process_pool::~process_pool() noexcept {
+#ifdef __linux__
+    {
+        std::unique_lock _{mutex};
+        stopping = true;
+    }
+
+    u64 one = 1;
+    [[maybe_unused]] auto _ = write(wake_fd, &one, sizeof one);
+    if (dispatcher.joinable()) dispatcher.join();
+
+    /// Workers exit once their socket is closed, and the helper process
+    /// once it has waited for them and its socket is closed.
+    for (auto& w : workers)
+        if (w.fd >= 0) close(w.fd);
+    close(helper_fd);
+    waitpid(helper_pid, nullptr, 0);
+
+    munmap(counters, counters_size);
+    close(wake_fd);
+    close(image_fd);
+#endif
+}
+
+void interp::process_pool::start_helper() {
+#ifdef __linux__
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0)
+        throw error("Failed to create socket: {}", std::strerror(errno));
+
+    auto pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        throw error("Failed to start helper process: {}", std::strerror(errno));
+    }
+
+    if (pid == 0) {
+        close(fds[0]);
+        helper_main(fds[1], image_fd, image_size, counters, workers.size(), setup);
+    }
+
+    close(fds[1]);
+    helper_pid = pid;
+    helper_fd = fds[0];
+
+    int unused;
+    auto ready = receive_reply(helper_fd, unused);
+    if (not ready or ready->error) throw error("Helper process failed to load the module");
+#endif
+}
+
+void interp::process_pool::spawn(worker& w) {
+#ifdef __linux__
+    w.started->store(0, std::memory_order_relaxed);
+    helper_request r{helper_request::spawn, u64(&w - workers.data())};
+    if (send(helper_fd, &r, sizeof r, MSG_NOSIGNAL) != sizeof r)
+        throw error("Failed to start worker: helper process is gone");
+
+    int fd;
+    auto reply = receive_reply(helper_fd, fd);
+    if (not reply) throw error("Failed to start worker: helper process is gone");
+    if (reply->error) throw error("Failed to start worker: {}", std::strerror(int(reply->error)));
+    if (fd < 0) throw error("Failed to start worker: no socket");
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    w.pid = int(reply->value);
+    w.fd = fd;
+    w.received.clear();
+    w.outgoing.clear();
+    w.answered = 0;
+#endif
+}
+
+int interp::process_pool::reap(worker& w) {
+#ifdef __linux__
+    helper_request r{helper_request::reap, u64(w.pid)};
+    int fd;
+    if (send(helper_fd, &r, sizeof r, MSG_NOSIGNAL) != sizeof r) return -1;
+    auto reply = receive_reply(helper_fd, fd);
+    if (fd >= 0) close(fd);
+    return reply ? int(reply->value) : -1;
+#else
+    return -1;
+#endif
+}
+
+auto interp::process_pool::submit(const std::string& function, std::vector<word> args) -> std::future<word> {
+    auto it = loaded.functions_map.find(function);
+    if (it == loaded.functions_map.end() or not std::holds_alternative<addr>(loaded.functions[it->second].address))
+        throw error("Cannot run function \"{}\"", function);
+    if (args.size() > register_count - 2) throw error("Too many arguments: {}", args.size());
+
+    job j{it->second, std::move(args), {}};
+    auto fut = j.result.get_future();
+    {
+        std::unique_lock _{mutex};
+        queue.push_back(std::move(j));
+        stats.submitted++;
+    }
+
+#ifdef __linux__
+    u64 one = 1;
+    [[maybe_unused]] auto _ = write(wake_fd, &one, sizeof one);
+#endif
+    return fut;
+}
+
+auto interp::process_pool::get_metrics() const -> metrics {
+    std::unique_lock _{mutex};
+    return stats;
+}
+
+void interp::process_pool::dispatch() {
+#ifdef __linux__
+    std::vector<std::pair<worker*, std::vector<job>>> batches;
+    {
+        std::unique_lock _{mutex};
+        if (queue.empty()) return;
+
+        /// Split the queue evenly between workers that have room, so a
+        /// burst of runs doesn’t all end up with the first worker.
+        const auto share = (queue.size() + workers.size() - 1) / workers.size();
+        for (auto& w : workers) {
+            if (w.fd < 0 or w.in_flight.size() >= max_batch) continue;
+            auto n = std::min({share, max_batch - w.in_flight.size(), queue.size()});
+            auto& b = batches.emplace_back(&w, std::vector<job>{}).second;
+            for (usz i = 0; i < n; i++) {
+                b.push_back(std::move(queue.front()));
+                queue.pop_front();
+            }
+            stats.batches++;
+            if (queue.empty()) break;
+        }
+    }
+
+    for (auto& [w, b] : batches) {
+        frame_builder out;
+        for (auto& j : b) {
+            out.put(j.function);
+            out.put(j.args.size());
+            for (auto a : j.args) out.put(a);
+            out.count++;
+        }
+
+        std::ranges::move(b, std::back_inserter(w->in_flight));
+        auto frame = out.finish();
+        w->outgoing.insert(w->outgoing.end(), frame.begin(), frame.end());
+
+        /// If the worker is gone, that is noticed when we next read from it.
+        flush(*w);
+    }
+#endif
+}
+
+bool interp::process_pool::flush(worker& w) {
+#ifdef __linux__
+    usz sent = 0;
+    while (sent < w.outgoing.size()) {
+        auto n = ::send(w.fd, w.outgoing.data() + sent, w.outgoing.size() - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) break;
+            return false;
+        }
+        sent += usz(n);
+    }
+
+    w.outgoing.erase(w.outgoing.begin(), w.outgoing.begin() + isz(sent));
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool interp::process_pool::collect(worker& w) {
+#ifdef __linux__
+    u8 buf[64 * 1024];
+    for (;;) {
+        auto n = read(w.fd, buf, sizeof buf);
+        if (n == 0) return false;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) break;
+            return false;
+        }
+        w.received.insert(w.received.end(), buf, buf + n);
+    }
+
+    /// Handle all complete frames. A run is only taken off the worker once
+    /// its record has been parsed, so that a malformed record leaves it to
+    /// replace(). Results are handed out once the statistics include them.
+    usz pos = 0;
+    std::vector<std::pair<std::promise<word>, word>> completed;
+    std::vector<std::pair<std::promise<word>, std::exception_ptr>> failed;
+    const auto parse = [&] {
+        while (w.received.size() - pos >= sizeof(frame_header)) {
+            frame_header h;
+            std::memcpy(&h, w.received.data() + pos, sizeof h);
+            if (w.received.size() - pos - sizeof h < h.size) break;
+
+            frame_parser in{std::span{w.received}.subspan(pos + sizeof h, h.size)};
+            for (u32 i = 0; i < h.count; i++) {
+                if (w.in_flight.empty()) return false;
+                auto& j = w.in_flight.front();
+                if (in.get() == 0) {
+                    auto value = in.get();
+                    completed.emplace_back(std::move(j.result), value);
+                } else {
+                    auto msg = in.get(usz(in.get()));
+                    failed.emplace_back(std::move(j.result), std::make_exception_ptr(error("{}", std::string_view{reinterpret_cast<const char*>(msg.data()), msg.size()})));
+                }
+
+                w.in_flight.pop_front();
+                w.answered++;
+            }
+
+            pos += sizeof h + h.size;
+        }
+
+        return true;
+    };
+
+    bool ok;
+    try {
+        ok = parse();
+    } catch (const std::exception&) {
+        ok = false;
+    }
+
+    if (ok) w.received.erase(w.received.begin(), w.received.begin() + isz(pos));
+    {
+        std::unique_lock _{mutex};
+        stats.completed += completed.size();
+        stats.failed += failed.size();
+    }
+
+    for (auto& [p, value] : completed) p.set_value(value);
+    for (auto& [p, e] : failed) p.set_exception(std::move(e));
+    return ok;
+#else
+    return false;
+#endif
+}
+
+void interp::process_pool::replace(worker& w) {
+#ifdef __linux__
+    close(w.fd);
+    w.fd = -1;
+    w.outgoing.clear();
+
+    /// The worker is a child of the helper process, so ask it how it died.
+    int status = reap(w);
+    std::string why = status < 0        ? std::string{"died"}
+                    : WIFSIGNALED(status) ? fmt::format("was killed by signal {} ({})", WTERMSIG(status), strsignal(WTERMSIG(status)))
+                                          : fmt::format("exited with status {}", WEXITSTATUS(status));
+
+    /// Runs before the one that killed the worker may have finished, but
+    /// their results are lost; run them again along with those that never
+    /// started.
+    auto started = w.started->load(std::memory_order_relaxed);
+    const usz culprit = started > w.answered ? usz(started - w.answered - 1) : usz(-1);
+    usz failed = 0, retried = 0;
+    std::vector<job> requeue;
+    for (usz i = 0; i < w.in_flight.size(); i++) {
+        auto& j = w.in_flight[i];
+        if (i == culprit) {
+            j.result.set_exception(std::make_exception_ptr(error("Worker process {} {}", w.pid, why)));
+            failed++;
+        } else {
+            requeue.push_back(std::move(j));
+            retried++;
+        }
+    }
+
+    w.in_flight.clear();
+    w.pid = -1;
+
+    {
+        std::unique_lock _{mutex};
+        for (auto& j : requeue | std::views::reverse) queue.push_front(std::move(j));
+        stats.failed += failed;
+        stats.retried += retried;
+        stats.respawned++;
+    }
+
+    /// If we can’t start a new worker, the others carry on without it.
+    try {
+        spawn(w);
+    } catch (const std::exception&) {}
+#endif
+}
+
+void interp::process_pool::run_dispatcher() {
+#ifdef __linux__
+    std::vector<pollfd> fds;
+    for (;;) {
+        dispatch();
+
+        {
+            std::unique_lock _{mutex};
+            auto idle = std::ranges::all_of(workers, [](auto& w) { return w.in_flight.empty(); });
+            auto alive = std::ranges::any_of(workers, [](auto& w) { return w.fd >= 0; });
+
+            /// Without workers, nothing queued can ever run.
+            if (not alive) {
+                for (auto& j : queue) j.result.set_exception(std::make_exception_ptr(error("No worker processes left")));
+                stats.failed += queue.size();
+                queue.clear();
+            }
+
+            if (stopping and idle and queue.empty()) return;
+        }
+
+        fds.clear();
+        fds.push_back({wake_fd, POLLIN, 0});
+        for (auto& w : workers)
+            if (w.fd >= 0) fds.push_back({w.fd, short(POLLIN | (w.outgoing.empty() ? 0 : POLLOUT)), 0});
+
+        if (poll(fds.data(), nfds_t(fds.size()), -1) < 0) continue;
+
+        if (fds[0].revents) {
+            u64 count;
+            [[maybe_unused]] auto _ = read(wake_fd, &count, sizeof count);
+        }
+
+        for (auto& w : workers) {
+            auto it = std::ranges::find(fds, w.fd, &pollfd::fd);
+            if (w.fd < 0 or it == fds.end() or not it->revents) continue;
+
+            /// Collect what the worker sent even if it is gone. A worker
+            /// that sends garbage is as good as dead.
+            bool sent = not (it->revents & POLLOUT) or flush(w);
+            bool alive = collect(w);
+            if (not sent or not alive) replace(w);
+        }
+    }
+#endif
+}
@@ -0,0 +1,237 @@
+#include <cstring>
+#include <interpreter/interp.hh>
+
+using namespace interp::integers;
+
+/// ===========================================================================
+///  Module images.
+/// ===========================================================================
+/// An image is a header followed by the bytecode, the functions, the names
+/// of the functions, and the try regions. All integers are stored as
+/// little-endian u64s, and strings are a length followed by the characters.
+namespace {
+constexpr char image_magic[8] = {'I', 'N', 'T', 'E', 'R', 'P', 'M', 'D'};
+constexpr u64 image_version = 1;
+
+/// Kinds of function entries.
+enum struct function_kind : u8 {
+    declared,
+    bytecode,
+    native,
+    library,
+};
+
+struct image_writer {
+    std::vector<u8> out;
+
+    void bytes(const void* data, usz size) {
+        auto p = static_cast<const u8*>(data);
+        out.insert(out.end(), p, p + size);
+    }
+
+    void number(u64 value) {
+        u8 buf[8];
+        for (usz i = 0; i < 8; i++) buf[i] = u8(value >> (8 * i));
+        bytes(buf, sizeof buf);
+    }
+
+    void string(const std::string& s) {
+        number(s.size());
+        bytes(s.data(), s.size());
+    }
+};
+
+struct image_reader {
+    std::span<const u8> in;
+    usz pos{};
+
+    const u8* bytes(usz size) {
+        if (size > in.size() - pos) throw interp::error("Invalid module image: unexpected end of data");
+        auto p = in.data() + pos;
+        pos += size;
+        return p;
+    }
+
+    u64 number() {
+        auto p = bytes(8);
+        u64 value = 0;
+        for (usz i = 0; i < 8; i++) value |= u64(p[i]) << (8 * i);
+        return value;
+    }
+
+    /// Read a count of things that take at least `min_size` bytes each, so
+    /// that a corrupt count can’t make us allocate absurd amounts of memory.
+    usz count(usz min_size) {
+        auto n = number();
+        if (n > (in.size() - pos) / min_size) throw interp::error("Invalid module image: bad count {}", n);
+        return usz(n);
+    }
+
+    std::string string() {
+        auto n = count(1);
+        auto p = bytes(n);
+        return {reinterpret_cast<const char*>(p), n};
+    }
+};
+} // namespace
+
+auto interp::module::serialize() const -> std::vector<u8> {
+    /// Make sure every label that is branched to is bound.
+    finalize();
+
+    image_writer w;
+    w.bytes(image_magic, sizeof image_magic);
+    w.number(image_version);
+    w.number(+gp);
+    w.number(max_memory);
+    w.number(indirect_call_sites);
+    w.number(spawns_threads);
+    w.number(has_indirect_branches);
+
+    w.number(bytecode.size());
+    w.bytes(bytecode.data(), bytecode.size());
+
+    /// Library functions only know their symbol, so find their libraries.
+    std::unordered_map<usz, const std::string*> library_paths;
+    for (auto& [path, lib] : libraries)
+        for (auto& [_, index] : lib.functions)
+            library_paths[index] = &path;
+
+    w.number(functions.size());
+    for (usz i = 0; i < functions.size(); i++) {
+        auto& f = functions[i];
+        w.number(f.locals_size);
+        if (auto a = std::get_if<addr>(&f.address)) {
+            w.number(u64(function_kind::bytecode));
+            w.number(*a);
+        } else if (auto l = std::get_if<library_function>(&f.address)) {
+            w.number(u64(function_kind::library));
+            w.string(*library_paths.at(i));
+            w.string(l->name);
+            w.number(l->num_params);
+        } else if (std::holds_alternative<native_function>(f.address)) {
+            w.number(u64(function_kind::native));
+        } else {
+            w.number(u64(function_kind::declared));
+        }
+    }
+
+    w.number(functions_map.size());
+    for (auto& [name, index] : functions_map) {
+        w.string(name);
+        w.number(index);
+    }
+
+    w.number(try_regions.size());
+    for (auto& r : try_regions) {
+        w.number(r.begin);
+        w.number(r.end);
+        w.number(r.handler);
+        w.number(r.function);
+    }
+
+    return std::move(w.out);
+}
+
+void interp::module::deserialize(std::span<const u8> image) {
+    image_reader r{image};
+    if (std::memcmp(r.bytes(sizeof image_magic), image_magic, sizeof image_magic) != 0)
+        throw error("Invalid module image: bad magic number");
+    if (auto v = r.number(); v != image_version)
+        throw error("Invalid module image: unsupported version {}", v);
+
+    /// Read everything before touching the module so that a bad image
+    /// leaves it as it was.
+    auto new_gp = static_cast<ptr>(r.number());
+    auto new_max_memory = usz(r.number());
+    auto new_call_sites = r.number();
+    auto new_spawns_threads = r.number() != 0;
+    auto new_has_indirect_branches = r.number() != 0;
+    if (new_call_sites > std::numeric_limits<u32>::max())
+        throw error("Invalid module image: bad number of call sites {}", new_call_sites);
+
+    auto code_size = r.count(1);
+    auto code = r.bytes(code_size);
+    std::vector<u8> new_bytecode(code, code + code_size);
+
+    struct library_ref {
+        usz index;
+        std::string path;
+        std::string name;
+        usz num_params;
+    };
+
+    std::vector<function> new_functions(r.count(16));
+    std::vector<library_ref> library_refs;
+    for (usz i = 0; i < new_functions.size(); i++) {
+        auto& f = new_functions[i];
+        f.locals_size = usz(r.number());
+        switch (auto k = r.number(); function_kind(k)) {
+            case function_kind::declared:
+            case function_kind::native:
+                break;
+
+            case function_kind::bytecode: {
+                auto a = usz(r.number());
+                if (a < ip_start_addr or a >= new_bytecode.size())
+                    throw error("Invalid module image: function {} starts at invalid address {}", i, a);
+                f.address = addr(a);
+            } break;
+
+            case function_kind::library: {
+                auto path = r.string();
+                auto name = r.string();
+                library_refs.push_back({i, std::move(path), std::move(name), usz(r.number())});
+            } break;
+
+            default: throw error("Invalid module image: bad function kind {}", k);
+        }
+    }
+
+    std::unordered_map<std::string, usz> new_functions_map;
+    for (auto n = r.count(16); n--;) {
+        auto name = r.string();
+        auto index = usz(r.number());
+        if (index >= new_functions.size()) throw error("Invalid module image: bad function index {}", index);
+        new_functions_map[std::move(name)] = index;
+    }
+
+    std::vector<try_region> new_try_regions(r.count(32));
+    for (auto& t : new_try_regions) {
+        t.begin = usz(r.number());
+        t.end = usz(r.number());
+        t.handler = usz(r.number());
+        t.function = usz(r.number());
+        if (t.begin > t.end or t.end > new_bytecode.size() or t.handler >= new_bytecode.size() or t.function >= new_functions.size())
+            throw error("Invalid module image: bad try region");
+    }
+
+    if (r.pos != image.size()) throw error("Invalid module image: trailing data");
+
+    /// Resolve library functions. Libraries that are already loaded stay
+    /// loaded, but forget their functions, whose indices no longer apply.
+    for (auto& [_, lib] : libraries) lib.functions.clear();
+    for (auto& l : library_refs) {
+        auto& lib = load_library(l.path);
+        new_functions[l.index].address = library_function{find_library_symbol(lib, l.path, l.name), l.num_params, l.name};
+        lib.functions[l.name] = l.index;
+    }
+
+    /// Commit.
+    std::unique_lock _{finalize_mutex};
+    bytecode = std::move(new_bytecode);
+    gp = new_gp;
+    max_memory = new_max_memory;
+    indirect_call_sites = u32(new_call_sites);
+    spawns_threads = new_spawns_threads;
+    has_indirect_branches = new_has_indirect_branches;
+    labels.clear();
+    label_branches.clear();
+    unbound_branches.clear();
+    functions = std::move(new_functions);
+    functions_map = std::move(new_functions_map);
+    try_regions = std::move(new_try_regions);
+    current_function = 0;
+    instruction_starts.clear();
+    block_costs.clear();
+}
@@ -0,0 +1,63 @@
+#include <cstring>
+#include <interpreter/snapshot.hh>
+
+#ifdef __linux__
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <unistd.h>
+#endif
+
+interp::snapshot::snapshot(const module& m, const std::string& init_function) : mod(m) {
+#ifdef __linux__
+    auto it = mod.functions_map.find(init_function);
+    if (it == mod.functions_map.end()) throw error("Unknown function \"{}\"", init_function);
+
+    /// Run the init function.
+    context ctx{mod};
+    ctx.run(it->second);
+
+    /// Only globals are captured; everything past them is the stack.
+    const auto data = ctx._memory_.data();
+    size = ctx._memory_.size();
+    const auto globals_end = std::min<usz>(+mod.gp, size);
+
+    /// Write the globals to a file. The rest of it reads as zeroes.
+    fd = memfd_create("interp-snapshot", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) throw error("Failed to create snapshot: {}", std::strerror(errno));
+    if (ftruncate(fd, off_t(size)) != 0) {
+        close(fd);
+        throw error("Failed to create snapshot: {}", std::strerror(errno));
+    }
+
+    for (usz written = 0; written < globals_end;) {
+        auto n = pwrite(fd, data + written, globals_end - written, off_t(written));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            throw error("Failed to create snapshot: {}", std::strerror(errno));
+        }
+        written += usz(n);
+    }
+
+    /// The snapshot is shared by every context spawned from it; make
+    /// sure no one can change it anymore.
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+        close(fd);
+        throw error("Failed to seal snapshot: {}", std::strerror(errno));
+    }
+#else
+    throw error("Snapshots are not supported on this platform");
+#endif
+}
+
+interp::snapshot::~snapshot() noexcept {
+#ifdef __linux__
+    if (fd >= 0) close(fd);
+#endif
+}
+
+auto interp::snapshot::spawn() const -> std::unique_ptr<context> {
+    auto ctx = std::make_unique<context>(mod);
+    ctx->_memory_.map_private(fd, size);
+    return ctx;
+}
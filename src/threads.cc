@@ -0,0 +1,314 @@
+#include <interpreter/executor.hh>
+#include <interpreter/interp.hh>
+#include <interpreter/io.hh>
+#include <utility>
+#include <vector>
+
+/// Guest threads that share the memory of a context.
+///
+/// Each thread runs in a context of its own, which aliases the memory of
+/// the context that owns the group; the threads are scheduled on an
+/// executor. Handles are slot indices plus one, so that 0 is never a
+/// valid handle.
+struct interp::thread_group {
+    /// States of a slot.
+    enum : u8 {
+        free,
+        queued,
+        running,
+        done,
+    };
+
+    struct slot {
+        std::unique_ptr<context> ctx;
+        std::atomic<u8> state{free};
+        word result{};
+        std::exception_ptr error;
+    };
+
+    std::unique_ptr<slot[]> slots;
+    usz count{};
+
+    /// Start of the stack slices, and the size of each one.
+    ptr stacks{};
+    usz stack_size{};
+
+    executor* exec{};
+
+    explicit thread_group(usz n) : slots(new slot[n]), count(n) {}
+};
+
+namespace {
+/// Executor used by contexts that don’t have one of their own.
+auto default_executor() -> interp::executor& {
+    static interp::executor e;
+    return e;
+}
+} // namespace
+
+interp::context::~context() noexcept {
+    reap_threads(true);
+    cancel_io();
+    if (not threads or guest_thread) return;
+
+    /// The threads refer to the group, so free them to free it.
+    for (usz i = 0; i < threads->count; i++) threads->slots[i].ctx.reset();
+}
+
+void interp::context::cancel_io() noexcept {
+    /// Guest threads are stopped by now, but their operations may not be.
+    if (threads and not guest_thread)
+        for (usz i = 0; i < threads->count; i++)
+            if (auto& t = threads->slots[i].ctx) t->cancel_io();
+
+    try {
+        for (auto& io : io_services) io->cancel(*this);
+    } catch (const std::exception&) {
+        /// Guest memory could be overwritten after it has been reused.
+        std::terminate();
+    }
+
+    io_services.clear();
+}
+
+void interp::context::reserve_thread_stacks() {
+    const usz size = (guest_thread_stack_size + sizeof(word) - 1) & ~(sizeof(word) - 1);
+    const usz total = size * max_guest_threads;
+    if (+stack_limit < +sp + total) throw error("Out of memory for thread stacks");
+
+    /// Shrink the main stack.
+    stack_limit = static_cast<ptr>(+stack_limit - total);
+    coroutine_stacks_end = stack_limit;
+
+    /// Create the group, or a bigger one if the limit has changed.
+    if (not threads or threads->count != max_guest_threads) {
+        if (threads)
+            for (usz i = 0; i < threads->count; i++) threads->slots[i].ctx.reset();
+        threads = std::make_shared<thread_group>(max_guest_threads);
+    }
+
+    threads->stacks = stack_limit;
+    threads->stack_size = size;
+    threads->exec = thread_executor ? thread_executor : &default_executor();
+}
+
+auto interp::context::spawn_thread(word function_index, word arg) -> word {
+    auto handle = try_spawn_thread(function_index, arg, 0);
+    if (not handle) throw error("Too many threads; at most {} can run at the same time", threads->count);
+    return handle;
+}
+
+auto interp::context::try_spawn_thread(word function_index, word arg0, word arg1) -> word {
+    /// Only functions defined in bytecode can be threads.
+    if (not threads) throw error("Threads are not enabled for this context");
+
+    /// Threads would get around fuel and time slices, since neither
+    /// applies to them.
+    if (metered) throw error("Cannot start threads in a run that uses fuel");
+    if (resumable_run) throw error("Cannot start threads in a run that can be resumed");
+    if (function_index >= functions.size() or not std::holds_alternative<addr>(functions[function_index].address))
+        throw error("Cannot start a thread that runs function {}", function_index);
+
+    /// Claim a free slot. It stays ‘running’ until it is set up so that
+    /// nobody else can run it in the meantime.
+    auto& g = *threads;
+    usz i = 0;
+    for (; i < g.count; i++) {
+        u8 expected = thread_group::free;
+        if (g.slots[i].state.compare_exchange_strong(expected, thread_group::running, std::memory_order_acquire)) break;
+    }
+    if (i == g.count) return 0;
+
+    /// Set up the context of the thread. Its stack is its slice of the
+    /// thread stacks; returning from the function ends the thread.
+    auto& s = g.slots[i];
+    if (not s.ctx) s.ctx = std::make_unique<context>(mod);
+    auto& c = *s.ctx;
+    auto& f = functions[function_index];
+    c._memory_ = guest_memory::alias(_memory_);
+    c.interrupts = interrupts;
+    c.threads = threads;
+    c.guest_thread = true;
+    c.channels = channels;
+    c.files = files;
+    c.ip = std::get<addr>(f.address);
+    c.stack_base = c.bottom_frame = static_cast<ptr>(+g.stacks + i * g.stack_size);
+    c.stack_limit = static_cast<ptr>(+c.stack_base + g.stack_size);
+    c.sp = static_cast<ptr>(+c.stack_base + f.locals_size);
+    c.coroutines.assign(1, {});
+    c.coroutines[0].st = coroutine::state::running;
+    c.free_coroutines.clear();
+    c.current_coroutine = 0;
+    c.coroutine_stacks_end = c.stack_limit;
+    c._registers_ = {};
+    c._registers_[2] = arg0;
+    c._registers_[3] = arg1;
+    c.call_caches.assign(mod.indirect_call_sites, {});
+    c.budget = std::numeric_limits<u64>::max();
+    c.metered = false;
+    c.charge_pending = false;
+    c.suspended = false;
+    if (+c.sp >= +c.stack_limit) {
+        s.state.store(thread_group::free, std::memory_order_release);
+        s.state.notify_all();
+        throw error("Stack overflow");
+    }
+
+    /// Hand it to the executor. If it hasn’t started by the time it is
+    /// joined, the joining thread runs it instead.
+    s.state.store(thread_group::queued, std::memory_order_release);
+    s.state.notify_all();
+    g.exec->post([group = threads, i] {
+        u8 expected = thread_group::queued;
+        if (group->slots[i].state.compare_exchange_strong(expected, thread_group::running, std::memory_order_acquire))
+            run_thread(*group, i);
+    });
+
+    return i + 1;
+}
+
+void interp::context::run_thread(thread_group& group, usz slot) noexcept {
+    auto& s = group.slots[slot];
+    try {
+        auto& c = *s.ctx;
+        if (auto st = c.execute(); st != run_status::finished) throw interrupted(st);
+        s.result = c._registers_[1];
+    } catch (...) {
+        s.error = std::current_exception();
+    }
+
+    s.state.store(thread_group::done, std::memory_order_release);
+    s.state.notify_all();
+}
+
+auto interp::context::join_thread(word handle) -> word {
+    if (not threads or handle == 0 or handle > threads->count) throw error("Invalid thread handle {}", handle);
+    auto& s = threads->slots[handle - 1];
+    if (s.state.load(std::memory_order_acquire) == thread_group::free) throw error("Thread {} is not running", handle);
+
+    /// Run it ourselves if it hasn’t started yet; otherwise, wait for it.
+    u8 st = thread_group::queued;
+    if (s.state.compare_exchange_strong(st, thread_group::running, std::memory_order_acquire)) run_thread(*threads, handle - 1);
+    else {
+        while ((st = s.state.load(std::memory_order_acquire)) != thread_group::done)
+            s.state.wait(st, std::memory_order_acquire);
+    }
+
+    /// Free the slot.
+    auto result = s.result;
+    auto err = std::exchange(s.error, nullptr);
+    s.state.store(thread_group::free, std::memory_order_release);
+    if (not err) return result;
+
+    /// A thread that was cancelled left the flag set for everyone else;
+    /// once the program itself sees it, it has done its job.
+    try {
+        std::rethrow_exception(err);
+    } catch (const interrupted& e) {
+        if (not guest_thread and e.status == run_status::cancelled)
+            interrupts->flags.fetch_and(u8(~interrupt_state::cancel), std::memory_order_relaxed);
+        throw;
+    }
+}
+
+void interp::context::reap_threads(bool cancel) noexcept {
+    if (not threads or guest_thread) return;
+    auto& g = *threads;
+
+    /// Threads that are still running may start more threads, so keep
+    /// going until a pass finds nothing left to do.
+    bool cancelled = false;
+    for (bool busy = true; busy;) {
+        busy = false;
+        for (usz i = 0; i < g.count; i++) {
+            auto& s = g.slots[i];
+            for (;;) {
+                auto st = s.state.load(std::memory_order_acquire);
+                if (st == thread_group::free) break;
+
+                /// Drop threads that haven’t started.
+                if (st == thread_group::queued) {
+                    if (s.state.compare_exchange_strong(st, thread_group::free, std::memory_order_acquire)) break;
+                    continue;
+                }
+
+                /// Free threads that are done.
+                if (st == thread_group::done) {
+                    s.error = nullptr;
+                    s.state.store(thread_group::free, std::memory_order_release);
+                    break;
+                }
+
+                /// Stop the others if requested, and wait for them.
+                if (cancel and not cancelled) {
+                    interrupts->flags.fetch_or(interrupt_state::cancel, std::memory_order_relaxed);
+                    cancelled = true;
+                }
+
+                busy = true;
+                s.state.wait(st, std::memory_order_acquire);
+            }
+        }
+    }
+
+    if (cancelled) interrupts->flags.fetch_and(u8(~interrupt_state::cancel), std::memory_order_relaxed);
+}
+
+auto interp::context::parallel_for(word function_index, word begin, word end, reduction op) -> word {
+    if (not threads) throw error("Threads are not enabled for this context");
+    if (end <= begin) return 0;
+
+    /// One chunk per thread; the last chunk may be shorter.
+    const word n = end - begin;
+    const word chunks = std::min<word>(n, threads->count);
+    const word chunk_size = (n + chunks - 1) / chunks;
+
+    /// Start as many chunks as we can. If other threads are using up the
+    /// slots, make room by waiting for the chunks we have already started.
+    std::vector<word> handles;
+    std::exception_ptr err;
+    word result = 0;
+    bool first = true;
+    usz joined = 0;
+    const auto join_next = [&] {
+        word value;
+        try {
+            value = join_thread(handles[joined++]);
+        } catch (...) {
+            if (not err) err = std::current_exception();
+            return;
+        }
+
+        if (op == reduction::none) return;
+        if (std::exchange(first, false)) result = value;
+        else if (op == reduction::add) result += value;
+        else if (op == reduction::min) result = std::min(result, value);
+        else if (op == reduction::max) result = std::max(result, value);
+        else if (op == reduction::min_signed) result = word(std::min(i64(result), i64(value)));
+        else if (op == reduction::max_signed) result = word(std::max(i64(result), i64(value)));
+    };
+
+    for (word b = begin; b < end; b += chunk_size) {
+        const word e = std::min(end, b + chunk_size);
+        for (;;) {
+            if (auto h = try_spawn_thread(function_index, b, e)) {
+                handles.push_back(h);
+                break;
+            }
+
+            if (joined == handles.size()) {
+                if (not err) err = std::make_exception_ptr(error("Too many threads; at most {} can run at the same time", threads->count));
+                break;
+            }
+
+            join_next();
+        }
+
+        if (err) break;
+    }
+
+    /// Wait for the rest, even if a chunk failed, so that the slots are freed.
+    while (joined < handles.size()) join_next();
+    if (err) std::rethrow_exception(err);
+    return result;
+}
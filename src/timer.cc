@@ -0,0 +1,116 @@
+#include <condition_variable>
+#include <map>
+#include <thread>
+#include <timer.hh>
+#include <unordered_map>
+
+namespace {
+using clock = std::chrono::steady_clock;
+
+class deadline_timer {
+    using entry_map = std::multimap<clock::time_point, std::shared_ptr<interp::interrupt_state>>;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool stopping = false;
+
+    /// Pending deadlines, earliest first.
+    entry_map entries;
+
+    /// The entry of each context that has a deadline. A context has at most
+    /// one, so changing a deadline drops the old entry instead of leaving
+    /// it in the queue until it expires.
+    std::unordered_map<interp::interrupt_state*, entry_map::iterator> entry_of;
+
+    std::thread thread{[this] { run(); }};
+
+    void run() {
+        std::unique_lock lock{mutex};
+        for (;;) {
+            if (stopping) return;
+            if (entries.empty()) {
+                changed.wait(lock);
+                continue;
+            }
+
+            /// Wait until the earliest deadline, or until an earlier one is added.
+            auto when = entries.begin()->first;
+            if (clock::now() < when) {
+                changed.wait_until(lock, when);
+                continue;
+            }
+
+            /// Expired. Since deadlines are only changed with the lock held,
+            /// this can’t race with setting or clearing the deadline.
+            auto state = std::move(entries.begin()->second);
+            entries.erase(entries.begin());
+            entry_of.erase(state.get());
+            state->scheduled.store(false, std::memory_order_relaxed);
+            state->flags.fetch_or(interp::interrupt_state::deadline, std::memory_order_relaxed);
+        }
+    }
+
+    /// Drop the entry of a context, if any, and clear its deadline flag.
+    void remove(interp::interrupt_state* state) {
+        if (auto it = entry_of.find(state); it != entry_of.end()) {
+            entries.erase(it->second);
+            entry_of.erase(it);
+        }
+
+        state->scheduled.store(false, std::memory_order_relaxed);
+        state->flags.fetch_and(interp::u8(~interp::interrupt_state::deadline), std::memory_order_relaxed);
+    }
+
+public:
+    ~deadline_timer() {
+        {
+            std::unique_lock _{mutex};
+            stopping = true;
+        }
+
+        changed.notify_one();
+        thread.join();
+    }
+
+    void schedule(clock::time_point when, std::shared_ptr<interp::interrupt_state> state) {
+        {
+            std::unique_lock _{mutex};
+            remove(state.get());
+            auto key = state.get();
+            state->scheduled.store(true, std::memory_order_relaxed);
+            entry_of[key] = entries.emplace(when, std::move(state));
+        }
+
+        changed.notify_one();
+    }
+
+    void cancel(interp::interrupt_state& state) {
+        std::unique_lock _{mutex};
+        remove(&state);
+    }
+
+    static deadline_timer& get() {
+        static deadline_timer timer;
+        return timer;
+    }
+};
+} // namespace
+
+void interp::timer::schedule(
+    std::chrono::steady_clock::time_point when,
+    std::shared_ptr<interrupt_state> state
+) {
+    deadline_timer::get().schedule(when, std::move(state));
+}
+
+void interp::timer::cancel(interrupt_state& state) {
+    /// Don’t start the timer thread if there is nothing to cancel. Only
+    /// the owner of the state schedules deadlines, so if there is no entry
+    /// now, the timer can’t set the flag behind our back.
+    if (not state.scheduled.load(std::memory_order_relaxed)) {
+        state.flags.fetch_and(u8(~interrupt_state::deadline), std::memory_order_relaxed);
+        return;
+    }
+
+    deadline_timer::get().cancel(state);
+}
@@ -0,0 +1,25 @@
+#ifndef INTERPRETER_TIMER_HH
+#define INTERPRETER_TIMER_HH
+
+#include <interpreter/interp.hh>
+
+/// Deadline timer.
+///
+/// A single background thread, started on first use, that sets the
+/// deadline flag of a context once its deadline has passed.
+namespace interp::timer {
+/// Set the deadline flag of a context at a point in time. This replaces
+/// any deadline set earlier and clears the flag until then.
+///
+/// \param when When to set the flag.
+/// \param state The interrupt state of the context.
+void schedule(
+    std::chrono::steady_clock::time_point when,
+    std::shared_ptr<interrupt_state> state
+);
+
+/// Remove the deadline of a context and clear its deadline flag.
+void cancel(interrupt_state& state);
+} // namespace interp::timer
+
+#endif // INTERPRETER_TIMER_HH
@@ -0,0 +1,363 @@
+#include <cstring>
+#include <tuple>
+#include <utility>
+#include <vector.hh>
+
+#if defined(__SSE2__) and not defined(INTERP_PORTABLE_VECTORS)
+#    include <immintrin.h>
+#    define INTERP_VECTOR_SSE2 1
+#    ifdef __SSE4_1__
+#        define INTERP_VECTOR_SSE41 1
+#    endif
+#    ifdef __SSE4_2__
+#        define INTERP_VECTOR_SSE42 1
+#    endif
+#    ifdef __AVX2__
+#        define INTERP_VECTOR_AVX2 1
+#    endif
+#endif
+
+using namespace interp::integers;
+using interp::vector_value;
+using interp::word;
+using interp::vector::binary_op;
+using interp::vector::reduction;
+
+namespace {
+/// Whether a feature is available.
+#ifdef INTERP_VECTOR_SSE41
+constexpr bool sse41 = true;
+#else
+constexpr bool sse41 = false;
+#endif
+
+#ifdef INTERP_VECTOR_SSE42
+constexpr bool sse42 = true;
+#else
+constexpr bool sse42 = false;
+#endif
+
+/// Get the lane type of a shape.
+template <u8 shape>
+struct lane_type;
+
+template <u8 shape>
+requires ((shape & INTERP_VECTOR_SIGNED) == 0)
+struct lane_type<shape> {
+    using type = std::tuple_element_t<shape & 0b11, std::tuple<u8, u16, u32, u64>>;
+};
+
+template <u8 shape>
+requires ((shape & INTERP_VECTOR_SIGNED) != 0)
+struct lane_type<shape> {
+    using type = std::tuple_element_t<shape & 0b11, std::tuple<i8, i16, i32, i64>>;
+};
+
+template <u8 shape>
+using lane_t = typename lane_type<shape>::type;
+
+/// ===========================================================================
+///  Scalar implementation.
+/// ===========================================================================
+/// Apply an operation to a single lane. Arithmetic is performed on
+/// unsigned values so that overflow wraps around instead of being UB.
+template <binary_op op, typename T>
+constexpr T apply(T a, T b) {
+    using U = std::make_unsigned_t<T>;
+    if constexpr (op == binary_op::add) return T(U(U(a) + U(b)));
+    else if constexpr (op == binary_op::sub) return T(U(U(a) - U(b)));
+    else if constexpr (op == binary_op::mul) return T(U(u64(U(a)) * u64(U(b))));
+    else if constexpr (op == binary_op::cmpeq) return a == b ? T(~U(0)) : T(0);
+    else if constexpr (op == binary_op::cmplt) return a < b ? T(~U(0)) : T(0);
+    else if constexpr (op == binary_op::min) return a < b ? a : b;
+    else if constexpr (op == binary_op::max) return a < b ? b : a;
+    else static_assert(op != op, "Unsupported operation");
+}
+
+template <binary_op op, typename T, usz bytes>
+void scalar_binary(vector_value& d, const vector_value& a, const vector_value& b) {
+    constexpr usz lanes = bytes / sizeof(T);
+    T x[lanes], y[lanes], r[32 / sizeof(T)]{};
+    std::memcpy(x, a.bytes.data(), bytes);
+    std::memcpy(y, b.bytes.data(), bytes);
+    for (usz i = 0; i < lanes; i++) r[i] = apply<op>(x[i], y[i]);
+    std::memcpy(d.bytes.data(), r, sizeof r);
+}
+
+/// ===========================================================================
+///  SSE implementation.
+/// ===========================================================================
+#ifdef INTERP_VECTOR_SSE2
+/// Check whether an operation can be performed using SSE.
+template <binary_op op, typename T>
+constexpr bool sse_supported() {
+    constexpr usz sz = sizeof(T);
+    constexpr bool sgn = std::is_signed_v<T>;
+    switch (op) {
+        case binary_op::add:
+        case binary_op::sub: return true;
+        case binary_op::mul: return sz == 2 or (sz == 4 and sse41);
+        case binary_op::cmpeq: return sz != 8 or sse41;
+        case binary_op::cmplt: return sz != 8 or sse42;
+        case binary_op::min:
+        case binary_op::max:
+            if (sz == 8) return false;
+            if (sgn) return sz == 2 or sse41;
+            return sz == 1 or sse41;
+        case binary_op::count: break;
+    }
+    return false;
+}
+
+/// Flip the sign bit of every lane; this maps unsigned to signed order.
+template <typename T>
+__m128i sse_bias(__m128i v) {
+    if constexpr (sizeof(T) == 1) return _mm_xor_si128(v, _mm_set1_epi8(INT8_MIN));
+    else if constexpr (sizeof(T) == 2) return _mm_xor_si128(v, _mm_set1_epi16(INT16_MIN));
+    else if constexpr (sizeof(T) == 4) return _mm_xor_si128(v, _mm_set1_epi32(INT32_MIN));
+    else return _mm_xor_si128(v, _mm_set1_epi64x(INT64_MIN));
+}
+
+template <typename T>
+__m128i sse_cmpgt_signed(__m128i a, __m128i b) {
+    if constexpr (sizeof(T) == 1) return _mm_cmpgt_epi8(a, b);
+    else if constexpr (sizeof(T) == 2) return _mm_cmpgt_epi16(a, b);
+    else if constexpr (sizeof(T) == 4) return _mm_cmpgt_epi32(a, b);
+#    ifdef INTERP_VECTOR_SSE42
+    else return _mm_cmpgt_epi64(a, b);
+#    else
+    else std::unreachable();
+#    endif
+}
+
+template <binary_op op, typename T>
+__m128i sse(__m128i a, __m128i b) {
+    constexpr usz sz = sizeof(T);
+    if constexpr (op == binary_op::add) {
+        if constexpr (sz == 1) return _mm_add_epi8(a, b);
+        else if constexpr (sz == 2) return _mm_add_epi16(a, b);
+        else if constexpr (sz == 4) return _mm_add_epi32(a, b);
+        else return _mm_add_epi64(a, b);
+    } else if constexpr (op == binary_op::sub) {
+        if constexpr (sz == 1) return _mm_sub_epi8(a, b);
+        else if constexpr (sz == 2) return _mm_sub_epi16(a, b);
+        else if constexpr (sz == 4) return _mm_sub_epi32(a, b);
+        else return _mm_sub_epi64(a, b);
+    } else if constexpr (op == binary_op::mul) {
+        if constexpr (sz == 2) return _mm_mullo_epi16(a, b);
+#    ifdef INTERP_VECTOR_SSE41
+        else if constexpr (sz == 4) return _mm_mullo_epi32(a, b);
+#    endif
+        else std::unreachable();
+    } else if constexpr (op == binary_op::cmpeq) {
+        if constexpr (sz == 1) return _mm_cmpeq_epi8(a, b);
+        else if constexpr (sz == 2) return _mm_cmpeq_epi16(a, b);
+        else if constexpr (sz == 4) return _mm_cmpeq_epi32(a, b);
+#    ifdef INTERP_VECTOR_SSE41
+        else return _mm_cmpeq_epi64(a, b);
+#    else
+        else std::unreachable();
+#    endif
+    } else if constexpr (op == binary_op::cmplt) {
+        if constexpr (std::is_signed_v<T>) return sse_cmpgt_signed<T>(b, a);
+        else return sse_cmpgt_signed<T>(sse_bias<T>(b), sse_bias<T>(a));
+    } else if constexpr (op == binary_op::min or op == binary_op::max) {
+        constexpr bool min = op == binary_op::min;
+        if constexpr (std::is_same_v<T, i16>) return min ? _mm_min_epi16(a, b) : _mm_max_epi16(a, b);
+        else if constexpr (std::is_same_v<T, u8>) return min ? _mm_min_epu8(a, b) : _mm_max_epu8(a, b);
+#    ifdef INTERP_VECTOR_SSE41
+        else if constexpr (std::is_same_v<T, i8>) return min ? _mm_min_epi8(a, b) : _mm_max_epi8(a, b);
+        else if constexpr (std::is_same_v<T, i32>) return min ? _mm_min_epi32(a, b) : _mm_max_epi32(a, b);
+        else if constexpr (std::is_same_v<T, u16>) return min ? _mm_min_epu16(a, b) : _mm_max_epu16(a, b);
+        else if constexpr (std::is_same_v<T, u32>) return min ? _mm_min_epu32(a, b) : _mm_max_epu32(a, b);
+#    endif
+        else std::unreachable();
+    } else {
+        static_assert(op != op, "Unsupported operation");
+    }
+}
+#endif
+
+/// ===========================================================================
+///  AVX2 implementation.
+/// ===========================================================================
+#ifdef INTERP_VECTOR_AVX2
+template <binary_op op, typename T>
+constexpr bool avx2_supported() {
+    constexpr usz sz = sizeof(T);
+    switch (op) {
+        case binary_op::add:
+        case binary_op::sub:
+        case binary_op::cmpeq:
+        case binary_op::cmplt: return true;
+        case binary_op::mul: return sz == 2 or sz == 4;
+        case binary_op::min:
+        case binary_op::max: return sz != 8;
+        case binary_op::count: break;
+    }
+    return false;
+}
+
+template <typename T>
+__m256i avx2_bias(__m256i v) {
+    if constexpr (sizeof(T) == 1) return _mm256_xor_si256(v, _mm256_set1_epi8(INT8_MIN));
+    else if constexpr (sizeof(T) == 2) return _mm256_xor_si256(v, _mm256_set1_epi16(INT16_MIN));
+    else if constexpr (sizeof(T) == 4) return _mm256_xor_si256(v, _mm256_set1_epi32(INT32_MIN));
+    else return _mm256_xor_si256(v, _mm256_set1_epi64x(INT64_MIN));
+}
+
+template <typename T>
+__m256i avx2_cmpgt_signed(__m256i a, __m256i b) {
+    if constexpr (sizeof(T) == 1) return _mm256_cmpgt_epi8(a, b);
+    else if constexpr (sizeof(T) == 2) return _mm256_cmpgt_epi16(a, b);
+    else if constexpr (sizeof(T) == 4) return _mm256_cmpgt_epi32(a, b);
+    else return _mm256_cmpgt_epi64(a, b);
+}
+
+template <binary_op op, typename T>
+__m256i avx2(__m256i a, __m256i b) {
+    constexpr usz sz = sizeof(T);
+    if constexpr (op == binary_op::add) {
+        if constexpr (sz == 1) return _mm256_add_epi8(a, b);
+        else if constexpr (sz == 2) return _mm256_add_epi16(a, b);
+        else if constexpr (sz == 4) return _mm256_add_epi32(a, b);
+        else return _mm256_add_epi64(a, b);
+    } else if constexpr (op == binary_op::sub) {
+        if constexpr (sz == 1) return _mm256_sub_epi8(a, b);
+        else if constexpr (sz == 2) return _mm256_sub_epi16(a, b);
+        else if constexpr (sz == 4) return _mm256_sub_epi32(a, b);
+        else return _mm256_sub_epi64(a, b);
+    } else if constexpr (op == binary_op::mul) {
+        if constexpr (sz == 2) return _mm256_mullo_epi16(a, b);
+        else return _mm256_mullo_epi32(a, b);
+    } else if constexpr (op == binary_op::cmpeq) {
+        if constexpr (sz == 1) return _mm256_cmpeq_epi8(a, b);
+        else if constexpr (sz == 2) return _mm256_cmpeq_epi16(a, b);
+        else if constexpr (sz == 4) return _mm256_cmpeq_epi32(a, b);
+        else return _mm256_cmpeq_epi64(a, b);
+    } else if constexpr (op == binary_op::cmplt) {
+        if constexpr (std::is_signed_v<T>) return avx2_cmpgt_signed<T>(b, a);
+        else return avx2_cmpgt_signed<T>(avx2_bias<T>(b), avx2_bias<T>(a));
+    } else if constexpr (op == binary_op::min or op == binary_op::max) {
+        constexpr bool min = op == binary_op::min;
+        if constexpr (std::is_same_v<T, i8>) return min ? _mm256_min_epi8(a, b) : _mm256_max_epi8(a, b);
+        else if constexpr (std::is_same_v<T, i16>) return min ? _mm256_min_epi16(a, b) : _mm256_max_epi16(a, b);
+        else if constexpr (std::is_same_v<T, i32>) return min ? _mm256_min_epi32(a, b) : _mm256_max_epi32(a, b);
+        else if constexpr (std::is_same_v<T, u8>) return min ? _mm256_min_epu8(a, b) : _mm256_max_epu8(a, b);
+        else if constexpr (std::is_same_v<T, u16>) return min ? _mm256_min_epu16(a, b) : _mm256_max_epu16(a, b);
+        else return min ? _mm256_min_epu32(a, b) : _mm256_max_epu32(a, b);
+    } else {
+        static_assert(op != op, "Unsupported operation");
+    }
+}
+#endif
+
+/// ===========================================================================
+///  Dispatch.
+/// ===========================================================================
+/// Perform a lane-wise operation using the best available implementation.
+/// 128-bit operations always clear the upper half of the destination.
+template <binary_op op, typename T, usz bytes>
+void binary(vector_value& d, const vector_value& a, const vector_value& b) {
+#ifdef INTERP_VECTOR_AVX2
+    if constexpr (bytes == 32 and avx2_supported<op, T>()) {
+        auto x = _mm256_load_si256(reinterpret_cast<const __m256i*>(a.bytes.data()));
+        auto y = _mm256_load_si256(reinterpret_cast<const __m256i*>(b.bytes.data()));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(d.bytes.data()), avx2<op, T>(x, y));
+        return;
+    }
+#endif
+
+#ifdef INTERP_VECTOR_SSE2
+    if constexpr (sse_supported<op, T>()) {
+        auto lo = sse<op, T>(
+            _mm_load_si128(reinterpret_cast<const __m128i*>(a.bytes.data())),
+            _mm_load_si128(reinterpret_cast<const __m128i*>(b.bytes.data()))
+        );
+
+        auto hi = _mm_setzero_si128();
+        if constexpr (bytes == 32) {
+            hi = sse<op, T>(
+                _mm_load_si128(reinterpret_cast<const __m128i*>(a.bytes.data() + 16)),
+                _mm_load_si128(reinterpret_cast<const __m128i*>(b.bytes.data() + 16))
+            );
+        }
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(d.bytes.data()), lo);
+        _mm_store_si128(reinterpret_cast<__m128i*>(d.bytes.data() + 16), hi);
+        return;
+    }
+#endif
+
+    scalar_binary<op, T, bytes>(d, a, b);
+}
+
+/// Reduce a vector to a single value.
+template <reduction op, typename T, usz bytes>
+word reduce(const vector_value& v) {
+    constexpr usz lanes = bytes / sizeof(T);
+    T x[lanes];
+    std::memcpy(x, v.bytes.data(), bytes);
+
+    T acc = x[0];
+    for (usz i = 1; i < lanes; i++) {
+        if constexpr (op == reduction::add) acc = apply<binary_op::add>(acc, x[i]);
+        else if constexpr (op == reduction::min) acc = apply<binary_op::min>(acc, x[i]);
+        else acc = apply<binary_op::max>(acc, x[i]);
+    }
+
+    if constexpr (std::is_signed_v<T>) return word(i64(acc));
+    else return word(acc);
+}
+
+/// Broadcast a value to every lane.
+template <typename T, usz bytes>
+void splat(vector_value& d, word value) {
+    constexpr usz lanes = bytes / sizeof(T);
+    T r[32 / sizeof(T)]{};
+    for (usz i = 0; i < lanes; i++) r[i] = static_cast<T>(value);
+    std::memcpy(d.bytes.data(), r, sizeof r);
+}
+
+/// Build the dispatch tables.
+template <binary_op op, usz... shapes>
+constexpr auto make_binary_row(std::index_sequence<shapes...>) {
+    return std::array<interp::vector::binary_fn, sizeof...(shapes)>{
+        &binary<op, lane_t<u8(shapes)>, interp::vector::width(u8(shapes))>...
+    };
+}
+
+template <reduction op, usz... shapes>
+constexpr auto make_reduction_row(std::index_sequence<shapes...>) {
+    return std::array<interp::vector::reduce_fn, sizeof...(shapes)>{
+        &reduce<op, lane_t<u8(shapes)>, interp::vector::width(u8(shapes))>...
+    };
+}
+
+template <usz... shapes>
+constexpr auto make_splats(std::index_sequence<shapes...>) {
+    return std::array<interp::vector::splat_fn, sizeof...(shapes)>{
+        &splat<lane_t<u8(shapes)>, interp::vector::width(u8(shapes))>...
+    };
+}
+
+using shapes = std::make_index_sequence<interp::vector::shape_count>;
+} // namespace
+
+const std::array<std::array<interp::vector::binary_fn, interp::vector::shape_count>, usz(binary_op::count)> interp::vector::binary_ops{
+    make_binary_row<binary_op::add>(shapes{}),
+    make_binary_row<binary_op::sub>(shapes{}),
+    make_binary_row<binary_op::mul>(shapes{}),
+    make_binary_row<binary_op::cmpeq>(shapes{}),
+    make_binary_row<binary_op::cmplt>(shapes{}),
+    make_binary_row<binary_op::min>(shapes{}),
+    make_binary_row<binary_op::max>(shapes{}),
+};
+
+const std::array<std::array<interp::vector::reduce_fn, interp::vector::shape_count>, usz(reduction::count)> interp::vector::reductions{
+    make_reduction_row<reduction::add>(shapes{}),
+    make_reduction_row<reduction::min>(shapes{}),
+    make_reduction_row<reduction::max>(shapes{}),
+};
+
+const std::array<interp::vector::splat_fn, interp::vector::shape_count> interp::vector::splats = make_splats(shapes{});
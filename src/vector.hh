@@ -0,0 +1,54 @@
+#ifndef INTERPRETER_VECTOR_HH
+#define INTERPRETER_VECTOR_HH
+
+#include <interpreter/interp.hh>
+
+/// Implementation of the vector instructions.
+///
+/// Every vector instruction is dispatched through one of the tables
+/// below, which are indexed by the shape of the instruction. Which
+/// implementation ends up in the tables (AVX2, SSE, or plain scalar
+/// loops) is decided at build time; define INTERP_PORTABLE_VECTORS to
+/// force the scalar implementation.
+namespace interp::vector {
+/// Lane-wise operations, in opcode order.
+enum struct binary_op : u8 {
+    add,
+    sub,
+    mul,
+    cmpeq,
+    cmplt,
+    min,
+    max,
+    count,
+};
+
+/// Horizontal reductions, in opcode order.
+enum struct reduction : u8 {
+    add,
+    min,
+    max,
+    count,
+};
+
+/// Function types.
+using binary_fn = void (*)(vector_value& dest, const vector_value& a, const vector_value& b);
+using reduce_fn = word (*)(const vector_value& v);
+using splat_fn = void (*)(vector_value& dest, word value);
+
+/// Number of distinct shapes.
+constexpr inline usz shape_count = vector_shape_mask + 1;
+
+/// Dispatch tables, indexed by operation and then shape.
+extern const std::array<std::array<binary_fn, shape_count>, usz(binary_op::count)> binary_ops;
+extern const std::array<std::array<reduce_fn, shape_count>, usz(reduction::count)> reductions;
+extern const std::array<splat_fn, shape_count> splats;
+
+/// Get the width of a vector in bytes.
+constexpr usz width(u8 shape) { return shape & INTERP_VECTOR_256 ? 32 : 16; }
+
+/// Get the size of a lane in bytes.
+constexpr usz lane_size(u8 shape) { return usz(1) << (shape & 0b11); }
+} // namespace interp::vector
+
+#endif // INTERPRETER_VECTOR_HH
@@ -0,0 +1,92 @@
+#include "test.hh"
+
+#include <interpreter/channel.hh>
+
+using namespace interp::literals;
+
+namespace {
+/// Send 1 through n to channel 1, then close it.
+void create_producer(interp::interpreter& i, interp::word n) {
+    i.defun_channels();
+    i.create_move(10_r, 1_w);
+    auto loop = i.current_addr();
+    i.create_move(2_r, 1_w);
+    i.create_move(3_r, 10_r);
+    i.create_call("chan.send");
+    i.create_add(10_r, 10_r, 1_w);
+    i.create_sub(11_r, 10_r, n + 1);
+    i.create_branch_ifnz(11_r, loop);
+    i.create_move(2_r, 1_w);
+    i.create_call("chan.close");
+    i.create_return();
+}
+
+/// Add up everything received from channel 1 until it is closed.
+void create_consumer(interp::interpreter& i) {
+    i.defun_channels();
+    i.create_move(10_r, 0_w);
+    auto loop = i.current_addr();
+    i.create_move(2_r, 1_w);
+    i.create_call("chan.recv");
+    i.create_add(10_r, 10_r, 1_r);
+    i.create_branch_ifnz(2_r, loop);
+    i.create_move(1_r, 10_r);
+    i.create_return();
+}
+} // namespace
+
+TEST(cooperative_pipeline) {
+    auto ch = std::make_shared<interp::channel>(interp::channel::kind::spsc, 4);
+    interp::interpreter p, c;
+    create_producer(p, 1000);
+    create_consumer(c);
+    p.attach(ch);
+    c.attach(ch);
+
+    auto sp = p.run_for(~0ull), sc = c.run_for(~0ull);
+    while (sp != interp::run_status::finished or sc != interp::run_status::finished) {
+        if (sp != interp::run_status::finished) sp = p.resume();
+        if (sc != interp::run_status::finished) sc = c.resume();
+    }
+
+    CHECK_EQ(c.result(), interp::word(1000 * 1001 / 2));
+}
+
+/// A run that is resumed while still blocked must not register another
+/// callback every time.
+TEST(one_callback_per_owner) {
+    interp::channel ch{interp::channel::kind::spsc, 2};
+    int calls = 0;
+    int owner;
+    for (int n = 0; n < 10; n++) ch.notify_on_send([&] { calls++; }, &owner);
+    ch.notify_on_send([&] { calls++; });
+
+    interp::channel::message m(1);
+    CHECK(ch.try_send(m));
+    CHECK_EQ(calls, 2);
+
+    /// Callbacks are one-shot.
+    CHECK(ch.try_receive().has_value());
+    CHECK(ch.try_send(m));
+    CHECK_EQ(calls, 2);
+}
+
+TEST(blocked_receive_wakes_up) {
+    auto ch = std::make_shared<interp::channel>(interp::channel::kind::spsc, 2);
+    interp::interpreter c;
+    create_consumer(c);
+    c.attach(ch);
+
+    int wakeups = 0;
+    c.wakeup = [&] { wakeups++; };
+    CHECK(c.run_for(~0ull) == interp::run_status::blocked);
+    for (int n = 0; n < 10; n++) CHECK(c.resume() == interp::run_status::blocked);
+
+    interp::channel::message m(sizeof(interp::word));
+    m[0] = 42;
+    CHECK(ch->try_send(m));
+    CHECK_EQ(wakeups, 1);
+    ch->close();
+    CHECK(c.resume() == interp::run_status::finished);
+    CHECK_EQ(c.result(), 42u);
+}
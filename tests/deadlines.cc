@@ -0,0 +1,57 @@
+#include "test.hh"
+
+#include <thread>
+
+using namespace interp::literals;
+using namespace std::chrono_literals;
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+void create_infinite_loop(interp::interpreter& i) {
+    i.create_move(2_r, 0_w);
+    auto loop = i.current_addr();
+    i.create_add(2_r, 2_r, 1_w);
+    i.create_branch(loop);
+}
+} // namespace
+
+TEST(deadline_stops_run) {
+    interp::interpreter i;
+    create_infinite_loop(i);
+    i.set_deadline(clock_type::now() + 20ms);
+    CHECK(i.run_for(~0ull) == interp::run_status::deadline_exceeded);
+
+    /// The deadline stays exceeded until it is cleared.
+    CHECK(i.resume(10) == interp::run_status::deadline_exceeded);
+    i.clear_deadline();
+    CHECK(i.resume(10) == interp::run_status::suspended);
+}
+
+TEST(superseded_deadline_does_not_fire) {
+    interp::interpreter i;
+    create_infinite_loop(i);
+    CHECK(i.run_for(10) == interp::run_status::suspended);
+    i.set_deadline(clock_type::now() + 5ms);
+    i.set_deadline(clock_type::now() + 1h);
+    std::this_thread::sleep_for(20ms);
+    CHECK(i.resume(10) == interp::run_status::suspended);
+    i.clear_deadline();
+}
+
+/// Replacing a deadline just as the old one expires must never leave the
+/// deadline flag set for the new one.
+TEST(replacing_expiring_deadline) {
+    interp::interpreter i;
+    i.create_move(1_r, 1_w);
+    i.create_return();
+
+    int spurious = 0;
+    for (int n = 0; n < 20'000; n++) {
+        i.set_deadline(clock_type::now());
+        i.set_deadline(clock_type::now() + 1h);
+        if (i.run_for(~0ull) != interp::run_status::finished) spurious++;
+    }
+
+    i.clear_deadline();
+    CHECK_EQ(spurious, 0);
+}
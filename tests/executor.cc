@@ -0,0 +1,54 @@
+#include "test.hh"
+
+#include <interpreter/executor.hh>
+
+using namespace interp::literals;
+
+/// Jobs posted from inside other jobs go to the worker’s own deque and
+/// are stolen from there; all of them must run before the executor stops.
+TEST(nested_jobs_all_run) {
+    std::atomic<interp::usz> ran{};
+    {
+        interp::executor ex{4};
+        for (int i = 0; i < 100; i++) {
+            ex.post([&] {
+                for (int j = 0; j < 100; j++) ex.post([&] { ran.fetch_add(1); });
+                ran.fetch_add(1);
+            });
+        }
+
+        /// Wait for everything to run so the workers go back to sleep
+        /// with nothing queued.
+        while (ran.load() != 100 * 101) std::this_thread::yield();
+    }
+    CHECK_EQ(ran.load(), interp::usz(100 * 101));
+}
+
+TEST(submit_returns_exceptions) {
+    interp::executor ex{2};
+    auto f = ex.submit([]() -> int { throw std::runtime_error("oops"); });
+    CHECK_THROWS(f.get());
+    CHECK_EQ(ex.submit([] { return 42; }).get(), 42);
+}
+
+TEST(execute_from_pool) {
+    interp::module m;
+    m.create_move(1_r, 7_w);
+    m.create_return();
+    interp::context_pool pool{m};
+
+    interp::module bad;
+    bad.create_move(2_r, 5_w);
+    bad.create_throw(2_r);
+    interp::context_pool bad_pool{bad};
+
+    std::atomic<int> errors{};
+    {
+        interp::executor ex{4};
+        std::vector<std::future<interp::word>> results;
+        for (int i = 0; i < 200; i++) results.push_back(ex.execute(pool));
+        for (int i = 0; i < 20; i++) ex.execute(bad_pool, [&](interp::word, std::exception_ptr e) { if (e) errors++; });
+        for (auto& r : results) CHECK_EQ(r.get(), 7u);
+    }
+    CHECK_EQ(errors.load(), 20);
+}
@@ -0,0 +1,91 @@
+#include "test.hh"
+
+using namespace interp::literals;
+
+namespace {
+/// Count down from 100 and return 42.
+void build(interp::module& m) {
+    m.create_move(10_r, 100_w);
+    auto loop = m.current_addr();
+    m.create_sub(10_r, 10_r, 1_w);
+    m.create_branch_ifnz(10_r, loop);
+    m.create_move(1_r, 42_w);
+    m.create_return();
+}
+
+/// The fuel that a full run of the program uses.
+interp::u64 cost() {
+    interp::interpreter i;
+    build(i);
+    i.set_fuel(1'000'000);
+    CHECK_EQ(i.run(), 42u);
+    return 1'000'000 - *i.remaining_fuel();
+}
+} // namespace
+
+TEST(metering_is_deterministic) {
+    auto used = cost();
+    CHECK(used >= 200);
+    CHECK_EQ(cost(), used);
+
+    /// Exactly enough fuel is enough.
+    interp::interpreter i;
+    build(i);
+    i.set_fuel(used);
+    CHECK_EQ(i.run(), 42u);
+    CHECK(i.remaining_fuel() == 0u);
+}
+
+/// Running out of fuel keeps the state of the run, so it can be refuelled
+/// and resumed; the total is the same as for an uninterrupted run.
+TEST(refuel_and_resume) {
+    auto used = cost();
+    interp::interpreter i;
+    build(i);
+    i.set_fuel(used / 3);
+    CHECK_THROWS(i.run());
+    CHECK(interp::test::throws<interp::out_of_fuel>([&] { i.resume(); }));
+
+    auto spent = used / 3, refills = interp::u64(1);
+    for (;;) {
+        i.set_fuel(10);
+        try {
+            CHECK(i.resume() == interp::run_status::finished);
+            spent += 10 - *i.remaining_fuel();
+            break;
+        } catch (const interp::out_of_fuel&) {
+            spent += 10 - *i.remaining_fuel();
+            refills++;
+        }
+    }
+
+    CHECK_EQ(i.result(), 42u);
+    CHECK(refills > 1);
+    CHECK_EQ(spent, used);
+}
+
+TEST(disable_fuel) {
+    interp::interpreter i;
+    build(i);
+    CHECK(not i.remaining_fuel().has_value());
+    i.set_fuel(1);
+    CHECK(i.remaining_fuel().has_value());
+    i.disable_fuel();
+    CHECK(not i.remaining_fuel().has_value());
+    CHECK_EQ(i.run(), 42u);
+}
+
+/// Guest threads can’t be metered.
+TEST(no_threads_with_fuel) {
+    interp::interpreter i;
+    i.create_move(10_r, interp::word(i.function_index("worker")));
+    i.create_thread_spawn(11_r, 10_r, 0_r);
+    i.create_thread_join(1_r, 11_r);
+    i.create_return();
+    i.create_function("worker");
+    i.create_move(1_r, 1_w);
+    i.create_return();
+    CHECK_EQ(i.run(), 1u);
+    i.set_fuel(1'000'000);
+    CHECK_THROWS_WITH("uses fuel", i.run());
+}
@@ -0,0 +1,172 @@
+#include "test.hh"
+
+#include <thread>
+#include <type_traits>
+
+using namespace interp::literals;
+
+namespace {
+constexpr int count = 400;
+
+/// Build function f<i>, which adds i three times to its argument, stores
+/// and reloads it through a global, picks a switch case, catches an
+/// exception, calls "leaf" indirectly, and calls f<i - 1> by name unless
+/// i is a multiple of 10. Works with both modules and builders.
+void body(auto& m, int i) {
+    auto g = m.create_global(8);
+    m.create_move(11_r, 0_w);
+    m.create_move(12_r, 0_w);
+    auto loop = m.create_label(), join = m.create_label(), after = m.create_label(), done = m.create_label();
+    m.bind(loop);
+    m.create_add(12_r, 12_r, interp::word(i));
+    m.create_add(11_r, 11_r, 1_w);
+    m.create_sub(13_r, 11_r, 3_w);
+    m.create_branch_ifnz(13_r, loop);
+    m.create_add(2_r, 2_r, 12_r);
+    m.create_store(g, 2_r);
+    m.create_load(14_r, g);
+    m.create_add(2_r, 2_r, 14_r);
+    m.create_branch(after);
+    auto c0 = m.current_addr();
+    m.create_add(2_r, 2_r, 1_w);
+    m.create_branch(join);
+    auto c1 = m.current_addr();
+    m.create_add(2_r, 2_r, 2_w);
+    m.create_branch(join);
+    auto fallback = m.current_addr();
+    m.create_add(2_r, 2_r, 3_w);
+    m.create_branch(join);
+    m.bind(after);
+    m.create_remu(15_r, 2_r, 3_w);
+    m.create_switch(15_r, {{0, c0}, {1, c1}}, fallback);
+    m.bind(join);
+    auto try_begin = m.current_addr();
+    m.create_move(3_r, 5_w);
+    m.create_throw(3_r);
+    auto try_end = m.current_addr();
+    m.create_branch(done);
+    auto handler = m.current_addr();
+    m.create_add(2_r, 2_r, 7_w);
+    m.bind(done);
+    m.create_try(try_begin, try_end, handler);
+    m.create_move(16_r, interp::word(m.function_index("leaf")));
+    m.create_call_indirect(16_r);
+    if (i % 10) m.create_call(fmt::format("f{}", i - 1));
+    m.create_move(1_r, 2_r);
+    m.create_return();
+}
+
+void leaf(auto& m) {
+    m.create_add(2_r, 2_r, 1_w);
+    m.create_return();
+}
+
+std::vector<interp::word> results(interp::module& m) {
+    interp::context c{m};
+    std::vector<interp::word> r;
+    for (int i = 9; i < count; i += 10) {
+        interp::word args[]{interp::word(i)};
+        r.push_back(c.run(m.function_index(fmt::format("f{}", i)), args));
+    }
+    return r;
+}
+} // namespace
+
+/// A builder only offers the code generation API of a module.
+static_assert(not std::is_convertible_v<interp::function_builder&, const interp::module&>);
+
+TEST(builders_match_direct_code) {
+    interp::module direct;
+    direct.max_memory = 1 << 20;
+    direct.create_function("leaf");
+    leaf(direct);
+    for (int i = 0; i < count; i++) {
+        direct.create_function(fmt::format("f{}", i));
+        body(direct, i);
+    }
+
+    /// Functions are built on several threads, in reverse order, so most
+    /// calls refer to functions that don’t exist yet.
+    interp::module built;
+    built.max_memory = 1 << 20;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) threads.emplace_back([&, t] {
+        for (int i = count - 1 - t; i >= 0; i -= 4) {
+            auto b = built.build_function(fmt::format("f{}", i));
+            body(*b, i);
+            built.link(*b);
+        }
+    });
+    auto b = built.build_function("leaf");
+    leaf(*b);
+    built.link(*b);
+    for (auto& t : threads) t.join();
+
+    CHECK(results(direct) == results(built));
+}
+
+TEST(calls_are_resolved_when_linked) {
+    interp::interpreter i;
+    auto b = i.build_function("main");
+    b->create_move(2_r, 20_w);
+    b->create_call("twice");
+    b->create_call("twice");
+    b->create_move(1_r, 2_r);
+    b->create_return();
+    i.link(*b);
+
+    /// The callee is defined after the caller was linked.
+    i.create_function("twice");
+    i.create_add(2_r, 2_r, 2_r);
+    i.create_return();
+    CHECK_EQ(i.run(b->function()), 80u);
+}
+
+TEST(parallel_for_is_defined_on_link) {
+    interp::interpreter i;
+    i.create_function("chunk");
+    i.create_sub(1_r, 3_r, 2_r);
+    i.create_return();
+    auto b = i.build_function("main");
+    b->create_move(10_r, interp::word(b->function_index("chunk")));
+    b->create_move(11_r, 0_w);
+    b->create_move(12_r, 1000_w);
+    b->create_parallel_for(1_r, 10_r, 11_r, 12_r, interp::reduction::add);
+    b->create_return();
+    i.link(*b);
+    CHECK_EQ(i.run(b->function()), 1000u);
+}
+
+TEST(link_errors) {
+    interp::module m;
+    auto f = m.build_function("f"), twin = m.build_function("f");
+    leaf(*f);
+    leaf(*twin);
+    m.link(*f);
+    CHECK_THROWS_WITH("already been linked", m.link(*f));
+    CHECK_THROWS_WITH("already exists", m.link(*twin));
+    CHECK_THROWS_WITH("already exists", m.build_function("f"));
+
+    interp::module other;
+    auto g = other.build_function("g");
+    CHECK_THROWS_WITH("different module", m.link(*g));
+}
+
+/// Linking moves code and grows the tables of running contexts, so it is
+/// refused once the module has been run.
+TEST(no_linking_after_start) {
+    interp::interpreter i;
+    auto early = i.build_function("early");
+    leaf(*early);
+    i.create_move(1_r, 3_w);
+    i.create_return();
+    CHECK_EQ(i.run(), 3u);
+
+    auto size = i.current_addr();
+    CHECK_THROWS_WITH("started running", i.link(*early));
+    CHECK_THROWS_WITH("started running", i.build_function("late"));
+    CHECK_THROWS_WITH("started running", early->function_index("missing"));
+    CHECK_THROWS_WITH("started running", early->create_global(8));
+    CHECK_EQ(i.current_addr(), size);
+    CHECK_EQ(i.run(), 3u);
+}
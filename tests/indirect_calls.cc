@@ -0,0 +1,42 @@
+#include "test.hh"
+
+using namespace interp::literals;
+
+TEST(call_through_register) {
+    interp::interpreter i;
+    auto square = i.function_index("square");
+    i.create_move(5_r, interp::word(square));
+    i.create_move(3_r, 0_w);
+    i.create_move(4_r, 10_w);
+    auto loop = i.current_addr();
+    i.create_move(2_r, 4_r);
+    i.create_call_indirect(5_r);
+    i.create_add(3_r, 3_r, 1_r);
+    i.create_sub(4_r, 4_r, 1_w);
+    i.create_branch_ifnz(4_r, loop);
+    i.create_move(1_r, 3_r);
+    i.create_return();
+    i.create_function("square");
+    i.create_mulu(1_r, 2_r, 2_r);
+    i.create_return();
+    CHECK_EQ(i.run(), 385u);
+}
+
+/// An empty call cache must not match any index, not even ~0.
+TEST(empty_cache_does_not_match) {
+    interp::interpreter i;
+    i.create_move(5_r, ~interp::word(0));
+    i.create_call_indirect(5_r);
+    i.create_move(1_r, 1_w);
+    i.create_return();
+    CHECK_THROWS_WITH("Call index out of bounds", i.run());
+}
+
+TEST(invalid_jump_target) {
+    interp::interpreter i;
+    i.create_move(7_r, interp::word(0x8));
+    i.create_branch_indirect(7_r);
+    i.create_move(1_r, 0x1234_w);
+    i.create_return();
+    CHECK_THROWS_WITH("Invalid indirect jump target", i.run());
+}
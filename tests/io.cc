@@ -0,0 +1,154 @@
+#include "test.hh"
+
+#include <cerrno>
+#include <cstdlib>
+#include <interpreter/io.hh>
+#include <thread>
+#include <unistd.h>
+
+using namespace interp::literals;
+
+namespace {
+/// Create a module that writes 4 KiB to file 1, reads it back, and returns
+/// the total number of bytes transferred; r31 is 0 if the data matches.
+void create_round_trip(interp::module& m) {
+    auto buf = m.create_global(4096);
+    auto copy = m.create_global(4096);
+    m.create_move(5_r, interp::word(buf));
+    m.create_move(6_r, 'x');
+    m.create_move(7_r, 4096_w);
+    m.create_memfill(5_r, 6_r, 7_r);
+
+    /// Four writes in flight at the same time.
+    for (interp::word k = 0; k < 4; k++) {
+        m.create_move(2_r, 1_w);
+        m.create_move(3_r, interp::word(buf) + k * 1024);
+        m.create_move(4_r, 1024_w);
+        m.create_move(5_r, k * 1024);
+        m.create_call("io.submit_write");
+        m.create_move(interp::reg(21 + k), 1_r);
+    }
+
+    m.create_move(30_r, 0_w);
+    for (interp::word k = 0; k < 4; k++) {
+        m.create_move(2_r, interp::reg(21 + k));
+        m.create_call("io.wait");
+        m.create_add(30_r, 30_r, 1_r);
+    }
+
+    m.create_move(2_r, 1_w);
+    m.create_move(3_r, interp::word(copy));
+    m.create_move(4_r, 4096_w);
+    m.create_move(5_r, 0_w);
+    m.create_call("io.read");
+    m.create_add(30_r, 30_r, 1_r);
+
+    m.create_move(2_r, interp::word(buf));
+    m.create_move(3_r, interp::word(copy));
+    m.create_move(4_r, 4096_w);
+    m.create_memcompare(31_r, 2_r, 3_r, 4_r);
+    m.create_move(1_r, 30_r);
+    m.create_return();
+}
+
+/// Create a module that reads from file 1 into a global.
+void create_read(interp::module& m) {
+    auto buf = m.create_global(64);
+    m.create_move(2_r, 1_w);
+    m.create_move(3_r, interp::word(buf));
+    m.create_move(4_r, 64_w);
+    m.create_move(5_r, ~interp::word(0));
+    m.create_call("io.read");
+    m.create_return();
+}
+
+int temp_file() {
+    char path[] = "/tmp/interp-io-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd >= 0) unlink(path);
+    return fd;
+}
+
+void round_trip(interp::io_service::backend b) {
+    auto io = std::make_shared<interp::io_service>(b);
+    interp::module m;
+    m.defun_io(io);
+    create_round_trip(m);
+
+    int fd = temp_file();
+    CHECK(fd >= 0);
+    interp::context c{m};
+    c.attach_file(fd);
+    CHECK_EQ(c.run(), interp::word(4 * 1024 + 4096));
+    CHECK_EQ(c.r(31_r), 0u);
+
+    /// Same thing, but the run stops while waiting.
+    auto st = c.run_for(~0ull);
+    while (st != interp::run_status::finished) {
+        std::this_thread::yield();
+        st = c.resume();
+    }
+
+    CHECK_EQ(c.result(), interp::word(4 * 1024 + 4096));
+    CHECK_EQ(c.r(31_r), 0u);
+    close(fd);
+}
+} // namespace
+
+TEST(round_trip_automatic) { round_trip(interp::io_service::backend::automatic); }
+TEST(round_trip_threads) { round_trip(interp::io_service::backend::threads); }
+
+/// A blocking read from a pipe might never return, so the thread pool
+/// refuses to start one.
+TEST(threads_backend_rejects_pipes) {
+    auto io = std::make_shared<interp::io_service>(interp::io_service::backend::threads);
+    interp::module m;
+    m.defun_io(io);
+    create_read(m);
+
+    int p[2];
+    CHECK(pipe(p) == 0);
+    interp::context c{m};
+    c.attach_file(p[0]);
+    CHECK_EQ(interp::i64(c.run()), -interp::i64(EOPNOTSUPP));
+    close(p[0]);
+    close(p[1]);
+}
+
+/// Destroying or resetting a context that is blocked on a read that never
+/// completes must cancel it instead of hanging or leaving the kernel to
+/// write into freed memory.
+TEST(cancel_blocked_read) {
+    auto io = std::make_shared<interp::io_service>();
+    interp::module m;
+    m.defun_io(io);
+    create_read(m);
+
+    int p[2];
+    CHECK(pipe(p) == 0);
+    for (int round = 0; round < 3; round++) {
+        interp::context c{m};
+        c.attach_file(p[0]);
+        auto st = c.run_until_blocked();
+        if (io->get_backend() == interp::io_service::backend::io_uring) CHECK(st == interp::run_status::blocked);
+        c.reset();
+    }
+
+    for (int round = 0; round < 3; round++) {
+        interp::context c{m};
+        c.attach_file(p[0]);
+        c.run_until_blocked();
+    }
+
+    close(p[0]);
+    close(p[1]);
+}
+
+TEST(guests_only_use_attached_files) {
+    auto io = std::make_shared<interp::io_service>();
+    interp::module m;
+    m.defun_io(io);
+    create_read(m);
+    interp::context c{m};
+    CHECK_THROWS_WITH("Invalid file handle", c.run());
+}
@@ -0,0 +1,134 @@
+#include "test.hh"
+
+using namespace interp::literals;
+
+namespace {
+/// Emit instructions that take up space.
+void pad(interp::module& m, int n) {
+    for (int k = 0; k < n; k++) m.create_move(20_r, 0x123456789abc_w);
+}
+
+/// Sum of the multiples of 3 below 100 (1683), plus 15 from a helper that
+/// catches an exception, plus 3000 from the default case of a switch.
+constexpr interp::word expected = 1683 + 15 + 3000;
+
+/// Build a program with forward and backward branches to labels, a call,
+/// a switch, and a try region, all of which are affected by moving code.
+void build(interp::module& m) {
+    m.create_move(10_r, 0_w);
+    m.create_move(11_r, 0_w);
+    auto loop = m.create_label(), skip = m.create_label(), after = m.create_label();
+    m.bind(loop);
+    m.create_remu(12_r, 11_r, 3_w);
+    m.create_branch_ifnz(12_r, skip);
+    m.create_add(10_r, 10_r, 11_r);
+    pad(m, 20);
+    m.bind(skip);
+    m.create_add(11_r, 11_r, 1_w);
+    m.create_sub(13_r, 11_r, 100_w);
+    m.create_branch_ifnz(13_r, loop);
+    m.create_call("helper");
+    m.create_add(10_r, 10_r, 1_r);
+    m.create_branch(after);
+    pad(m, 3);
+    auto case0 = m.current_addr();
+    m.create_add(10_r, 10_r, 1000_w);
+    m.create_move(1_r, 10_r);
+    m.create_return();
+    auto case1 = m.current_addr();
+    m.create_add(10_r, 10_r, 2000_w);
+    m.create_move(1_r, 10_r);
+    m.create_return();
+    auto fallback = m.current_addr();
+    m.create_add(10_r, 10_r, 3000_w);
+    m.create_move(1_r, 10_r);
+    m.create_return();
+    m.bind(after);
+    m.create_remu(14_r, 10_r, 4_w);
+    m.create_switch(14_r, {{0, case0}, {1, case1}}, fallback);
+
+    m.create_function("helper");
+    auto done = m.create_label();
+    auto try_begin = m.current_addr();
+    m.create_move(2_r, 5_w);
+    m.create_throw(2_r);
+    auto try_end = m.current_addr();
+    m.create_branch(done);
+    pad(m, 2);
+    auto handler = m.current_addr();
+    m.create_add(1_r, 1_r, 10_w);
+    m.bind(done);
+    m.create_return();
+    m.create_try(try_begin, try_end, handler);
+}
+} // namespace
+
+TEST(runs_without_relaxing) {
+    interp::interpreter i;
+    build(i);
+    CHECK_EQ(i.run(), expected);
+}
+
+TEST(relax_shrinks_code) {
+    interp::interpreter i;
+    build(i);
+    auto before = i.current_addr();
+    i.relax();
+    CHECK(i.current_addr() < before);
+    CHECK_EQ(i.run(), expected);
+}
+
+/// Reading a module must never move its code.
+TEST(reading_does_not_move_code) {
+    interp::interpreter i;
+    build(i);
+    auto size = i.current_addr();
+    CHECK(not i.disassemble().empty());
+    CHECK(not i.serialize().empty());
+    i.finalize();
+    CHECK_EQ(i.current_addr(), size);
+
+    /// Unrelaxed code survives a round trip.
+    interp::module copy;
+    copy.deserialize(i.serialize());
+    interp::context c{copy};
+    CHECK_EQ(c.run(), expected);
+}
+
+/// Once a context has started, code must stay where it is.
+TEST(relax_after_start_does_not_move_code) {
+    interp::interpreter i;
+    build(i);
+    CHECK_EQ(i.run(), expected);
+    auto size = i.current_addr();
+    i.relax();
+    CHECK_EQ(i.current_addr(), size);
+    CHECK_EQ(i.run(), expected);
+}
+
+TEST(indirect_branches_keep_code_in_place) {
+    interp::interpreter i;
+    build(i);
+    i.create_function("unused");
+    i.create_branch_indirect(20_r);
+    auto size = i.current_addr();
+    i.relax();
+    CHECK_EQ(i.current_addr(), size);
+    CHECK_EQ(i.run(), expected);
+}
+
+TEST(unbound_labels) {
+    interp::interpreter i;
+    auto l = i.create_label();
+    i.create_branch(l);
+    CHECK_THROWS_WITH("never bound", i.run());
+    CHECK_THROWS_WITH("never bound", i.relax());
+    CHECK_THROWS_WITH("never bound", i.serialize());
+    i.create_move(1_r, 1_w);
+    i.create_return();
+    i.bind(l);
+    i.create_move(1_r, 2_w);
+    i.create_return();
+    CHECK_EQ(i.run(), 2u);
+    CHECK_THROWS_WITH("already bound", i.bind(l));
+}
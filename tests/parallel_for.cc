@@ -0,0 +1,47 @@
+#include "test.hh"
+
+using namespace interp::literals;
+
+namespace {
+/// Run parallel_for over [0, 80) with a chunk function that returns
+/// its start minus 40, so that the first chunks return negative values.
+interp::word reduce(interp::reduction op) {
+    interp::interpreter i;
+    i.max_guest_threads = 8;
+    i.create_function("chunk");
+    i.create_sub(1_r, 2_r, 40_w);
+    i.create_return();
+    i.create_function("main");
+    i.create_move(10_r, interp::word(i.function_index("chunk")));
+    i.create_move(11_r, 0_w);
+    i.create_move(12_r, 80_w);
+    i.create_parallel_for(1_r, 10_r, 11_r, 12_r, op);
+    i.create_return();
+    return i.run(i.function_index("main"));
+}
+} // namespace
+
+TEST(reductions) {
+    CHECK_EQ(reduce(interp::reduction::none), 0u);
+    CHECK_EQ(interp::i64(reduce(interp::reduction::add)), -40 + -30 + -20 + -10 + 0 + 10 + 20 + 30);
+    CHECK_EQ(interp::i64(reduce(interp::reduction::min_signed)), -40);
+    CHECK_EQ(interp::i64(reduce(interp::reduction::max_signed)), 30);
+
+    /// The unsigned variants treat negative values as huge.
+    CHECK_EQ(reduce(interp::reduction::min), 0u);
+    CHECK_EQ(interp::i64(reduce(interp::reduction::max)), -10);
+}
+
+TEST(chunk_errors_are_rethrown) {
+    interp::interpreter i;
+    i.create_function("bad");
+    i.create_move(5_r, 7_w);
+    i.create_throw(5_r);
+    i.create_function("main");
+    i.create_move(10_r, interp::word(i.function_index("bad")));
+    i.create_move(11_r, 0_w);
+    i.create_move(12_r, 100_w);
+    i.create_parallel_for(1_r, 10_r, 11_r, 12_r);
+    i.create_return();
+    CHECK_THROWS(i.run(i.function_index("main")));
+}
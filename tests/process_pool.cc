@@ -0,0 +1,88 @@
+#include "test.hh"
+
+#include <csignal>
+#include <interpreter/process_pool.hh>
+#include <string>
+#include <unistd.h>
+
+using namespace interp::literals;
+
+namespace {
+void create_module(interp::module& m) {
+    m.create_return();
+
+    /// r1 = r2 * r2 + r3.
+    m.create_function("square");
+    m.create_mulu(1_r, 2_r, 2_r);
+    m.create_add(1_r, 1_r, 3_r);
+    m.create_return();
+
+    m.create_function("crash");
+    m.create_call("crash_natively");
+    m.create_return();
+
+    m.create_function("fail");
+    m.create_call("fail_natively");
+    m.create_return();
+
+    m.create_function("pid");
+    m.create_call("getpid");
+    m.create_return();
+}
+
+void setup(interp::module& m) {
+    m.defun("crash_natively", [](interp::context&) { std::raise(SIGKILL); });
+    m.defun("fail_natively", [](interp::context&) { throw interp::error("{}", std::string(2000, 'x')); });
+    m.defun("getpid", [](interp::context& c) { c.set_return_value(interp::word(getpid())); });
+}
+} // namespace
+
+TEST(runs_in_workers) {
+    interp::module m;
+    create_module(m);
+    interp::process_pool pool{m, 2, setup, 8};
+    CHECK_EQ(pool.submit("square", {9, 1}).get(), 82u);
+    CHECK(pool.submit("pid").get() != interp::word(getpid()));
+    CHECK_THROWS_WITH("xxx", pool.submit("fail").get());
+    CHECK_THROWS(pool.submit("nope"));
+}
+
+/// The run that kills its worker fails; everything sent along with it
+/// is run again on the new worker.
+TEST(crashed_worker_is_replaced) {
+    interp::module m;
+    create_module(m);
+    interp::process_pool pool{m, 1, setup, 16};
+    std::vector<std::future<interp::word>> before, after;
+    for (interp::word i = 0; i < 100; i++) before.push_back(pool.submit("square", {i, 1}));
+    auto crash = pool.submit("crash");
+    for (interp::word i = 0; i < 100; i++) after.push_back(pool.submit("square", {i, 2}));
+
+    for (interp::word i = 0; i < 100; i++) CHECK_EQ(before[i].get(), i * i + 1);
+    for (interp::word i = 0; i < 100; i++) CHECK_EQ(after[i].get(), i * i + 2);
+    CHECK_THROWS_WITH("was killed by signal", crash.get());
+
+    auto stats = pool.get_metrics();
+    CHECK_EQ(stats.respawned, 1u);
+    CHECK_EQ(stats.failed, 1u);
+    CHECK_EQ(stats.completed, 200u);
+}
+
+/// Frames bigger than the socket buffers in both directions at once must
+/// not deadlock the host and the worker.
+TEST(large_frames) {
+    interp::module m;
+    create_module(m);
+    interp::process_pool pool{m, 2, setup, 64};
+    std::vector<interp::word> args(60, 1);
+    std::vector<std::future<interp::word>> results;
+    for (int i = 0; i < 2000; i++) results.push_back(pool.submit(i % 2 ? "fail" : "square", args));
+
+    interp::usz failed = 0;
+    for (int i = 0; i < 2000; i++) {
+        if (i % 2) failed += interp::test::throws([&] { results[interp::usz(i)].get(); });
+        else CHECK_EQ(results[interp::usz(i)].get(), 2u);
+    }
+
+    CHECK_EQ(failed, interp::usz(1000));
+}
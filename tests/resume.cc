@@ -0,0 +1,73 @@
+#include "test.hh"
+
+using namespace interp::literals;
+
+namespace {
+/// Sum the numbers below 1000 in a loop, calling a helper for each one so
+/// that every iteration takes a few ticks.
+void build(interp::module& m) {
+    m.create_move(10_r, 0_w);
+    m.create_move(11_r, 0_w);
+    auto loop = m.current_addr();
+    m.create_move(2_r, 11_r);
+    m.create_call("identity");
+    m.create_add(10_r, 10_r, 1_r);
+    m.create_add(11_r, 11_r, 1_w);
+    m.create_sub(12_r, 11_r, 1000_w);
+    m.create_branch_ifnz(12_r, loop);
+    m.create_move(1_r, 10_r);
+    m.create_return();
+
+    m.create_function("identity");
+    m.create_move(1_r, 2_r);
+    m.create_return();
+}
+
+constexpr interp::word expected = 999 * 1000 / 2;
+} // namespace
+
+TEST(slices_add_up_to_a_full_run) {
+    interp::interpreter i;
+    build(i);
+    CHECK_EQ(i.run(), expected);
+
+    interp::usz slices = 1;
+    auto status = i.run_for(50);
+    while (status == interp::run_status::suspended) {
+        CHECK_THROWS_WITH("not finished", i.result());
+        status = i.resume(50);
+        slices++;
+    }
+
+    CHECK(status == interp::run_status::finished);
+    CHECK(slices > 10);
+    CHECK_EQ(i.result(), expected);
+}
+
+TEST(resume_needs_a_suspended_run) {
+    interp::interpreter i;
+    build(i);
+    CHECK_THROWS_WITH("no suspended run", i.resume());
+    CHECK(i.run_for(~0ull) == interp::run_status::finished);
+    CHECK_THROWS_WITH("no suspended run", i.resume());
+}
+
+/// A zero budget leaves the run suspended without running anything.
+TEST(zero_budget) {
+    interp::interpreter i;
+    build(i);
+    CHECK(i.run_for(1) == interp::run_status::suspended);
+    CHECK(i.resume(0) == interp::run_status::suspended);
+    CHECK(i.resume() == interp::run_status::finished);
+    CHECK_EQ(i.result(), expected);
+}
+
+/// An interrupted run keeps its state and can be continued.
+TEST(interrupt_then_resume) {
+    interp::interpreter i;
+    build(i);
+    i.interrupt();
+    CHECK(i.run_for(~0ull) == interp::run_status::cancelled);
+    CHECK(i.resume() == interp::run_status::finished);
+    CHECK_EQ(i.result(), expected);
+}
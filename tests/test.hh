@@ -0,0 +1,98 @@
+#ifndef INTERPRETER_TESTS_TEST_HH
+#define INTERPRETER_TESTS_TEST_HH
+
+#include <cstdlib>
+#include <fmt/format.h>
+#include <functional>
+#include <interpreter/interp.hh>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Minimal test harness. Each test file defines a number of cases with
+/// TEST(); main() runs all of them and fails if any check failed.
+namespace interp::test {
+struct test_case {
+    std::string_view name;
+    void (*run)();
+};
+
+inline std::vector<test_case>& cases() {
+    static std::vector<test_case> all;
+    return all;
+}
+
+inline int failures = 0;
+
+struct registrar {
+    registrar(std::string_view name, void (*run)()) { cases().push_back({name, run}); }
+};
+
+/// Run \c f and return whether it threw an exception of type \c E.
+template <typename E = std::exception, typename F>
+bool throws(F&& f) {
+    try {
+        std::invoke(std::forward<F>(f));
+    } catch (const E&) {
+        return true;
+    }
+    return false;
+}
+
+/// Run \c f and return the message of the exception it threw, if any.
+template <typename F>
+std::string error_message(F&& f) {
+    try {
+        std::invoke(std::forward<F>(f));
+    } catch (const std::exception& e) {
+        return e.what();
+    }
+    return "";
+}
+} // namespace interp::test
+
+#define INTERP_TEST_CAT_IMPL(a, b) a##b
+#define INTERP_TEST_CAT(a, b) INTERP_TEST_CAT_IMPL(a, b)
+
+#define TEST(name)                                                                                                  \
+    static void INTERP_TEST_CAT(test_, name)();                                                                     \
+    static const ::interp::test::registrar INTERP_TEST_CAT(register_, name){#name, INTERP_TEST_CAT(test_, name)}; \
+    static void INTERP_TEST_CAT(test_, name)()
+
+#define CHECK(...)                                                                                     \
+    do {                                                                                               \
+        if (not(__VA_ARGS__)) {                                                                        \
+            fmt::print(stderr, "{}:{}: check failed: {}\n", __FILE__, __LINE__, #__VA_ARGS__);         \
+            ::interp::test::failures++;                                                                \
+        }                                                                                              \
+    } while (0)
+
+#define CHECK_EQ(a, b)                                                                                              \
+    do {                                                                                                            \
+        auto&& check_lhs = (a);                                                                                     \
+        auto&& check_rhs = (b);                                                                                     \
+        if (not(check_lhs == check_rhs)) {                                                                          \
+            fmt::print(stderr, "{}:{}: check failed: {} == {} ({} vs {})\n", __FILE__, __LINE__, #a, #b, check_lhs, check_rhs); \
+            ::interp::test::failures++;                                                                             \
+        }                                                                                                           \
+    } while (0)
+
+#define CHECK_THROWS(...) CHECK(::interp::test::throws([&] { __VA_ARGS__; }))
+#define CHECK_THROWS_WITH(message, ...) \
+    CHECK(::interp::test::error_message([&] { __VA_ARGS__; }).contains(message))
+
+int main() {
+    for (auto& c : ::interp::test::cases()) {
+        auto before = ::interp::test::failures;
+        try {
+            c.run();
+        } catch (const std::exception& e) {
+            fmt::print(stderr, "{}: uncaught exception: {}\n", c.name, e.what());
+            ::interp::test::failures++;
+        }
+        fmt::print("{} {}\n", ::interp::test::failures == before ? "PASS" : "FAIL", c.name);
+    }
+    return ::interp::test::failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif // INTERPRETER_TESTS_TEST_HH